@@ -11,7 +11,8 @@ namespace MiniDNN
 		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 
 	public:
-		static inline void activate(const Matrix& Z, Matrix& A) { A.noalias() = Z; }
+		template <typename MatrixType>
+		static inline void activate(const MatrixType& Z, MatrixType& A) { A.noalias() = Z; }
 
 		static inline void apply_jacobian(const Matrix& Z, const Matrix& A, const Matrix& F, Matrix& G)
 		{
@@ -11,9 +11,10 @@ namespace MiniDNN
 		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 
 	public:
-		static inline void activate(const Matrix& Z, Matrix& A)
+		template <typename MatrixType>
+		static inline void activate(const MatrixType& Z, MatrixType& A)
 		{
-			Matrix S = (-Z.array().abs()).exp();
+			MatrixType S = (-Z.array().abs()).exp();
 			A.array() = (S.array() + Scalar(1)).square();
 			S.noalias() = (Z.array() >= Scalar(0)).select(S.cwiseAbs2(), Scalar(1));
 			A.array() = (A.array() - S.array()) / (A.array() + S.array());
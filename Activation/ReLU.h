@@ -11,7 +11,8 @@ namespace MiniDNN
 		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 
 	public:
-		static inline void activation(const Matrix& Z, Matrix& A)
+		template <typename MatrixType>
+		static inline void activate(const MatrixType& Z, MatrixType& A)
 		{ A.array() = Z.array().cwiseMax(Scalar(0)); }
 
 		static inline void apply_jacobian(const Matrix& Z, const Matrix& A, const Matrix& F, Matrix& G)
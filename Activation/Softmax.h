@@ -12,10 +12,11 @@ namespace MiniDNN
 		typedef Eigen::Array<Scalar, 1, Eigen::Dynamic> RowArray;
 
 	public:
-		static inline void activation(const Matrix& Z, Matrix& A)
+		template <typename MatrixType>
+		static inline void activate(const MatrixType& Z, MatrixType& A)
 		{
 			A.array() = (Z.rowwise() - Z.colwise().maxCoeff()).array().exp();
-			RowArray colsums = A.colwise().sum();
+			Eigen::Array<Scalar, 1, MatrixType::ColsAtCompileTime> colsums = A.colwise().sum();
 			A.array().rowwise() /= colsums;
 		}
 
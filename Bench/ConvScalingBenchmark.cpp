@@ -0,0 +1,85 @@
+// Thread scaling of the convolution kernels
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. ConvScalingBenchmark.cpp -o conv_scaling_benchmark
+//
+// Usage:
+//     conv_scaling_benchmark [max_threads=16] [batch_size=64] [repeats=5]
+//
+// Times forward() and backprop() of Convolutional layers of a few typical shapes
+// with 1, 2, 4, ... up to max_threads threads in the shared pool, and prints the
+// speedup over one thread. The speedup is only meaningful up to the number of
+// physical cores of the machine.
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstdlib>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef std::chrono::steady_clock Clock;
+
+// Best time in milliseconds of forward() plus backprop() over 'repeats' runs
+static double time_layer(Layer& layer, const Matrix& x, const Matrix& grad, const int repeats)
+{
+	double best = 1e100;
+	for (int i = 0; i < repeats; i++)
+	{
+		const Clock::time_point t0 = Clock::now();
+		layer.forward(x);
+		layer.backprop(x, grad);
+		best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+	}
+
+	return best;
+}
+
+int main(int argc, char* argv[])
+{
+	const int max_threads = argc > 1 ? std::atoi(argv[1]) : 16;
+	const int nobs = argc > 2 ? std::atoi(argv[2]) : 64;
+	const int repeats = argc > 3 ? std::atoi(argv[3]) : 5;
+
+	std::vector<int> nthreads;
+	for (int n = 1; n <= max_threads; n *= 2)
+		nthreads.push_back(n);
+
+	// in_channels, out_channels, image size, window size
+	const int shapes[][4] = { { 3, 32, 32, 3 }, { 16, 32, 28, 3 }, { 32, 64, 14, 3 }, { 64, 128, 8, 3 } };
+
+	std::cout << "Batch size " << nobs << ", forward + backprop in ms (speedup)\n"
+			  << "Layer                 ";
+	for (std::size_t t = 0; t < nthreads.size(); t++)
+		std::cout << std::setw(9) << nthreads[t] << " thr    ";
+	std::cout << "\n";
+
+	for (int s = 0; s < 4; s++)
+	{
+		const int in = shapes[s][0], out = shapes[s][1], size = shapes[s][2], window = shapes[s][3];
+		Convolutional<ReLU> layer(size, size, in, out, window, window);
+		RNG rng(1);
+		layer.init(0, 0.01, rng);
+		const Matrix x = Matrix::Random(layer.in_size(), nobs);
+		const Matrix grad = Matrix::Random(layer.out_size(), nobs);
+
+		std::cout << std::setw(3) << in << "x" << std::setw(2) << size << "x" << std::setw(2) << size
+				  << " -> " << std::setw(3) << out << " " << window << "x" << window << "  ";
+		double serial = 0;
+		for (std::size_t t = 0; t < nthreads.size(); t++)
+		{
+			internal::set_num_threads(nthreads[t]);
+			const double ms = time_layer(layer, x, grad, repeats);
+			if (t == 0)
+				serial = ms;
+			std::cout << std::fixed << std::setprecision(2) << std::setw(9) << ms
+					  << " (" << std::setw(5) << serial / ms << ")";
+		}
+		std::cout << "\n";
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+// Hogwild versus synchronous training, loss against wall-clock time
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. HogwildBenchmark.cpp -o hogwild_benchmark
+//
+// Usage:
+//     hogwild_benchmark [threads=4] [epochs=5] [batch_size=32] [observations=8192]
+//
+// A wide fully connected classifier is trained on sparse synthetic inputs, once with
+// Network::fit() and once with fit_hogwild(), starting from the same parameters.
+// The loss on the training data after each epoch is printed next to the training
+// time. Synchronous training uses the global thread pool inside each batch, sized
+// by the MDNN_NUM_THREADS environment variable.
+
+#include <iostream>
+#include <cstdlib>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static void build(Network& net, const int in_size, const int nclass)
+{
+	net.add_layer(new FullyConnected<ReLU>(in_size, 1024));
+	net.add_layer(new FullyConnected<Softmax>(1024, nclass));
+	net.set_output(new MultiClassEntropy());
+	net.init(0, 0.01, 123);
+}
+
+int main(int argc, char* argv[])
+{
+	const int nthread = argc > 1 ? std::atoi(argv[1]) : 4;
+	const int epoch = argc > 2 ? std::atoi(argv[2]) : 5;
+	const int batch_size = argc > 3 ? std::atoi(argv[3]) : 32;
+	const int nobs = argc > 4 ? std::atoi(argv[4]) : 8192;
+	const int in_size = 4096, nclass = 10;
+
+	// About 2% of the inputs are non-zero, and the classes come from a fixed
+	// random linear map
+	RNG rng(1);
+	Matrix x = Matrix::Zero(in_size, nobs);
+	for (int j = 0; j < nobs; j++)
+	{
+		for (int k = 0; k < in_size / 50; k++)
+		{
+			x(int(rng.rand() * in_size) % in_size, j) = 1;
+		}
+	}
+	const Matrix map = Matrix::Random(nclass, in_size);
+	const Matrix score = map * x;
+	Matrix y = Matrix::Zero(nclass, nobs);
+	for (int j = 0; j < nobs; j++)
+	{
+		Matrix::Index c;
+		score.col(j).maxCoeff(&c);
+		y(c, j) = 1;
+	}
+
+	SGD opt(0.1);
+
+	Network sync;
+	build(sync, in_size, nclass);
+	const std::vector<ConvergencePoint> sync_trace = fit_traced(sync, opt, x, y, batch_size, epoch, 1);
+
+	Network hogwild;
+	build(hogwild, in_size, nclass);
+	const std::vector<ConvergencePoint> hogwild_trace = fit_hogwild(hogwild, opt, x, y, batch_size, epoch, nthread, 1);
+
+	std::cout << "Hogwild threads: " << nthread << ", batch size: " << batch_size << std::endl;
+	convergence_summary(std::cout, sync_trace, hogwild_trace);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,120 @@
+// Channels-first versus channels-last benchmark
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. LayoutBenchmark.cpp -o layout_benchmark
+//
+// Usage:
+//     layout_benchmark [batch_size=32] [repeats=5]
+//
+// Times forward() and backprop() of Convolutional and MaxPooling layers of a few
+// typical shapes in both layouts, and the conversion of the input at the network
+// boundary. The MDNN_NUM_THREADS environment variable sets the number of threads.
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <chrono>
+#include <cstdlib>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef std::chrono::steady_clock Clock;
+
+// Best time in milliseconds of forward() and of backprop() over 'repeats' runs
+static void time_layer(Layer& layer, const Matrix& x, const int repeats, double& fwd, double& bwd)
+{
+	Matrix grad = Matrix::Random(layer.out_size(), x.cols());
+	fwd = bwd = 1e100;
+
+	for (int i = 0; i < repeats; i++)
+	{
+		const Clock::time_point t0 = Clock::now();
+		layer.forward(x);
+		const Clock::time_point t1 = Clock::now();
+		layer.backprop(x, grad);
+		const Clock::time_point t2 = Clock::now();
+
+		fwd = std::min(fwd, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		bwd = std::min(bwd, std::chrono::duration<double, std::milli>(t2 - t1).count());
+	}
+}
+
+static void report(const std::string& name, const double first_fwd, const double first_bwd,
+				   const double last_fwd, const double last_bwd)
+{
+	std::cout << std::left << std::setw(34) << name << std::right << std::fixed << std::setprecision(2)
+			  << std::setw(10) << first_fwd << std::setw(10) << first_bwd
+			  << std::setw(10) << last_fwd << std::setw(10) << last_bwd
+			  << std::setw(9) << (first_fwd + first_bwd) / (last_fwd + last_bwd) << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+	const int nobs = argc > 1 ? std::atoi(argv[1]) : 32;
+	const int repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+
+	// in_channels, out_channels, image size, window size
+	const int conv_shapes[][4] = {
+		{ 1, 16, 28, 5 }, { 3, 32, 32, 3 }, { 16, 32, 28, 3 }, { 32, 64, 14, 3 },
+		{ 64, 64, 14, 3 }, { 64, 128, 7, 3 }, { 64, 64, 28, 1 }, { 128, 256, 7, 1 }
+	};
+	// channels, image size, pooling size
+	const int pool_shapes[][3] = { { 16, 28, 2 }, { 64, 14, 2 }, { 256, 8, 2 } };
+
+	std::cout << "batch " << nobs << ", threads " << internal::thread_pool().size() << ", times in ms\n"
+			  << std::left << std::setw(34) << "layer" << std::right
+			  << std::setw(10) << "CF fwd" << std::setw(10) << "CF bwd"
+			  << std::setw(10) << "CL fwd" << std::setw(10) << "CL bwd" << std::setw(9) << "CF/CL" << "\n";
+
+	for (const int* s : conv_shapes)
+	{
+		const int in = s[0], out = s[1], size = s[2], window = s[3];
+		Convolutional<ReLU> first(size, size, in, out, window, window);
+		Convolutional<ReLU> last(size, size, in, out, window, window, internal::CHANNELS_LAST);
+		RNG rng(1);
+		first.init(0, 0.1, rng);
+		last.init();
+		last.set_parameters(first.get_parameters());
+
+		Matrix x = Matrix::Random(first.in_size(), nobs);
+		double ffwd, fbwd, lfwd, lbwd;
+		time_layer(first, x, repeats, ffwd, fbwd);
+		time_layer(last, x, repeats, lfwd, lbwd);
+
+		report("Convolutional " + std::to_string(in) + "->" + std::to_string(out) + " " + std::to_string(size) +
+			   "x" + std::to_string(size) + " w" + std::to_string(window), ffwd, fbwd, lfwd, lbwd);
+	}
+
+	for (const int* s : pool_shapes)
+	{
+		const int channels = s[0], size = s[1], pool = s[2];
+		MaxPooling first(size, size, channels, pool, pool);
+		MaxPooling last(size, size, channels, pool, pool, internal::CHANNELS_LAST);
+		first.set_gradient_need(false, true);
+		last.set_gradient_need(false, true);
+
+		Matrix x = Matrix::Random(first.in_size(), nobs);
+		double ffwd, fbwd, lfwd, lbwd;
+		time_layer(first, x, repeats, ffwd, fbwd);
+		time_layer(last, x, repeats, lfwd, lbwd);
+
+		report("MaxPooling " + std::to_string(channels) + " " + std::to_string(size) + "x" + std::to_string(size) +
+			   " p" + std::to_string(pool), ffwd, fbwd, lfwd, lbwd);
+	}
+
+	// Converting a batch of 3-channel 224x224 images at the network boundary
+	const int channels = 3, npixel = 224 * 224;
+	Matrix x = Matrix::Random(channels * npixel, nobs), y(channels * npixel, nobs);
+	double best = 1e100;
+	for (int i = 0; i < repeats; i++)
+	{
+		const Clock::time_point t0 = Clock::now();
+		internal::to_channels_last(x.data(), channels, npixel, nobs, y.data());
+		best = std::min(best, std::chrono::duration<double, std::milli>(Clock::now() - t0).count());
+	}
+	std::cout << "to_channels_last 3x224x224 " << std::fixed << std::setprecision(2) << best << " ms\n";
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,75 @@
+// Pipeline-parallel versus serial training of a deep convolutional stack
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. PipelineBenchmark.cpp -o pipeline_benchmark
+//
+// Usage:
+//     pipeline_benchmark [max_stages=4] [micro_batches=8] [batch_size=64] [batches=8]
+//
+// Times one epoch of Network::fit() and of Network::fit_pipeline() with 1, 2, ...,
+// max_stages stages on the same data. Run with MDNN_NUM_THREADS=1 to compare the
+// pipeline against a single thread that runs the batch layer by layer.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef std::chrono::steady_clock Clock;
+
+static void build(Network& net)
+{
+	net.add_layer(new Convolutional<ReLU>(32, 32, 3, 16, 3, 3));
+	net.add_layer(new Convolutional<ReLU>(30, 30, 16, 16, 3, 3));
+	net.add_layer(new Convolutional<ReLU>(28, 28, 16, 16, 3, 3));
+	net.add_layer(new Convolutional<ReLU>(26, 26, 16, 16, 3, 3));
+	net.add_layer(new Convolutional<ReLU>(24, 24, 16, 16, 3, 3));
+	net.add_layer(new Convolutional<ReLU>(22, 22, 16, 16, 3, 3));
+	net.add_layer(new MaxPooling(20, 20, 16, 2, 2));
+	net.add_layer(new FullyConnected<Softmax>(10 * 10 * 16, 10));
+	net.set_output(new MultiClassEntropy());
+	net.init(0, 0.01, 123);
+}
+
+int main(int argc, char* argv[])
+{
+	const int max_stages = argc > 1 ? std::atoi(argv[1]) : 4;
+	const int nmicro = argc > 2 ? std::atoi(argv[2]) : 8;
+	const int batch_size = argc > 3 ? std::atoi(argv[3]) : 64;
+	const int nbatch = argc > 4 ? std::atoi(argv[4]) : 8;
+	const int nobs = batch_size * nbatch;
+
+	Matrix x = Matrix::Random(32 * 32 * 3, nobs);
+	Matrix y = Matrix::Zero(10, nobs);
+	for (int j = 0; j < nobs; j++)
+	{
+		y(j % 10, j) = 1;
+	}
+
+	SGD opt(0.01);
+	Network serial;
+	build(serial);
+	Clock::time_point t0 = Clock::now();
+	serial.fit(opt, x, y, batch_size, 1, 1);
+	const double serial_ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count() / nbatch;
+
+	std::cout << "Micro-batches: " << nmicro << ", batch size: " << batch_size << std::endl;
+	std::cout << "Stages  ms/batch  Speedup" << std::endl;
+	std::cout << std::fixed << std::setprecision(2)
+			  << std::setw(6) << "fit" << std::setw(10) << serial_ms << std::setw(9) << 1.0 << std::endl;
+	for (int nstage = 1; nstage <= max_stages; nstage++)
+	{
+		Network net;
+		build(net);
+		t0 = Clock::now();
+		net.fit_pipeline(opt, x, y, batch_size, 1, nstage, nmicro, 1);
+		const double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count() / nbatch;
+		std::cout << std::setw(6) << nstage << std::setw(10) << ms << std::setw(9) << serial_ms / ms << std::endl;
+	}
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,109 @@
+// Full precision versus bfloat16 weights and activations
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. PrecisionBenchmark.cpp -o precision_benchmark
+//
+// Usage:
+//     precision_benchmark [batch_size=256] [repeats=5]
+//
+// Times forward() and backprop() of FullyConnected layers of a few sizes with full
+// precision and with bfloat16 weights (Network::set_parameter_storage()), and one
+// epoch of training of a multi-layer perceptron with each combination of weight
+// and activation storage. The final training loss shows the cost in accuracy.
+// The MDNN_NUM_THREADS environment variable sets the number of threads.
+
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <cstdlib>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+typedef std::chrono::steady_clock Clock;
+
+// Best time in milliseconds of forward() and of backprop() over 'repeats' runs
+static void time_layer(Layer& layer, const Matrix& x, const int repeats, double& fwd, double& bwd)
+{
+	Matrix grad = Matrix::Random(layer.out_size(), x.cols());
+	fwd = bwd = 1e100;
+
+	for (int i = 0; i < repeats; i++)
+	{
+		const Clock::time_point t0 = Clock::now();
+		layer.forward(x);
+		const Clock::time_point t1 = Clock::now();
+		layer.backprop(x, grad);
+		const Clock::time_point t2 = Clock::now();
+
+		fwd = std::min(fwd, std::chrono::duration<double, std::milli>(t1 - t0).count());
+		bwd = std::min(bwd, std::chrono::duration<double, std::milli>(t2 - t1).count());
+	}
+}
+
+static void build(Network& net, const int param_storage, const int activation_storage)
+{
+	net.add_layer(new FullyConnected<ReLU>(1024, 2048));
+	net.add_layer(new FullyConnected<ReLU>(2048, 2048));
+	net.add_layer(new FullyConnected<Identity>(2048, 16));
+	net.set_output(new RegressionMSE());
+	net.set_parameter_storage(param_storage);
+	net.set_activation_storage(activation_storage);
+	net.init(0, 0.02, 123);
+}
+
+int main(int argc, char* argv[])
+{
+	const int batch_size = argc > 1 ? std::atoi(argv[1]) : 256;
+	const int repeats = argc > 2 ? std::atoi(argv[2]) : 5;
+
+	std::cout << "FullyConnected, batch size " << batch_size << ", times in ms" << std::endl;
+	std::cout << "   in   out   fp64 fwd   bf16 fwd   fp64 bwd   bf16 bwd" << std::endl;
+	const int sizes[][2] = { { 1024, 1024 }, { 2048, 2048 }, { 4096, 1024 }, { 1024, 4096 } };
+	for (int k = 0; k < 4; k++)
+	{
+		const int in = sizes[k][0], out = sizes[k][1];
+		FullyConnected<ReLU> full(in, out), bf16(in, out);
+		RNG rng(1);
+		full.init(0, 0.02, rng);
+		bf16.init();
+		bf16.set_parameters(full.get_parameters());
+		bf16.set_parameter_storage(internal::BFLOAT16);
+
+		const Matrix x = Matrix::Random(in, batch_size);
+		double full_fwd, full_bwd, bf16_fwd, bf16_bwd;
+		time_layer(full, x, repeats, full_fwd, full_bwd);
+		time_layer(bf16, x, repeats, bf16_fwd, bf16_bwd);
+		std::cout << std::fixed << std::setprecision(2)
+				  << std::setw(5) << in << std::setw(6) << out
+				  << std::setw(11) << full_fwd << std::setw(11) << bf16_fwd
+				  << std::setw(11) << full_bwd << std::setw(11) << bf16_bwd << std::endl;
+	}
+
+	const int nobs = 8 * batch_size;
+	const Matrix x = Matrix::Random(1024, nobs);
+	const Matrix y = (Matrix::Random(16, 1024) * x / 32).array().tanh().matrix();
+	const char* names[] = { "fp64", "half", "bf16" };
+
+	std::cout << std::endl << "Training, one epoch of " << nobs << " observations" << std::endl;
+	std::cout << "Weights  Activations  ms/batch      Loss" << std::endl;
+	const int configs[][2] = { { internal::FULL_PRECISION, internal::FULL_PRECISION },
+							   { internal::BFLOAT16, internal::FULL_PRECISION },
+							   { internal::FULL_PRECISION, internal::BFLOAT16 },
+							   { internal::BFLOAT16, internal::BFLOAT16 } };
+	for (int k = 0; k < 4; k++)
+	{
+		Network net;
+		build(net, configs[k][0], configs[k][1]);
+		SGD opt(0.01);
+		const Clock::time_point t0 = Clock::now();
+		net.fit(opt, x, y, batch_size, 1, 1);
+		const double ms = std::chrono::duration<double, std::milli>(Clock::now() - t0).count() / 8;
+		std::cout << std::setw(7) << names[configs[k][0]] << std::setw(13) << names[configs[k][1]]
+				  << std::fixed << std::setprecision(2) << std::setw(10) << ms
+				  << std::setprecision(6) << std::setw(10) << net.loss(x, y) << std::endl;
+	}
+
+	return 0;
+}
\ No newline at end of file
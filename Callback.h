@@ -1 +1,31 @@
 #pragma once
+
+namespace MiniDNN
+{
+	class Network;
+
+	///
+	/// Hooks into the training loop of Network::fit()
+	///
+	/// The default implementation does nothing. Derived classes can, for example,
+	/// start communicating the gradients of a layer while backprop() continues with
+	/// the layers below it.
+	///
+	class Callback
+	{
+	public:
+		virtual ~Callback() {}
+
+		// backprop() has computed the parameter gradients of the trainable layer
+		// 'layer'. The layers are visited from the last to the first
+		virtual void gradients_ready(Network& net, const int layer) {}
+
+		// All the gradients of the batch are ready, and update() runs next
+		virtual void pre_update(Network& net) {}
+
+		// Epoch 'epoch', counted from 1, is complete. Returning false stops the
+		// training, keeping the batches and the optimizer state of the previous
+		// epochs otherwise
+		virtual bool epoch_end(Network& net, const int epoch) { return true; }
+	};
+}
\ No newline at end of file
@@ -0,0 +1,541 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include <sstream>
+#include <ostream>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Utils/Enum.h"
+#include "Utils/Factory.h"
+#include "Utils/IO.h"
+
+namespace MiniDNN
+{
+	namespace internal
+	{
+		typedef std::map<std::string, int> MetaInfo;
+
+		// Number of inputs of a fully connected layer applied in one pass over the outputs
+		const int fc_unroll = 4;
+
+		// Scalar literals that read back to the same value
+		class LiteralWriter
+		{
+		private:
+			std::ostringstream m_stream;
+			const char* m_suffix;
+
+		public:
+			LiteralWriter() : m_suffix(sizeof(Scalar) == sizeof(float) ? "f" : "")
+			{
+				m_stream.precision(std::numeric_limits<Scalar>::max_digits10);
+			}
+
+			std::string operator()(const Scalar& x)
+			{
+				m_stream.str("");
+				m_stream << x;
+				std::string res = m_stream.str();
+				if (*m_suffix && res.find_first_of(".eE") == std::string::npos)
+					res += ".0";
+				return res + m_suffix;
+			}
+		};
+
+		// Write 'alignas(64) constexpr Scalar name[] = { ... };'
+		inline void write_array(std::ostream& out, const std::string& name, const std::vector<Scalar>& values)
+		{
+			LiteralWriter literal;
+			out << "\talignas(64) constexpr Scalar " << name << "[" << values.size() << "] = {";
+			for (std::size_t i = 0; i < values.size(); i++)
+			{
+				out << (i % 8 == 0 ? "\n\t\t" : " ") << literal(values[i]) << (i + 1 < values.size() ? "," : "");
+			}
+			out << "\n\t};\n\n";
+		}
+
+		// Name of the generated helper applying the activation, or "" for Identity
+		inline std::string activation_function(const int act_id)
+		{
+			switch (act_id)
+			{
+			case IDENTITY:
+				return "";
+			case RELU:
+				return "relu";
+			case SIGMOID:
+				return "sigmoid";
+			case SOFTMAX:
+				return "softmax";
+			case TANH:
+				return "tanh_activation";
+			case MISH:
+				return "mish";
+			}
+
+			throw std::invalid_argument("[function generate_source]: Activation is not of a known type");
+		}
+
+		// Helper applying the activation 'act_id', following the formula of its Activation class
+		inline void write_activation(std::ostream& out, const int act_id)
+		{
+			const std::string f = activation_function(act_id);
+			if (f.empty())
+				return;
+
+			out << "\tinline void " << f << "(Scalar* x, const int n)\n"
+				<< "\t{\n";
+			switch (act_id)
+			{
+			case RELU:
+				out << "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t\tx[i] = x[i] > Scalar(0) ? x[i] : Scalar(0);\n";
+				break;
+			case SIGMOID:
+				out << "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t\tx[i] = Scalar(1) / (Scalar(1) + std::exp(-x[i]));\n";
+				break;
+			case TANH:
+				out << "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t\tx[i] = std::tanh(x[i]);\n";
+				break;
+			case MISH:
+				out << "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t{\n"
+					   "\t\t\tconst Scalar s = std::exp(-std::abs(x[i]));\n"
+					   "\t\t\tconst Scalar a = (s + Scalar(1)) * (s + Scalar(1));\n"
+					   "\t\t\tconst Scalar t = x[i] >= Scalar(0) ? s * s : Scalar(1);\n"
+					   "\t\t\tx[i] *= (a - t) / (a + t);\n"
+					   "\t\t}\n";
+				break;
+			case SOFTMAX:
+				out << "\t\tScalar m = x[0];\n"
+					   "\t\tfor (int i = 1; i < n; i++)\n"
+					   "\t\t\tm = x[i] > m ? x[i] : m;\n"
+					   "\t\tScalar sum = 0;\n"
+					   "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t{\n"
+					   "\t\t\tx[i] = std::exp(x[i] - m);\n"
+					   "\t\t\tsum += x[i];\n"
+					   "\t\t}\n"
+					   "\t\tfor (int i = 0; i < n; i++)\n"
+					   "\t\t\tx[i] /= sum;\n";
+				break;
+			}
+			out << "\t}\n\n";
+		}
+
+		inline void write_activation_call(std::ostream& out, const int act_id, const std::string& buffer, const int n)
+		{
+			const std::string f = activation_function(act_id);
+			if (!f.empty())
+				out << "\t\t" << f << "(" << buffer << ", " << n << ");\n";
+		}
+
+		// Shapes shared by the convolutional layers
+		struct GenConvShape
+		{
+			int in_channels, out_channels, rows, cols, filter_rows, filter_cols, conv_rows, conv_cols;
+
+			GenConvShape(const MetaInfo& map, const std::string& ind, const bool depthwise)
+			{
+				in_channels = meta_value(map, "in_channels" + ind);
+				out_channels = depthwise ? in_channels : meta_value(map, "out_channels" + ind);
+				rows = meta_value(map, "in_height" + ind);
+				cols = meta_value(map, "in_width" + ind);
+				filter_rows = meta_value(map, "window_height" + ind);
+				filter_cols = meta_value(map, "window_width" + ind);
+				conv_rows = rows - filter_rows + 1;
+				conv_cols = cols - filter_cols + 1;
+			}
+
+			int filter_size() const { return filter_rows * filter_cols; }
+			int conv_size() const { return conv_rows * conv_cols; }
+		};
+
+		// Channels-first "valid" convolution from 'in' to 'out', bias included
+		inline void write_convolution(std::ostream& out, const GenConvShape& s, const std::string& id,
+									  const std::string& in, const std::string& dest)
+		{
+			const int channel_size = s.rows * s.cols;
+			out << "\t\tfor (int o = 0; o < " << s.out_channels << "; o++)\n"
+				<< "\t\t{\n"
+				<< "\t\t\tScalar* res = " << dest << " + o * " << s.conv_size() << ";\n"
+				<< "\t\t\tfor (int p = 0; p < " << s.conv_size() << "; p++)\n"
+				<< "\t\t\t\tres[p] = b" << id << "[o];\n\n"
+				<< "\t\t\tfor (int ch = 0; ch < " << s.in_channels << "; ch++)\n"
+				<< "\t\t\t{\n"
+				<< "\t\t\t\tconst Scalar* x = " << in << " + ch * " << channel_size << ";\n"
+				<< "\t\t\t\tconst Scalar* f = w" << id << " + (ch * " << s.out_channels << " + o) * " << s.filter_size() << ";\n"
+				<< "\t\t\t\tfor (int c = 0; c < " << s.filter_cols << "; c++)\n"
+				<< "\t\t\t\t\tfor (int r = 0; r < " << s.filter_rows << "; r++)\n"
+				<< "\t\t\t\t\t{\n"
+				<< "\t\t\t\t\t\tconst Scalar w = f[r + c * " << s.filter_rows << "];\n"
+				<< "\t\t\t\t\t\tfor (int j = 0; j < " << s.conv_cols << "; j++)\n"
+				<< "\t\t\t\t\t\t\tfor (int i = 0; i < " << s.conv_rows << "; i++)\n"
+				<< "\t\t\t\t\t\t\t\tres[i + j * " << s.conv_rows << "] += w * x[(i + r) + (j + c) * " << s.rows << "];\n"
+				<< "\t\t\t\t\t}\n"
+				<< "\t\t\t}\n"
+				<< "\t\t}\n";
+		}
+
+		// Max pooling from 'in' to 'dest', in either layout
+		inline void write_pooling(std::ostream& out, const int channels, const int rows, const int cols,
+								  const int pool_rows, const int pool_cols, const bool channels_last,
+								  const std::string& in, const std::string& dest)
+		{
+			const int out_rows = rows / pool_rows;
+			const int out_cols = cols / pool_cols;
+			// Strides between rows and columns of a channel, and between channels
+			const int row_stride = channels_last ? channels : 1;
+			const int col_stride = row_stride * rows;
+			const int channel_stride = channels_last ? 1 : rows * cols;
+			const int out_channel_stride = channels_last ? 1 : out_rows * out_cols;
+			const int out_pixel_stride = channels_last ? channels : 1;
+
+			out << "\t\tfor (int oc = 0; oc < " << out_cols << "; oc++)\n"
+				<< "\t\t\tfor (int orow = 0; orow < " << out_rows << "; orow++)\n"
+				<< "\t\t\t\tfor (int ch = 0; ch < " << channels << "; ch++)\n"
+				<< "\t\t\t\t{\n"
+				<< "\t\t\t\t\tconst Scalar* x = " << in << " + ch * " << channel_stride << " + orow * " << pool_rows * row_stride
+				<< " + oc * " << pool_cols * col_stride << ";\n"
+				<< "\t\t\t\t\tScalar m = x[0];\n"
+				<< "\t\t\t\t\tfor (int c = 0; c < " << pool_cols << "; c++)\n"
+				<< "\t\t\t\t\t\tfor (int r = 0; r < " << pool_rows << "; r++)\n"
+				<< "\t\t\t\t\t\t{\n"
+				<< "\t\t\t\t\t\t\tconst Scalar v = x[r * " << row_stride << " + c * " << col_stride << "];\n"
+				<< "\t\t\t\t\t\t\tm = v > m ? v : m;\n"
+				<< "\t\t\t\t\t\t}\n"
+				<< "\t\t\t\t\t" << dest << "[ch * " << out_channel_stride << " + (orow + oc * " << out_rows << ") * "
+				<< out_pixel_stride << "] = m;\n"
+				<< "\t\t\t\t}\n";
+		}
+
+		// Write the constants and the function 'layer<index>(in, out)' of one layer,
+		// and return the size of its scratch buffer
+		inline int write_layer(std::ostream& out, const MetaInfo& map, const int index,
+							   const std::vector<Scalar>& param)
+		{
+			const std::string ind = to_string(index);
+			const int lay_id = meta_value(map, "Layer" + ind);
+			const int act_id = meta_value(map, "Activation" + ind);
+			int scratch = 0;
+
+			// SparseFullyConnected has the parameter layout of FullyConnected, and the
+			// generated loops have constant bounds either way
+			if (lay_id == FULLY_CONNECTED || lay_id == SPARSE_FULLY_CONNECTED)
+			{
+				const int in = meta_value(map, "in_size" + ind), nout = meta_value(map, "out_size" + ind);
+				// Store the weights transposed, so that the inner loop runs over the outputs
+				// and vectorizes. Every pass adds 'fc_unroll' inputs, which cuts the loads
+				// and stores of the outputs
+				std::vector<Scalar> w(std::size_t(in) * nout);
+				for (int o = 0; o < nout; o++)
+					for (int i = 0; i < in; i++)
+						w[std::size_t(i) * nout + o] = param[std::size_t(o) * in + i];
+				const int in_main = in - in % fc_unroll;
+
+				out << "\t// Layer " << index << ": FullyConnected " << in << " -> " << nout << "\n";
+				write_array(out, "w" + ind, w);
+				write_array(out, "b" + ind, std::vector<Scalar>(param.begin() + w.size(), param.end()));
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out)\n"
+					<< "\t{\n"
+					<< "\t\tfor (int o = 0; o < " << nout << "; o++)\n"
+					<< "\t\t\tout[o] = b" << ind << "[o];\n";
+				if (in_main > 0)
+				{
+					out << "\t\tfor (int i = 0; i < " << in_main << "; i += " << fc_unroll << ")\n"
+						<< "\t\t{\n"
+						<< "\t\t\tconst Scalar* w = w" << ind << " + i * " << nout << ";\n";
+					for (int j = 0; j < fc_unroll; j++)
+						out << "\t\t\tconst Scalar x" << j << " = in[i + " << j << "];\n";
+					out << "\t\t\tfor (int o = 0; o < " << nout << "; o++)\n"
+						<< "\t\t\t\tout[o] += w[o] * x0";
+					for (int j = 1; j < fc_unroll; j++)
+						out << " + w[" << j * nout << " + o] * x" << j;
+					out << ";\n"
+						<< "\t\t}\n";
+				}
+				if (in_main < in)
+				{
+					out << "\t\tfor (int i = " << in_main << "; i < " << in << "; i++)\n"
+						<< "\t\t{\n"
+						<< "\t\t\tconst Scalar x = in[i];\n"
+						<< "\t\t\tconst Scalar* w = w" << ind << " + i * " << nout << ";\n"
+						<< "\t\t\tfor (int o = 0; o < " << nout << "; o++)\n"
+						<< "\t\t\t\tout[o] += w[o] * x;\n"
+						<< "\t\t}\n";
+				}
+				write_activation_call(out, act_id, "out", nout);
+				out << "\t}\n\n";
+			}
+			else if (lay_id == CONVOLUTIONAL && meta_value(map, "layout" + ind, CHANNELS_FIRST) == CHANNELS_LAST)
+			{
+				const GenConvShape s(map, ind, false);
+				const int nfilter = s.in_channels * s.out_channels * s.filter_size();
+				// Pack the filters as [filter element][input channel][output channel]
+				std::vector<Scalar> w(nfilter);
+				for (int ch = 0; ch < s.in_channels; ch++)
+					for (int o = 0; o < s.out_channels; o++)
+						for (int q = 0; q < s.filter_size(); q++)
+							w[(std::size_t(q) * s.in_channels + ch) * s.out_channels + o] =
+								param[(std::size_t(ch) * s.out_channels + o) * s.filter_size() + q];
+
+				out << "\t// Layer " << index << ": Convolutional (channels-last) " << s.in_channels << "x" << s.rows
+					<< "x" << s.cols << " -> " << s.out_channels << "x" << s.conv_rows << "x" << s.conv_cols << "\n";
+				write_array(out, "w" + ind, w);
+				write_array(out, "b" + ind, std::vector<Scalar>(param.begin() + nfilter, param.end()));
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out)\n"
+					<< "\t{\n"
+					<< "\t\tfor (int j = 0; j < " << s.conv_cols << "; j++)\n"
+					<< "\t\t\tfor (int i = 0; i < " << s.conv_rows << "; i++)\n"
+					<< "\t\t\t{\n"
+					<< "\t\t\t\tScalar* res = out + (i + j * " << s.conv_rows << ") * " << s.out_channels << ";\n"
+					<< "\t\t\t\tfor (int o = 0; o < " << s.out_channels << "; o++)\n"
+					<< "\t\t\t\t\tres[o] = b" << ind << "[o];\n"
+					<< "\t\t\t\tfor (int c = 0; c < " << s.filter_cols << "; c++)\n"
+					<< "\t\t\t\t\tfor (int r = 0; r < " << s.filter_rows << "; r++)\n"
+					<< "\t\t\t\t\t{\n"
+					<< "\t\t\t\t\t\tconst Scalar* x = in + ((i + r) + (j + c) * " << s.rows << ") * " << s.in_channels << ";\n"
+					<< "\t\t\t\t\t\tconst Scalar* f = w" << ind << " + (r + c * " << s.filter_rows << ") * "
+					<< s.in_channels * s.out_channels << ";\n"
+					<< "\t\t\t\t\t\tfor (int ch = 0; ch < " << s.in_channels << "; ch++)\n"
+					<< "\t\t\t\t\t\t\tfor (int o = 0; o < " << s.out_channels << "; o++)\n"
+					<< "\t\t\t\t\t\t\t\tres[o] += f[ch * " << s.out_channels << " + o] * x[ch];\n"
+					<< "\t\t\t\t\t}\n"
+					<< "\t\t\t}\n";
+				write_activation_call(out, act_id, "out", s.conv_size() * s.out_channels);
+				out << "\t}\n\n";
+			}
+			else if (lay_id == CONVOLUTIONAL || lay_id == CONVOLUTIONAL_MAX_POOLING)
+			{
+				const GenConvShape s(map, ind, false);
+				const int nfilter = s.in_channels * s.out_channels * s.filter_size();
+				const bool pooled = (lay_id == CONVOLUTIONAL_MAX_POOLING);
+
+				out << "\t// Layer " << index << ": " << (pooled ? "ConvolutionalMaxPooling " : "Convolutional ")
+					<< s.in_channels << "x" << s.rows << "x" << s.cols << " -> " << s.out_channels << "x"
+					<< s.conv_rows << "x" << s.conv_cols << "\n";
+				write_array(out, "w" + ind, std::vector<Scalar>(param.begin(), param.begin() + nfilter));
+				write_array(out, "b" + ind, std::vector<Scalar>(param.begin() + nfilter, param.end()));
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out" << (pooled ? ", Scalar* scratch" : "")
+					<< ")\n"
+					<< "\t{\n";
+				if (pooled)
+				{
+					// Convolution into the scratch buffer, then pooling of the activated values
+					scratch = s.conv_size() * s.out_channels;
+					write_convolution(out, s, ind, "in", "scratch");
+					write_activation_call(out, act_id, "scratch", scratch);
+					write_pooling(out, s.out_channels, s.conv_rows, s.conv_cols,
+								  meta_value(map, "pooling_height" + ind), meta_value(map, "pooling_width" + ind),
+								  false, "scratch", "out");
+				}
+				else
+				{
+					write_convolution(out, s, ind, "in", "out");
+					write_activation_call(out, act_id, "out", s.conv_size() * s.out_channels);
+				}
+				out << "\t}\n\n";
+			}
+			else if (lay_id == DEPTHWISE_CONVOLUTIONAL)
+			{
+				const GenConvShape s(map, ind, true);
+				const int nfilter = s.in_channels * s.filter_size();
+				const int channel_size = s.rows * s.cols;
+
+				out << "\t// Layer " << index << ": DepthwiseConvolutional " << s.in_channels << "x" << s.rows << "x"
+					<< s.cols << " -> " << s.in_channels << "x" << s.conv_rows << "x" << s.conv_cols << "\n";
+				write_array(out, "w" + ind, std::vector<Scalar>(param.begin(), param.begin() + nfilter));
+				write_array(out, "b" + ind, std::vector<Scalar>(param.begin() + nfilter, param.end()));
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out)\n"
+					<< "\t{\n"
+					<< "\t\tfor (int ch = 0; ch < " << s.in_channels << "; ch++)\n"
+					<< "\t\t{\n"
+					<< "\t\t\tconst Scalar* x = in + ch * " << channel_size << ";\n"
+					<< "\t\t\tconst Scalar* f = w" << ind << " + ch * " << s.filter_size() << ";\n"
+					<< "\t\t\tScalar* res = out + ch * " << s.conv_size() << ";\n"
+					<< "\t\t\tfor (int p = 0; p < " << s.conv_size() << "; p++)\n"
+					<< "\t\t\t\tres[p] = b" << ind << "[ch];\n"
+					<< "\t\t\tfor (int c = 0; c < " << s.filter_cols << "; c++)\n"
+					<< "\t\t\t\tfor (int r = 0; r < " << s.filter_rows << "; r++)\n"
+					<< "\t\t\t\t{\n"
+					<< "\t\t\t\t\tconst Scalar w = f[r + c * " << s.filter_rows << "];\n"
+					<< "\t\t\t\t\tfor (int j = 0; j < " << s.conv_cols << "; j++)\n"
+					<< "\t\t\t\t\t\tfor (int i = 0; i < " << s.conv_rows << "; i++)\n"
+					<< "\t\t\t\t\t\t\tres[i + j * " << s.conv_rows << "] += w * x[(i + r) + (j + c) * " << s.rows << "];\n"
+					<< "\t\t\t\t}\n"
+					<< "\t\t}\n";
+				write_activation_call(out, act_id, "out", s.conv_size() * s.in_channels);
+				out << "\t}\n\n";
+			}
+			else if (lay_id == MAX_POOLING)
+			{
+				const int channels = meta_value(map, "in_channels" + ind);
+				const int rows = meta_value(map, "in_height" + ind), cols = meta_value(map, "in_width" + ind);
+				const bool channels_last = meta_value(map, "layout" + ind, CHANNELS_FIRST) == CHANNELS_LAST;
+
+				out << "\t// Layer " << index << ": MaxPooling" << (channels_last ? " (channels-last) " : " ")
+					<< channels << "x" << rows << "x" << cols << "\n";
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out)\n"
+					<< "\t{\n";
+				write_pooling(out, channels, rows, cols, meta_value(map, "pooling_height" + ind),
+							  meta_value(map, "pooling_width" + ind), channels_last, "in", "out");
+				out << "\t}\n\n";
+			}
+			else if (lay_id == BATCH_NORMALIZATION)
+			{
+				// Inference uses the running statistics, so the layer is a per-channel affine map
+				const int channels = meta_value(map, "in_channels" + ind);
+				const int npixel = meta_value(map, "in_height" + ind) * meta_value(map, "in_width" + ind);
+				const bool channels_last = meta_value(map, "layout" + ind, CHANNELS_FIRST) == CHANNELS_LAST;
+				std::vector<Scalar> scale(channels), shift(channels);
+				batch_norm_affine(&param[0], &param[channels], &param[2 * channels], &param[3 * channels], channels,
+								  scale.data(), shift.data());
+
+				out << "\t// Layer " << index << ": BatchNormalization" << (channels_last ? " (channels-last) " : " ")
+					<< channels << "x" << npixel << "\n";
+				write_array(out, "w" + ind, scale);
+				write_array(out, "b" + ind, shift);
+				out << "\tinline void layer" << ind << "(const Scalar* in, Scalar* out)\n"
+					<< "\t{\n";
+				if (channels_last)
+				{
+					out << "\t\tfor (int p = 0; p < " << npixel << "; p++)\n"
+						<< "\t\t\tfor (int ch = 0; ch < " << channels << "; ch++)\n"
+						<< "\t\t\t\tout[p * " << channels << " + ch] = w" << ind << "[ch] * in[p * " << channels
+						<< " + ch] + b" << ind << "[ch];\n";
+				}
+				else
+				{
+					out << "\t\tfor (int ch = 0; ch < " << channels << "; ch++)\n"
+						<< "\t\t\tfor (int p = 0; p < " << npixel << "; p++)\n"
+						<< "\t\t\t\tout[ch * " << npixel << " + p] = w" << ind << "[ch] * in[ch * " << npixel
+						<< " + p] + b" << ind << "[ch];\n";
+				}
+				write_activation_call(out, act_id, "out", channels * npixel);
+				out << "\t}\n\n";
+			}
+			else
+			{
+				throw std::invalid_argument("[function generate_source]: Layer is not of a known type");
+			}
+
+			return scratch;
+		}
+	}
+
+	///
+	/// Write a standalone C++ source file that computes the prediction of a trained model
+	///
+	/// The generated file only depends on the standard library. The parameters are
+	/// 'constexpr' arrays aligned to 64 bytes, and every layer is a function whose
+	/// loop bounds are the constants of the model, so the compiler can fold the
+	/// shapes and vectorize the loops. It defines, inside namespace 'name',
+	///
+	///     constexpr int input_size, output_size;
+	///     void predict(const Scalar* input, Scalar* output);
+	///
+	/// for one observation at a time. predict() only uses thread-local buffers, so it
+	/// can be called from several threads.
+	///
+	/// \param map     Meta information of the model, as written by Network::export_net()
+	/// \param param   Parameters of each layer, as returned by Network::get_parameters()
+	/// \param name    Namespace of the generated code
+	/// \param out     Stream receiving the source
+	///
+	inline void generate_source(const std::map<std::string, int>& map,
+								const std::vector< std::vector<Scalar> >& param,
+								const std::string& name, std::ostream& out)
+	{
+		const int nlayer = internal::meta_value(map, "Nlayers");
+		if (nlayer <= 0 || static_cast<int>(param.size()) != nlayer)
+			throw std::invalid_argument("[function generate_source]: Parameters do not match the meta information");
+
+		// Layer sizes come from the regular layer classes
+		std::vector<int> size(nlayer + 1);
+		for (int i = 0; i < nlayer; i++)
+		{
+			Layer* layer = internal::create_layer(map, i);
+			if (i == 0)
+				size[0] = layer->in_size();
+			size[i + 1] = layer->out_size();
+			delete layer;
+		}
+
+		out << "// Generated by MiniDNN::generate_source(). Do not edit\n"
+			<< "//\n"
+			<< "// namespace " << name << "\n"
+			<< "// {\n"
+			<< "//     void predict(const Scalar* input, Scalar* output);\n"
+			<< "// }\n\n"
+			<< "#include <cmath>\n\n"
+			<< "namespace " << name << "\n"
+			<< "{\n"
+			<< "\ttypedef " << (sizeof(Scalar) == sizeof(float) ? "float" : "double") << " Scalar;\n\n"
+			<< "\tconstexpr int input_size = " << size[0] << ";\n"
+			<< "\tconstexpr int output_size = " << size[nlayer] << ";\n\n";
+
+		// One helper per activation used by the model
+		std::vector<bool> written(internal::MISH + 1, false);
+		for (int i = 0; i < nlayer; i++)
+		{
+			const int act_id = internal::meta_value(map, "Activation" + internal::to_string(i));
+			internal::activation_function(act_id);
+			if (!written[act_id])
+				internal::write_activation(out, act_id);
+			written[act_id] = true;
+		}
+
+		std::vector<int> scratch(nlayer);
+		int buffer_size = 1, scratch_size = 0;
+		for (int i = 0; i < nlayer; i++)
+		{
+			scratch[i] = internal::write_layer(out, map, i, param[i]);
+			scratch_size = std::max(scratch_size, scratch[i]);
+			if (i > 0)
+				buffer_size = std::max(buffer_size, size[i]);
+		}
+
+		// The layers are called one after another, switching between two buffers
+		out << "\tvoid predict(const Scalar* input, Scalar* output)\n"
+			<< "\t{\n"
+			<< "\t\talignas(64) static thread_local Scalar buffer[2][" << buffer_size << "];\n";
+		if (scratch_size > 0)
+			out << "\t\talignas(64) static thread_local Scalar scratch[" << scratch_size << "];\n";
+		out << "\n";
+		for (int i = 0; i < nlayer; i++)
+		{
+			const std::string ind = internal::to_string(i);
+			const std::string in = (i == 0) ? "input" : "buffer[" + internal::to_string((i - 1) % 2) + "]";
+			const std::string dest = (i == nlayer - 1) ? "output" : "buffer[" + internal::to_string(i % 2) + "]";
+			out << "\t\tlayer" << ind << "(" << in << ", " << dest << (scratch[i] > 0 ? ", scratch" : "") << ");\n";
+		}
+		out << "\t}\n"
+			<< "}\n";
+	}
+
+	///
+	/// Write the source of a trained network, see generate_source() above
+	///
+	inline void generate_source(const Network& net, const std::string& name, std::ostream& out)
+	{
+		std::map<std::string, int> map;
+		const std::vector<const Layer*> layers = net.get_layers();
+		const int nlayer = layers.size();
+
+		map.insert(std::make_pair("Nlayers", nlayer));
+		for (int i = 0; i < nlayer; i++)
+		{
+			layers[i]->fill_meta_info(map, i);
+		}
+
+		generate_source(map, net.get_parameters(), name, out);
+	}
+}
\ No newline at end of file
@@ -0,0 +1,144 @@
+#pragma once
+
+#include <vector>
+#include <new>
+#include <stdexcept>
+#include <algorithm>
+#include "../Config.h"
+#include "SharedMemory.h"
+
+namespace MiniDNN
+{
+
+    namespace distributed
+    {
+
+
+        ///
+        /// Averaging allreduce over shared memory among 'nworker' forked processes
+        ///
+        /// The data are split into segments (one per layer of a network), which are
+        /// reduced independently so that a segment can be communicated as soon as it
+        /// is ready. For each segment, every worker
+        ///
+        ///   1. writes its values into its own input slot and calls publish(),
+        ///   2. calls reduce(), which waits for all the inputs and averages the
+        ///      worker's share of the segment, 1/nworker of it, into the result,
+        ///   3. calls wait() before reading result().
+        ///
+        /// This is a reduce-scatter followed by an all-gather, where the all-gather
+        /// costs nothing because every process reads the result in place. Each
+        /// worker reads the segment once and writes 1/nworker of it, the same
+        /// traffic as a ring allreduce, with a single synchronization per phase.
+        ///
+        /// The object is created before fork(). The counters grow monotonically, so
+        /// nothing has to be reset between rounds. A worker must not publish a
+        /// segment again before wait() on the previous round returned.
+        ///
+        class ShmAllReduce
+        {
+        private:
+            const int m_nworker;
+            std::vector<std::size_t> m_offset;
+            std::size_t m_total;
+
+            SharedRegion m_region;
+            SharedCounter* m_arrived;
+            SharedCounter* m_reduced;
+            Scalar* m_input;
+            Scalar* m_result;
+
+            // Rounds of each segment started by this process
+            std::vector<long long> m_round;
+
+            // Counters, then one input slot per worker, then the result
+            static std::size_t region_bytes(const std::vector<std::size_t>& segment_sizes, const int nworker)
+            {
+                std::size_t total = 0;
+                for (std::size_t i = 0; i < segment_sizes.size(); i++)
+                    total += segment_sizes[i];
+                return 2 * segment_sizes.size() * sizeof(SharedCounter) + (nworker + 1) * total * sizeof(Scalar);
+            }
+
+        public:
+            ShmAllReduce(const std::vector<std::size_t>& segment_sizes, const int nworker) :
+                m_nworker(nworker), m_offset(segment_sizes.size() + 1, 0), m_total(0),
+                m_region(region_bytes(segment_sizes, std::max(nworker, 1))),
+                m_round(segment_sizes.size(), 0)
+            {
+                if (nworker < 1)
+                    throw std::invalid_argument("[class ShmAllReduce]: Number of workers must be positive");
+
+                const std::size_t nsegment = segment_sizes.size();
+                for (std::size_t i = 0; i < nsegment; i++)
+                    m_offset[i + 1] = m_offset[i] + segment_sizes[i];
+                m_total = m_offset[nsegment];
+
+                m_arrived = static_cast<SharedCounter*>(m_region.data());
+                m_reduced = m_arrived + nsegment;
+                for (std::size_t i = 0; i < 2 * nsegment; i++)
+                    new (&m_arrived[i].value) std::atomic<long long>(0);
+
+                m_input = reinterpret_cast<Scalar*>(m_reduced + nsegment);
+                m_result = m_input + nworker * m_total;
+            }
+
+            int num_workers() const { return m_nworker; }
+
+            int num_segments() const { return m_round.size(); }
+
+            std::size_t segment_size(const int segment) const { return m_offset[segment + 1] - m_offset[segment]; }
+
+            // Where worker 'rank' writes its values of 'segment'
+            Scalar* input(const int rank, const int segment)
+            {
+                return m_input + rank * m_total + m_offset[segment];
+            }
+
+            // The average of all the inputs, valid after wait()
+            const Scalar* result(const int segment) const { return m_result + m_offset[segment]; }
+
+            // The input of this worker for the next round of 'segment' is written
+            void publish(const int segment)
+            {
+                m_round[segment]++;
+                m_arrived[segment].value.fetch_add(1, std::memory_order_acq_rel);
+            }
+
+            // Average the share of worker 'rank' once all the inputs of the current
+            // round have arrived. Can run on another thread than publish()
+            void reduce(const int rank, const int segment)
+            {
+                const long long round = m_round[segment];
+                wait_for(m_arrived[segment], round * m_nworker);
+
+                const std::size_t size = segment_size(segment);
+                const std::size_t begin = size * rank / m_nworker;
+                const std::size_t end = size * (rank + 1) / m_nworker;
+                Scalar* res = m_result + m_offset[segment];
+                const Scalar scale = Scalar(1) / m_nworker;
+
+                std::copy(m_input + m_offset[segment] + begin, m_input + m_offset[segment] + end, res + begin);
+                for (int w = 1; w < m_nworker; w++)
+                {
+                    const Scalar* src = m_input + w * m_total + m_offset[segment];
+                    for (std::size_t k = begin; k < end; k++)
+                        res[k] += src[k];
+                }
+                for (std::size_t k = begin; k < end; k++)
+                    res[k] *= scale;
+
+                m_reduced[segment].value.fetch_add(1, std::memory_order_acq_rel);
+            }
+
+            // Wait until all the workers have reduced the current round of 'segment'
+            void wait(const int segment) const
+            {
+                wait_for(m_reduced[segment], m_round[segment] * m_nworker);
+            }
+        };
+
+
+    } // namespace distributed
+
+} // namespace MiniDNN
\ No newline at end of file
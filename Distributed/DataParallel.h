@@ -0,0 +1,279 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <utility>
+#include <stdexcept>
+#include <cerrno>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "../Config.h"
+#include "../Network.h"
+#include "../Optimizer.h"
+#include "../Callback.h"
+#include "../Utils/ThreadPool.h"
+#include "AllReduce.h"
+
+namespace MiniDNN
+{
+
+    namespace distributed
+    {
+
+
+        ///
+        /// Averages the gradients of all the workers before each parameter update
+        ///
+        /// The gradients of a layer are published as soon as backprop() has
+        /// computed them, and a communication thread reduces them while the main
+        /// thread continues with the layers below. pre_update() waits for the last
+        /// layers and installs the averages with Network::set_derivatives().
+        ///
+        class GradientAverager : public Callback
+        {
+        private:
+            ShmAllReduce& m_reducer;
+            const int m_rank;
+
+            // Layers published during this batch, and the sizes of their gradients
+            std::vector< std::pair<int, std::size_t> > m_pending;
+            std::deque<int> m_queue;        // Layers waiting for the communication thread
+            bool m_stop;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::thread m_thread;
+
+            void communicate()
+            {
+                for (;;)
+                {
+                    int layer;
+                    {
+                        std::unique_lock<std::mutex> lock(m_mutex);
+                        m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                        if (m_queue.empty())
+                            return;
+                        layer = m_queue.front();
+                        m_queue.pop_front();
+                    }
+                    m_reducer.reduce(m_rank, layer);
+                }
+            }
+
+        public:
+            GradientAverager(ShmAllReduce& reducer, const int rank) :
+                m_reducer(reducer), m_rank(rank), m_stop(false)
+            {
+                m_thread = std::thread(&GradientAverager::communicate, this);
+            }
+
+            ~GradientAverager()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_cv.notify_one();
+                m_thread.join();
+            }
+
+            void gradients_ready(Network& net, const int layer)
+            {
+                const std::vector<Scalar> deriv = net.get_layers()[layer]->get_derivatives();
+                // The segments hold the parameters, and some layers have fewer
+                // gradients than parameters
+                if (deriv.size() > m_reducer.segment_size(layer))
+                    throw std::logic_error("[class GradientAverager]: Gradient size does not match");
+                if (deriv.empty())
+                    return;
+
+                std::copy(deriv.begin(), deriv.end(), m_reducer.input(m_rank, layer));
+                m_reducer.publish(layer);
+                m_pending.push_back(std::make_pair(layer, deriv.size()));
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_queue.push_back(layer);
+                }
+                m_cv.notify_one();
+            }
+
+            void pre_update(Network& net)
+            {
+                for (std::size_t i = 0; i < m_pending.size(); i++)
+                {
+                    const int layer = m_pending[i].first;
+                    m_reducer.wait(layer);
+                    const Scalar* avg = m_reducer.result(layer);
+                    net.set_derivatives(layer, std::vector<Scalar>(avg, avg + m_pending[i].second));
+                }
+                m_pending.clear();
+            }
+        };
+
+        namespace internal
+        {
+            // Average a vector per layer over the workers, on the calling thread
+            inline void average_layers(ShmAllReduce& reducer, const int rank, std::vector< std::vector<Scalar> >& values)
+            {
+                for (int i = 0; i < reducer.num_segments(); i++)
+                {
+                    std::copy(values[i].begin(), values[i].end(), reducer.input(rank, i));
+                    reducer.publish(i);
+                    reducer.reduce(rank, i);
+                }
+                for (int i = 0; i < reducer.num_segments(); i++)
+                {
+                    reducer.wait(i);
+                    std::copy(reducer.result(i), reducer.result(i) + values[i].size(), values[i].begin());
+                }
+            }
+        } // namespace internal
+
+
+        ///
+        /// Train a network with synchronous data parallelism over 'nworker' processes
+        ///
+        /// The calling process forks 'nworker' workers that start from its current
+        /// parameters. Worker k trains on the k-th contiguous shard of the data,
+        /// ncol / nworker observations each (the remainder is dropped so that all
+        /// the workers run the same number of batches), and the gradients are
+        /// averaged over all the workers after every batch. With 'batch_size'
+        /// observations per worker, this is equivalent to training a single model
+        /// with batches of nworker * batch_size observations.
+        ///
+        /// The parameters of the workers are averaged at the end, which also merges
+        /// statistics such as the running moments of BatchNormalization layers, and
+        /// copied into 'net'. The threads of the global thread pool are shared among
+        /// the workers.
+        ///
+        /// POSIX only. Every worker has to reach the same sequence of batches, so
+        /// the others cannot continue without a worker that fails. The parent then
+        /// fails fast: it kills the remaining workers and returns false.
+        ///
+        /// \param net           The network, with initialized parameters and an output layer
+        /// \param opt           The optimizer, copied into each worker
+        /// \param x             Predictors, one observation per column
+        /// \param y             Targets, one observation per column
+        /// \param batch_size    Mini-batch size of each worker
+        /// \param epoch         Number of passes over the data
+        /// \param nworker       Number of worker processes
+        /// \param seed          Seed of the shuffling RNG of worker k is 'seed + k', ignored if not positive
+        /// \return              Whether all the workers succeeded
+        ///
+        template <typename DerivedX, typename DerivedY>
+        bool fit_data_parallel(Network& net, Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+                               const Eigen::MatrixBase<DerivedY>& y, const int batch_size, const int epoch,
+                               const int nworker, const int seed = -1)
+        {
+            const int nlayer = net.num_layers();
+            const int shard = x.cols() / std::max(nworker, 1);
+            if (nlayer <= 0 || nworker < 1 || shard < 1 || x.cols() != y.cols())
+                return false;
+
+            // Parameters and gradients have the same layout, so the segments also
+            // hold the final parameters
+            std::vector< std::vector<Scalar> > param = net.get_parameters();
+            std::vector<std::size_t> sizes(nlayer);
+            for (int i = 0; i < nlayer; i++)
+                sizes[i] = param[i].size();
+            ShmAllReduce reducer(sizes, nworker);
+
+            const int nthread = std::max(1, MiniDNN::internal::thread_pool().size() / nworker);
+            std::vector<pid_t> pid;
+            for (int k = 0; k < nworker; k++)
+            {
+                const pid_t p = ::fork();
+                if (p < 0)
+                    break;
+                if (p > 0)
+                {
+                    pid.push_back(p);
+                    continue;
+                }
+
+                // Worker. The threads of the pool did not survive fork(), so its
+                // state is not usable: leak it and start a new one
+                MiniDNN::internal::thread_pool_instance().release();
+                MiniDNN::internal::set_num_threads(nthread);
+
+                int status = 1;
+                try
+                {
+                    bool ok;
+                    {
+                        GradientAverager averager(reducer, k);
+                        net.set_callback(averager);
+                        ok = net.fit(opt, x.middleCols(k * shard, shard), y.middleCols(k * shard, shard),
+                                     batch_size, epoch, seed > 0 ? seed + k : -1);
+                        net.set_default_callback();
+                    }
+
+                    std::vector< std::vector<Scalar> > res = net.get_parameters();
+                    internal::average_layers(reducer, k, res);
+                    status = ok ? 0 : 1;
+                }
+                catch (...)
+                {
+                }
+                ::_exit(status);
+            }
+
+            // Without all the workers, the others would wait forever
+            bool ok = static_cast<int>(pid.size()) == nworker;
+            if (!ok)
+            {
+                for (std::size_t k = 0; k < pid.size(); k++)
+                    ::kill(pid[k], SIGKILL);
+            }
+            // Reap the workers in the order they exit. The first failure kills the
+            // others, which would wait for it in the allreduce otherwise
+            std::size_t nrunning = pid.size();
+            while (nrunning > 0)
+            {
+                int status = 0;
+                const pid_t p = ::waitpid(-1, &status, 0);
+                if (p < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    ok = false;
+                    break;
+                }
+
+                std::vector<pid_t>::iterator it = std::find(pid.begin(), pid.end(), p);
+                if (it == pid.end())
+                    continue;
+                *it = -1;
+                nrunning--;
+
+                if (ok && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+                {
+                    ok = false;
+                    for (std::size_t k = 0; k < pid.size(); k++)
+                    {
+                        if (pid[k] > 0)
+                            ::kill(pid[k], SIGKILL);
+                    }
+                }
+            }
+            if (!ok)
+                return false;
+
+            for (int i = 0; i < nlayer; i++)
+                std::copy(reducer.result(i), reducer.result(i) + sizes[i], param[i].begin());
+            net.set_parameters(param);
+
+            return true;
+        }
+
+
+    } // namespace distributed
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -0,0 +1,77 @@
+// Data-parallel training on one host, compared with single-process training
+//
+// Build (POSIX only, header-only library):
+//     g++ -O2 -std=c++14 -pthread -I<eigen> -I.. DataParallelTrain.cpp -o data_parallel_train
+//
+// Usage:
+//     data_parallel_train [workers=4] [epochs=5] [batch_size=32] [observations=16384]
+//
+// A multi-layer perceptron is trained on synthetic data, once by this process with
+// batches of workers * batch_size observations, and once by fit_data_parallel()
+// with batches of batch_size observations per worker. Both see the same number of
+// observations per update, so the losses should be comparable.
+
+#include <iostream>
+#include <cstdlib>
+#include <chrono>
+#include "../MiniDNN.h"
+#include "DataParallel.h"
+
+using namespace MiniDNN;
+
+typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+static void build(Network& net, const int in_size, const int out_size)
+{
+	net.add_layer(new FullyConnected<ReLU>(in_size, 256));
+	net.add_layer(new FullyConnected<ReLU>(256, 256));
+	net.add_layer(new FullyConnected<Identity>(256, out_size));
+	net.set_output(new RegressionMSE());
+	net.init(0, 0.05, 123);
+}
+
+int main(int argc, char* argv[])
+{
+	const int nworker = argc > 1 ? std::atoi(argv[1]) : 4;
+	const int epoch = argc > 2 ? std::atoi(argv[2]) : 5;
+	const int batch_size = argc > 3 ? std::atoi(argv[3]) : 32;
+	const int nobs = argc > 4 ? std::atoi(argv[4]) : 16384;
+	const int in_size = 64, out_size = 8;
+
+	// Targets from a fixed random linear map with a nonlinearity
+	Matrix x = Matrix::Random(in_size, nobs);
+	Matrix map = Matrix::Random(out_size, in_size) / in_size;
+	Matrix y = (map * x).array().tanh().matrix();
+
+	typedef std::chrono::steady_clock Clock;
+
+	Network single;
+	build(single, in_size, out_size);
+	SGD opt_single;
+	opt_single.m_lrate = 0.05;
+	Clock::time_point t0 = Clock::now();
+	single.fit(opt_single, x, y, nworker * batch_size, epoch, 1);
+	const double single_seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+
+	Network parallel;
+	build(parallel, in_size, out_size);
+	SGD opt_parallel;
+	opt_parallel.m_lrate = 0.05;
+	t0 = Clock::now();
+	const bool ok = distributed::fit_data_parallel(parallel, opt_parallel, x, y, batch_size, epoch, nworker, 1);
+	const double parallel_seconds = std::chrono::duration<double>(Clock::now() - t0).count();
+	if (!ok)
+	{
+		std::cerr << "Data-parallel training failed" << std::endl;
+		return 1;
+	}
+
+	const Scalar single_loss = (single.predict(x) - y).squaredNorm() / nobs;
+	const Scalar parallel_loss = (parallel.predict(x) - y).squaredNorm() / nobs;
+	std::cout << "Workers:           " << nworker << std::endl
+			  << "Single process:    " << single_seconds << " s, loss " << single_loss << std::endl
+			  << "Data parallel:     " << parallel_seconds << " s, loss " << parallel_loss << std::endl
+			  << "Speedup:           " << single_seconds / parallel_seconds << std::endl;
+
+	return 0;
+}
\ No newline at end of file
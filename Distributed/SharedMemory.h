@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <sys/mman.h>
+
+namespace MiniDNN
+{
+
+    namespace distributed
+    {
+
+
+        ///
+        /// Anonymous shared memory, visible to the processes forked after its creation
+        ///
+        /// The region is zero-initialized and unmapped on destruction.
+        ///
+        class SharedRegion
+        {
+        private:
+            void* m_data;
+            std::size_t m_bytes;
+
+            SharedRegion(const SharedRegion&);
+            SharedRegion& operator=(const SharedRegion&);
+
+        public:
+            explicit SharedRegion(const std::size_t bytes) :
+                m_data(NULL), m_bytes(bytes)
+            {
+                m_data = ::mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+                if (m_data == MAP_FAILED)
+                    throw std::runtime_error("[class SharedRegion]: mmap failed");
+            }
+
+            ~SharedRegion() { ::munmap(m_data, m_bytes); }
+
+            void* data() const { return m_data; }
+
+            std::size_t size() const { return m_bytes; }
+        };
+
+        // A counter in shared memory, on its own cache line
+        struct alignas(64) SharedCounter
+        {
+            std::atomic<long long> value;
+        };
+
+        // Wait until 'counter' reaches 'target'. Spins briefly, then yields the CPU
+        // so that the other processes can make progress on an oversubscribed host
+        inline void wait_for(const SharedCounter& counter, const long long target)
+        {
+            for (int spin = 0; counter.value.load(std::memory_order_acquire) < target; spin++)
+            {
+                if (spin >= 64)
+                    std::this_thread::yield();
+            }
+        }
+
+
+    } // namespace distributed
+
+} // namespace MiniDNN
\ No newline at end of file
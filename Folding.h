@@ -0,0 +1,112 @@
+#pragma once
+
+#include <vector>
+#include <map>
+#include <string>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Layer/BatchNormalization.h"
+#include "Utils/Enum.h"
+#include "Utils/Factory.h"
+
+namespace MiniDNN
+{
+	///
+	/// Fold BatchNormalization layers into the layers before them, for inference
+	///
+	/// A BatchNormalization layer computes 'scale * x + shift' per channel from its
+	/// learned parameters and running statistics. When the layer before it uses the
+	/// Identity activation, the scale is multiplied into its weights and the shift
+	/// added to its bias, the preceding layer takes over the activation of the
+	/// normalization, and the normalization layer is removed. Foldable layers are
+	/// FullyConnected and SparseFullyConnected (per output unit, for any image
+	/// shape of the normalization), and Convolutional and DepthwiseConvolutional
+	/// layers that produce the channels of the normalization in the same layout.
+	/// Other normalization layers are left in place.
+	///
+	/// The predictions of the network are unchanged up to rounding. Training the
+	/// folded network afterwards no longer normalizes the batches.
+	///
+	/// \param net    The network
+	/// \return       The number of folded layers
+	///
+	inline int fold_batch_normalization(Network& net)
+	{
+		typedef std::map<std::string, int> MetaInfo;
+
+		int nfold = 0;
+		for (int i = 1; i < net.num_layers(); i++)
+		{
+			const Layer& bn = *net.get_layers()[i];
+			const Layer& prev = *net.get_layers()[i - 1];
+			if (internal::layer_id(bn.layer_type()) != internal::BATCH_NORMALIZATION ||
+				internal::activation_id(prev.activataion_type()) != internal::IDENTITY)
+				continue;
+
+			MetaInfo map;
+			bn.fill_meta_info(map, 1);
+			prev.fill_meta_info(map, 0);
+			const int nchannel = internal::meta_value(map, "in_channels1");
+			const int layout = internal::meta_value(map, "layout1");
+			const int npixel = bn.in_size() / nchannel;
+
+			std::vector<Scalar> scale(nchannel), shift(nchannel);
+			const std::vector<Scalar> bn_param = bn.get_parameters();
+			internal::batch_norm_affine(&bn_param[0], &bn_param[nchannel], &bn_param[2 * nchannel],
+										&bn_param[3 * nchannel], nchannel, scale.data(), shift.data());
+
+			std::vector<Scalar> param = prev.get_parameters();
+			const int prev_id = internal::meta_value(map, "Layer0");
+			if (prev_id == internal::FULLY_CONNECTED || prev_id == internal::SPARSE_FULLY_CONNECTED)
+			{
+				// Column 'o' of the weights, then bias 'o'
+				const int in = prev.in_size(), out = prev.out_size();
+				Scalar* bias = &param[std::size_t(in) * out];
+				for (int o = 0; o < out; o++)
+				{
+					const int c = (layout == internal::CHANNELS_LAST) ? o % nchannel : o / npixel;
+					Scalar* w = &param[std::size_t(o) * in];
+					for (int k = 0; k < in; k++)
+						w[k] *= scale[c];
+					bias[o] = bias[o] * scale[c] + shift[c];
+				}
+			}
+			else if (prev_id == internal::CONVOLUTIONAL || prev_id == internal::DEPTHWISE_CONVOLUTIONAL)
+			{
+				const bool depthwise = prev_id == internal::DEPTHWISE_CONVOLUTIONAL;
+				const int prev_layout = internal::meta_value(map, "layout0", internal::CHANNELS_FIRST);
+				const int out_channels = internal::meta_value(map, depthwise ? "in_channels0" : "out_channels0");
+				if (prev_layout != layout || out_channels != nchannel)
+					continue;
+
+				// The filters of output channel 'o' are blocks 'o', 'o + nchannel', ...
+				const int filter_size = internal::meta_value(map, "window_width0") *
+										internal::meta_value(map, "window_height0");
+				const int nfilter = param.size() - nchannel;
+				for (int f = 0; f < nfilter / filter_size; f++)
+				{
+					Scalar* w = &param[std::size_t(f) * filter_size];
+					for (int k = 0; k < filter_size; k++)
+						w[k] *= scale[f % nchannel];
+				}
+				for (int c = 0; c < nchannel; c++)
+					param[nfilter + c] = param[nfilter + c] * scale[c] + shift[c];
+			}
+			else
+			{
+				continue;
+			}
+
+			map["Activation0"] = internal::meta_value(map, "Activation1");
+			Layer* folded = internal::create_layer(map, 0);
+			folded->set_parameters(param);
+			net.replace_layer(i - 1, folded);
+			net.remove_layer(i);
+			i--;
+			nfold++;
+		}
+
+		return nfold;
+	}
+}
\ No newline at end of file
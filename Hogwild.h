@@ -0,0 +1,406 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include <algorithm>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Optimizer.h"
+#include "Callback.h"
+#include "Utils/Factory.h"
+
+namespace MiniDNN
+{
+	///
+	/// Loss of a network at the end of an epoch of training
+	///
+	struct ConvergencePoint
+	{
+		int epoch;
+		// Training time since the start, excluding the evaluations of the loss
+		double seconds;
+		Scalar loss;
+	};
+
+	namespace internal
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> HogwildVector;
+
+		// Update of the replicas, which is a no-op as the workers update the
+		// shared parameters themselves
+		class NoUpdate : public Optimizer
+		{
+		public:
+			void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec) {}
+		};
+
+		// A network with the architecture, parameters and trainable flags of 'net'
+		inline void replicate_network(const Network& net, Network& replica)
+		{
+			std::map<std::string, int> map;
+			const int nlayer = net.num_layers();
+			for (int i = 0; i < nlayer; i++)
+				net.get_layers()[i]->fill_meta_info(map, i);
+			map["OutputLayer"] = output_id(net.get_output()->output_type());
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				replica.add_layer(create_layer(map, i));
+				replica.set_trainable(i, net.get_layers()[i]->trainable());
+			}
+			replica.set_output(create_output(map));
+			replica.set_parameters(net.get_parameters());
+		}
+
+		///
+		/// Barrier of the Hogwild workers at the end of each epoch
+		///
+		/// The last worker to finish an epoch copies the shared parameters into the
+		/// network and records its loss, while the others wait. The time spent in
+		/// the evaluation is not counted as training time.
+		///
+		class HogwildEpochs
+		{
+		private:
+			typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+			typedef std::chrono::steady_clock Clock;
+
+			Network& m_net;
+			const std::vector<HogwildVector>& m_shared;
+			const Matrix& m_x;
+			const Matrix& m_y;
+			const int m_nworker;
+			std::vector<ConvergencePoint>& m_trace;
+
+			std::mutex m_mutex;
+			std::condition_variable m_cv;
+			int m_arrived;
+			int m_epoch;
+			bool m_aborted;
+			Clock::time_point m_resume;
+			double m_seconds;
+
+		public:
+			HogwildEpochs(Network& net, const std::vector<HogwildVector>& shared, const Matrix& x, const Matrix& y,
+						  const int nworker, std::vector<ConvergencePoint>& trace) :
+			m_net(net), m_shared(shared), m_x(x), m_y(y), m_nworker(nworker), m_trace(trace),
+			m_arrived(0), m_epoch(0), m_aborted(false), m_seconds(0)
+			{}
+
+			// The training time is counted from here
+			void start() { m_resume = Clock::now(); }
+
+			// Returns false if a worker has failed, which stops the others
+			bool epoch_end(const int epoch)
+			{
+				std::unique_lock<std::mutex> lock(m_mutex);
+				if (m_aborted)
+					return false;
+
+				if (++m_arrived < m_nworker)
+				{
+					m_cv.wait(lock, [&] { return m_epoch >= epoch || m_aborted; });
+					return !m_aborted;
+				}
+
+				m_seconds += std::chrono::duration<double>(Clock::now() - m_resume).count();
+				const int nlayer = m_shared.size();
+				for (int i = 0; i < nlayer; i++)
+					m_net.set_parameters(i, std::vector<Scalar>(m_shared[i].data(), m_shared[i].data() + m_shared[i].size()));
+				ConvergencePoint point = { epoch, m_seconds, m_net.loss(m_x, m_y) };
+				m_trace.push_back(point);
+
+				m_arrived = 0;
+				m_epoch = epoch;
+				m_resume = Clock::now();
+				m_cv.notify_all();
+				return true;
+			}
+
+			// Called by a worker that failed, so that the others do not wait for it
+			void abort()
+			{
+				{
+					std::lock_guard<std::mutex> lock(m_mutex);
+					m_aborted = true;
+				}
+				m_cv.notify_all();
+			}
+		};
+
+		///
+		/// Applies the gradients of a replica to the shared parameters, without locks
+		///
+		/// Runs after backprop() of each batch. The update reads and writes the
+		/// shared parameters while the other workers do the same, so it may lose or
+		/// mix some of their updates; with sparse or small updates these collisions
+		/// are rare and do not prevent convergence. The layer then reads the
+		/// shared parameters back, including the updates of the other workers.
+		///
+		template <typename OptimizerT>
+		class HogwildWorker : public Callback
+		{
+		private:
+			std::vector<HogwildVector>& m_shared;
+			HogwildEpochs& m_epochs;
+			OptimizerT m_opt;
+			HogwildVector m_deriv;
+			std::vector<Scalar> m_param;
+
+		public:
+			HogwildWorker(std::vector<HogwildVector>& shared, HogwildEpochs& epochs, const OptimizerT& opt) :
+			m_shared(shared), m_epochs(epochs), m_opt(opt) {}
+
+			bool epoch_end(Network& net, const int epoch) { return m_epochs.epoch_end(epoch); }
+
+			void pre_update(Network& net)
+			{
+				const int nlayer = net.num_layers();
+				for (int i = 0; i < nlayer; i++)
+				{
+					const Layer& layer = *net.get_layers()[i];
+					if (!layer.trainable() || m_shared[i].size() == 0)
+						continue;
+
+					// The gradients cover the leading parameters, and the layout of
+					// get_derivatives() is the same as get_parameters()
+					const std::vector<Scalar> deriv = layer.get_derivatives();
+					const int nderiv = deriv.size();
+					m_deriv = Eigen::Map<const HogwildVector>(deriv.data(), nderiv);
+					HogwildVector::ConstAlignedMapType dvec(m_deriv.data(), nderiv);
+					HogwildVector::AlignedMapType param(m_shared[i].data(), nderiv);
+					m_opt.update(dvec, param);
+
+					// Parameters without gradients, such as running statistics, are
+					// updated by the layer itself
+					if (nderiv < m_shared[i].size())
+					{
+						m_param = layer.get_parameters();
+						std::copy(m_param.begin() + nderiv, m_param.end(), m_shared[i].data() + nderiv);
+					}
+
+					m_param.assign(m_shared[i].data(), m_shared[i].data() + m_shared[i].size());
+					net.set_parameters(i, m_param);
+				}
+			}
+		};
+	}
+
+	///
+	/// Train a network with Hogwild asynchronous stochastic gradient descent
+	///
+	/// 'nthread' workers train replicas of the network on contiguous shards of the
+	/// data, each with its own shuffling and its own copy of 'opt'. After each
+	/// batch, a worker applies its gradients directly to parameters shared by all
+	/// the workers, without locks or barriers, and continues from the shared
+	/// values. This removes the synchronization of the gradients, at the price of
+	/// stale and occasionally overwritten updates, and suits wide layers whose
+	/// updates rarely collide. As in the original Hogwild, the concurrent accesses
+	/// to the shared parameters are deliberate data races.
+	///
+	/// The workers wait for each other after each epoch so that the loss on the
+	/// training data is recorded, and the shared parameters are copied into 'net'
+	/// at that point. Checkpointing and storage settings of 'net' do not apply to
+	/// the replicas. With a single thread the result is the one of Network::fit()
+	/// with the same optimizer and seed.
+	///
+	/// \param net           The network, with initialized parameters and an output layer
+	/// \param opt           The optimizer, copied into each worker
+	/// \param x             Predictors, one observation per column
+	/// \param y             Targets, one observation per column
+	/// \param batch_size    Mini-batch size of each worker
+	/// \param epoch         Number of passes over the data
+	/// \param nthread       Number of worker threads
+	/// \param seed          Seed of the shuffling RNG of worker k is 'seed + k', ignored if not positive
+	/// \return              The loss after each epoch, starting with epoch 0 before training
+	///
+	template <typename OptimizerT, typename DerivedX, typename DerivedY>
+	std::vector<ConvergencePoint> fit_hogwild(Network& net, const OptimizerT& opt,
+											  const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+											  const int batch_size, const int epoch, const int nthread, const int seed = -1)
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+		const int nlayer = net.num_layers();
+		const int nworker = std::max(1, std::min<int>(nthread, x.cols()));
+		if (nlayer <= 0 || net.get_output() == NULL)
+			throw std::invalid_argument("[function fit_hogwild]: Network has no layer or no output layer");
+
+		const Matrix xdata = x, ydata = y;
+		std::vector<ConvergencePoint> res;
+		ConvergencePoint start = { 0, 0.0, net.loss(xdata, ydata) };
+		res.push_back(start);
+
+		const std::vector< std::vector<Scalar> > param = net.get_parameters();
+		std::vector<internal::HogwildVector> shared(nlayer);
+		for (int i = 0; i < nlayer; i++)
+			shared[i] = Eigen::Map<const internal::HogwildVector>(param[i].data(), param[i].size());
+
+		internal::HogwildEpochs epochs(net, shared, xdata, ydata, nworker, res);
+		std::vector<Network*> replica(nworker);
+		std::vector< internal::HogwildWorker<OptimizerT>* > worker(nworker);
+		for (int k = 0; k < nworker; k++)
+		{
+			replica[k] = new Network();
+			internal::replicate_network(net, *replica[k]);
+			worker[k] = new internal::HogwildWorker<OptimizerT>(shared, epochs, opt);
+			replica[k]->set_callback(*worker[k]);
+		}
+
+		// Each worker runs all the epochs in one fit(), so its batches are shuffled
+		// once, as in Network::fit()
+		std::vector<std::exception_ptr> worker_error(nworker);
+		std::vector<std::thread> threads;
+		epochs.start();
+		for (int k = 0; k < nworker; k++)
+		{
+			threads.push_back(std::thread([&, k]()
+			{
+				try
+				{
+					const int begin = static_cast<long long>(xdata.cols()) * k / nworker;
+					const int end = static_cast<long long>(xdata.cols()) * (k + 1) / nworker;
+					internal::NoUpdate no_update;
+					replica[k]->fit(no_update, xdata.middleCols(begin, end - begin),
+									ydata.middleCols(begin, end - begin), batch_size, epoch,
+									seed > 0 ? seed + k : -1);
+				}
+				catch (...)
+				{
+					worker_error[k] = std::current_exception();
+					epochs.abort();
+				}
+			}));
+		}
+
+		std::exception_ptr error;
+		for (int k = 0; k < nworker; k++)
+		{
+			threads[k].join();
+			if (worker_error[k] && !error)
+				error = worker_error[k];
+		}
+
+		for (int k = 0; k < nworker; k++)
+		{
+			delete replica[k];
+			delete worker[k];
+		}
+		if (error)
+			std::rethrow_exception(error);
+
+		return res;
+	}
+
+	namespace internal
+	{
+		// Records the loss after each epoch of Network::fit(), and forwards the
+		// other hooks to the callback that was set on the network
+		class EpochTrace : public Callback
+		{
+		private:
+			typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+			typedef std::chrono::steady_clock Clock;
+
+			Callback& m_next;
+			const Matrix& m_x;
+			const Matrix& m_y;
+			std::vector<ConvergencePoint>& m_trace;
+			Clock::time_point m_resume;
+			double m_seconds;
+
+		public:
+			EpochTrace(Callback& next, const Matrix& x, const Matrix& y, std::vector<ConvergencePoint>& trace) :
+			m_next(next), m_x(x), m_y(y), m_trace(trace), m_resume(Clock::now()), m_seconds(0)
+			{}
+
+			void gradients_ready(Network& net, const int layer) { m_next.gradients_ready(net, layer); }
+
+			void pre_update(Network& net) { m_next.pre_update(net); }
+
+			bool epoch_end(Network& net, const int epoch)
+			{
+				m_seconds += std::chrono::duration<double>(Clock::now() - m_resume).count();
+				ConvergencePoint point = { epoch, m_seconds, net.loss(m_x, m_y) };
+				m_trace.push_back(point);
+				m_resume = Clock::now();
+				return m_next.epoch_end(net, epoch);
+			}
+		};
+	}
+
+	///
+	/// Train a network with Network::fit(), and record the loss on the training
+	/// data after each epoch, for comparison with fit_hogwild(). The time spent
+	/// in the evaluations of the loss is not counted. The callback of the network
+	/// still runs, but as with any callback the updates are not overlapped
+	///
+	template <typename DerivedX, typename DerivedY>
+	std::vector<ConvergencePoint> fit_traced(Network& net, Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x,
+											 const Eigen::MatrixBase<DerivedY>& y, const int batch_size,
+											 const int epoch, const int seed = -1)
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+		const Matrix xdata = x, ydata = y;
+		std::vector<ConvergencePoint> res;
+		ConvergencePoint start = { 0, 0.0, net.loss(xdata, ydata) };
+		res.push_back(start);
+
+		Callback& callback = net.get_callback();
+		internal::EpochTrace trace(callback, xdata, ydata, res);
+		net.set_callback(trace);
+		try
+		{
+			net.fit(opt, xdata, ydata, batch_size, epoch, seed);
+		}
+		catch (...)
+		{
+			net.set_callback(callback);
+			throw;
+		}
+		net.set_callback(callback);
+
+		return res;
+	}
+
+	///
+	/// Print two convergence traces side by side, such as those of fit_traced()
+	/// and fit_hogwild()
+	///
+	inline void convergence_summary(std::ostream& os, const std::vector<ConvergencePoint>& sync,
+									const std::vector<ConvergencePoint>& hogwild)
+	{
+		const std::ios_base::fmtflags flags = os.flags();
+		const std::streamsize precision = os.precision();
+
+		os << "Epoch  Sync seconds     Sync loss  Hogwild seconds  Hogwild loss\n";
+		const std::size_t n = std::max(sync.size(), hogwild.size());
+		for (std::size_t i = 0; i < n; i++)
+		{
+			os << std::left << std::setw(5) << i << std::right << std::fixed;
+			if (i < sync.size())
+				os << std::setprecision(3) << std::setw(14) << sync[i].seconds
+				   << std::setprecision(6) << std::setw(14) << sync[i].loss;
+			else
+				os << std::setw(28) << "";
+			if (i < hogwild.size())
+				os << std::setprecision(3) << std::setw(17) << hogwild[i].seconds
+				   << std::setprecision(6) << std::setw(14) << hogwild[i].loss;
+			os << "\n";
+		}
+
+		os.flags(flags);
+		os.precision(precision);
+	}
+}
\ No newline at end of file
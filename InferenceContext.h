@@ -0,0 +1,61 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <stdexcept>
+#include "Config.h"
+#include "Layer.h"
+#include "Network.h"
+
+namespace MiniDNN
+{
+	///
+	/// Execution state for running predictions on a shared Network
+	///
+	/// The context only holds activation buffers and reads the parameters of the
+	/// network through Layer::predict(), which is const. Each thread uses its own
+	/// context, and any number of contexts can run concurrently on one network as
+	/// long as nobody trains or modifies it at the same time. The context keeps
+	/// the layer list of the network at construction, so it has to be recreated
+	/// after read_net() or add_layer().
+	///
+	class InferenceContext
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+		std::vector<const Layer*> m_layers;
+
+		// Pre-activation scratch, and two output buffers used alternately
+		Matrix m_z;
+		Matrix m_a[2];
+
+	public:
+		explicit InferenceContext(const Network& net) :
+		m_layers(net.get_layers()) {}
+
+		// The returned reference stays valid until the next call
+		const Matrix& predict(const Matrix& x)
+		{
+			const int nlayer = m_layers.size();
+			if (nlayer <= 0)
+			{
+				m_a[0].resize(0, 0);
+				return m_a[0];
+			}
+
+			if (x.rows() != m_layers[0]->in_size())
+				throw std::invalid_argument("[class InferenceContext]: Input data have incorrect dimension");
+
+			const Matrix* input = &x;
+			for (int i = 0; i < nlayer; i++)
+			{
+				Matrix& output = m_a[i % 2];
+				m_layers[i]->predict(*input, m_z, output);
+				input = &output;
+			}
+
+			return *input;
+		}
+	};
+}
\ No newline at end of file
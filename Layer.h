@@ -6,6 +6,7 @@
 #include "Config.h"
 #include "RNG.h"
 #include "Optimizer.h"
+#include "Utils/Cost.h"
 
 namespace MiniDNN
 {
@@ -19,9 +20,16 @@ namespace MiniDNN
 		const int m_in_size;
 		const int m_out_size;
 
+		// Whether update() changes the parameters
+		bool m_trainable;
+		// Which gradients backprop() has to compute, see set_gradient_need()
+		bool m_need_param_grad;
+		bool m_need_input_grad;
+
 	public:
 		Layer(const int in_size, const int out_size) :
-		m_in_size(in_size), m_out_size(out_size) {}
+		m_in_size(in_size), m_out_size(out_size),
+		m_trainable(true), m_need_param_grad(true), m_need_input_grad(true) {}
 
 		virtual ~Layer() {}
 
@@ -29,18 +37,59 @@ namespace MiniDNN
 
 		int out_size() const { return m_out_size; }
 
+		bool trainable() const { return m_trainable; }
+
+		// A frozen layer keeps its parameters during training
+		void set_trainable(const bool trainable) { m_trainable = trainable; }
+
+		// Tell backprop() whether the parameter gradients (get_derivatives()) and the
+		// input gradient (backprop_data()) are read afterwards. Unneeded ones are not computed
+		void set_gradient_need(const bool param_grad, const bool input_grad)
+		{
+			m_need_param_grad = param_grad;
+			m_need_input_grad = input_grad;
+		}
+
 		virtual void init(const Scalar& mu, const Scalar& sigma, RNG& rng) = 0;
 
 		virtual void init() = 0;
 
 		virtual void forward(const Matrix& prev_layer_data) = 0;
 
+		// Stateless forward pass for inference. The pre-activation values go to 'z' and
+		// the output to 'a', so concurrent calls with separate buffers are safe
+		virtual void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const = 0;
+
 		virtual const Matrix& output() const = 0;
 
+		// Compute the parameter gradients and backprop_data(). Layers finish reading
+		// their parameters before returning, so that update() can run on another
+		// thread while the layers below continue the backward pass
 		virtual void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data) = 0;
 
 		virtual const Matrix& backprop_data() const = 0;
 
+		// Free the per-batch buffers (output, saved activations and input gradient).
+		// The next forward() reallocates them
+		virtual void release_state() = 0;
+
+		// Whether backprop() reads the values of 'prev_layer_data', or only its shape
+		virtual bool backprop_reads_input() const { return true; }
+
+		// Keep the state saved for backprop() in reduced precision (internal::STORAGE_ENUM)
+		// until decompress_state(). 'keep_output' tells whether the next layer reads
+		// output() in its own backprop()
+		virtual void compress_state(const int storage, const bool keep_output) {}
+
+		virtual void decompress_state() {}
+
+		// Read the weights from a reduced precision copy (internal::STORAGE_ENUM) in
+		// forward() and backprop(). The parameters, their gradients and update() stay
+		// in full precision. Layers without support ignore it
+		virtual void set_parameter_storage(const int storage) {}
+
+		// Only touches the parameters, their gradients and the caches derived from
+		// them, not the state released by release_state()
 		virtual void update(Optimizer& opt) = 0;
 
 		virtual std::vector<Scalar> get_parameters() const = 0;
@@ -49,10 +98,16 @@ namespace MiniDNN
 
 		virtual std::vector<Scalar> get_derivatives() const = 0;
 
+		// Overwrite the gradients read by update(), in the layout of get_derivatives()
+		virtual void set_derivatives(const std::vector<Scalar>& deriv) {}
+
 		virtual std::string layer_type() const = 0;
 
 		virtual std::string activataion_type() const = 0;
 
 		virtual void fill_meta_info(MetaInfo& map, int index) const = 0;
+
+		// Static FLOP and memory cost of forward() and backprop() on 'batch_size' observations
+		virtual internal::LayerCost cost(const int batch_size) const = 0;
 	};
 }
\ No newline at end of file
@@ -0,0 +1,364 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/Compress.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+
+namespace MiniDNN
+{
+	namespace internal
+	{
+		// Added to the variance before the square root
+		const Scalar batch_norm_epsilon = Scalar(1e-5);
+
+		// Weight of the current batch in the running mean and variance
+		const Scalar batch_norm_momentum = Scalar(0.1);
+
+		// Inference-time scale and shift of 'nchannel' channels, from the parameters
+		// of a BatchNormalization layer. The output is 'scale * x + shift'
+		inline void batch_norm_affine(const Scalar* gamma, const Scalar* beta, const Scalar* mean, const Scalar* var,
+									  const int nchannel, Scalar* scale, Scalar* shift)
+		{
+			for (int c = 0; c < nchannel; c++)
+			{
+				scale[c] = gamma[c] / std::sqrt(var[c] + batch_norm_epsilon);
+				shift[c] = beta[c] - mean[c] * scale[c];
+			}
+		}
+	}
+
+	///
+	/// Batch normalization layer
+	///
+	/// Every channel is normalized to zero mean and unit variance over the pixels
+	/// and the observations of the batch, then scaled by 'gamma' and shifted by
+	/// 'beta', and the activation is applied. Placed between a layer with the
+	/// Identity activation and the nonlinearity, e.g. Convolutional<Identity> then
+	/// BatchNormalization<ReLU>, it can be folded into the preceding layer for
+	/// inference, see fold_batch_normalization().
+	///
+	/// forward() uses the statistics of the batch, and predict() the running
+	/// averages. The running averages are updated in backprop(), once per training
+	/// step even when checkpointing recomputes forward(), and frozen layers keep them.
+	/// For the output of a fully connected layer use a 1 x 1 image with one channel
+	/// per unit.
+	///
+	template <typename Activation>
+	class BatchNormalization : public Layer
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+		typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+		typedef Vector::AlignedMapType AlignedMapVec;
+		typedef Eigen::Stride<Eigen::Dynamic, Eigen::Dynamic> ChannelStride;
+		typedef Eigen::Map<const Matrix, 0, ChannelStride> ConstChannelMap;
+		typedef Eigen::Map<Matrix, 0, ChannelStride> ChannelMap;
+		typedef std::map<std::string, int> MetaInfo;
+
+		const int m_channel_rows;
+		const int m_channel_cols;
+		const int m_in_channels;
+		const int m_channel_size;
+		const int m_layout;
+
+		Vector m_gamma;
+		Vector m_beta;
+		Vector m_running_mean;
+		Vector m_running_var;
+		Vector m_dgamma;
+		Vector m_dbeta;
+
+		// Statistics of the last batch seen by forward()
+		Vector m_mean;
+		Vector m_var;
+		Vector m_inv_std;
+
+		Matrix m_z;
+		Matrix m_a;
+		Matrix m_din;
+
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+		// Observation 'i' of 'data' as a 'channel_size x in_channels' matrix
+		ChannelStride channel_stride() const
+		{
+			return m_layout == internal::CHANNELS_LAST ? ChannelStride(1, m_in_channels) :
+														 ChannelStride(m_channel_size, 1);
+		}
+
+		ConstChannelMap channels(const Matrix& data, const int i) const
+		{
+			return ConstChannelMap(data.data() + std::size_t(i) * this->m_in_size, m_channel_size, m_in_channels,
+								   channel_stride());
+		}
+
+		ChannelMap channels(Matrix& data, const int i) const
+		{
+			return ChannelMap(data.data() + std::size_t(i) * this->m_in_size, m_channel_size, m_in_channels,
+							  channel_stride());
+		}
+
+		// z = scale * x + shift, channel by channel
+		void apply_affine(const Matrix& x, const Vector& scale, const Vector& shift, Matrix& z) const
+		{
+			const int nobs = x.cols();
+			for (int i = 0; i < nobs; i++)
+			{
+				channels(z, i).noalias() = channels(x, i) * scale.asDiagonal();
+				channels(z, i).rowwise() += shift.transpose();
+			}
+		}
+
+	public:
+		BatchNormalization(const int in_width, const int in_height, const int in_channels,
+						   const int layout = internal::CHANNELS_FIRST) :
+		Layer(in_width * in_height * in_channels, in_width * in_height * in_channels),
+		m_channel_rows(in_height), m_channel_cols(in_width), m_in_channels(in_channels),
+		m_channel_size(in_width * in_height), m_layout(layout)
+		{
+			if (layout != internal::CHANNELS_FIRST && layout != internal::CHANNELS_LAST)
+				throw std::invalid_argument("[class BatchNormalization]: Unknown image layout");
+		}
+
+		// The normalization starts as the identity, so 'mu' and 'sigma' are not used
+		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+		{
+			init();
+
+			m_gamma.setOnes();
+			m_beta.setZero();
+			m_running_mean.setZero();
+			m_running_var.setOnes();
+		}
+
+		void init()
+		{
+			m_gamma.resize(m_in_channels);
+			m_beta.resize(m_in_channels);
+			m_running_mean.resize(m_in_channels);
+			m_running_var.resize(m_in_channels);
+			m_dgamma.resize(m_in_channels);
+			m_dbeta.resize(m_in_channels);
+		}
+
+		void forward(const Matrix& prev_layer_data)
+		{
+			const int nobs = prev_layer_data.cols();
+			const Scalar count = Scalar(m_channel_size) * nobs;
+
+			m_mean.setZero(m_in_channels);
+			for (int i = 0; i < nobs; i++)
+				m_mean.noalias() += channels(prev_layer_data, i).colwise().sum().transpose();
+			m_mean /= count;
+
+			m_var.setZero(m_in_channels);
+			for (int i = 0; i < nobs; i++)
+			{
+				m_var.noalias() += (channels(prev_layer_data, i).rowwise() - m_mean.transpose())
+									   .colwise().squaredNorm().transpose();
+			}
+			m_var /= count;
+			m_inv_std = (m_var.array() + internal::batch_norm_epsilon).rsqrt();
+
+			const Vector scale = m_gamma.cwiseProduct(m_inv_std);
+			const Vector shift = m_beta - m_mean.cwiseProduct(scale);
+			m_z.resize(this->m_out_size, nobs);
+			apply_affine(prev_layer_data, scale, shift, m_z);
+
+			m_a.resize(this->m_out_size, nobs);
+			Activation::activate(m_z, m_a);
+		}
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
+		{
+			const int nobs = prev_layer_data.cols();
+			Vector scale(m_in_channels), shift(m_in_channels);
+			internal::batch_norm_affine(m_gamma.data(), m_beta.data(), m_running_mean.data(), m_running_var.data(),
+										m_in_channels, scale.data(), shift.data());
+
+			z.resize(this->m_out_size, nobs);
+			apply_affine(prev_layer_data, scale, shift, z);
+
+			a.resize(this->m_out_size, nobs);
+			Activation::activate(z, a);
+		}
+
+		const Matrix& output() const { return m_a; }
+
+		void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+		{
+			const int nobs = prev_layer_data.cols();
+			const Scalar count = Scalar(m_channel_size) * nobs;
+
+			Matrix& dLz = m_z;
+			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+
+			// Per channel, the sums of g = dL/dz and of g * (x - mean)
+			Vector sum_g = Vector::Zero(m_in_channels);
+			Vector sum_gx = Vector::Zero(m_in_channels);
+			for (int i = 0; i < nobs; i++)
+			{
+				sum_g.noalias() += channels(dLz, i).colwise().sum().transpose();
+				sum_gx.noalias() += (channels(prev_layer_data, i).rowwise() - m_mean.transpose())
+										.cwiseProduct(channels(dLz, i)).colwise().sum().transpose();
+			}
+
+			if (m_need_param_grad)
+			{
+				m_dgamma.noalias() = sum_gx.cwiseProduct(m_inv_std) / nobs;
+				m_dbeta.noalias() = sum_g / nobs;
+
+				// Unbiased variance for the running average
+				const Scalar unbias = count > 1 ? count / (count - 1) : Scalar(1);
+				const Scalar m = internal::batch_norm_momentum;
+				m_running_mean = (1 - m) * m_running_mean + m * m_mean;
+				m_running_var = (1 - m) * m_running_var + (m * unbias) * m_var;
+			}
+
+			if (m_need_input_grad)
+			{
+				// dL/dx = gamma * inv_std * (g - mean(g) - xhat * mean(g * xhat)),
+				// with xhat = (x - mean) * inv_std
+				const Vector a = m_gamma.cwiseProduct(m_inv_std);
+				const Vector b = -a.cwiseProduct(m_inv_std.cwiseAbs2()).cwiseProduct(sum_gx) / count;
+				const Vector c = -a.cwiseProduct(sum_g) / count - b.cwiseProduct(m_mean);
+
+				m_din.resize(this->m_in_size, nobs);
+				for (int i = 0; i < nobs; i++)
+				{
+					ChannelMap din = channels(m_din, i);
+					din.noalias() = channels(dLz, i) * a.asDiagonal();
+					din.noalias() += channels(prev_layer_data, i) * b.asDiagonal();
+					din.rowwise() += c.transpose();
+				}
+			}
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		void release_state()
+		{
+			m_z.resize(0, 0);
+			m_a.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
+		}
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
+
+		void update(Optimizer& opt)
+		{
+			ConstAlignedMapVec dg(m_dgamma.data(), m_dgamma.size());
+			ConstAlignedMapVec db(m_dbeta.data(), m_dbeta.size());
+			AlignedMapVec	   g(m_gamma.data(), m_gamma.size());
+			AlignedMapVec	   b(m_beta.data(), m_beta.size());
+			opt.update(dg, g);
+			opt.update(db, b);
+		}
+
+		// gamma, beta, running mean and running variance
+		std::vector<Scalar> get_parameters() const
+		{
+			std::vector<Scalar> res(4 * m_in_channels);
+
+			std::copy(m_gamma.data(), m_gamma.data() + m_in_channels, res.begin());
+			std::copy(m_beta.data(), m_beta.data() + m_in_channels, res.begin() + m_in_channels);
+			std::copy(m_running_mean.data(), m_running_mean.data() + m_in_channels, res.begin() + 2 * m_in_channels);
+			std::copy(m_running_var.data(), m_running_var.data() + m_in_channels, res.begin() + 3 * m_in_channels);
+
+			return res;
+		}
+
+		void set_parameters(const std::vector<Scalar>& param)
+		{
+			if (static_cast<int>(param.size()) != 4 * m_in_channels)
+			{
+				throw std::invalid_argument("[Class BatchNormalization]: Parameter size does not match");
+			}
+
+			std::copy(param.begin(), param.begin() + m_in_channels, m_gamma.data());
+			std::copy(param.begin() + m_in_channels, param.begin() + 2 * m_in_channels, m_beta.data());
+			std::copy(param.begin() + 2 * m_in_channels, param.begin() + 3 * m_in_channels, m_running_mean.data());
+			std::copy(param.begin() + 3 * m_in_channels, param.end(), m_running_var.data());
+		}
+
+		// The running statistics are not trained, so their derivatives are zero
+		std::vector<Scalar> get_derivatives() const
+		{
+			std::vector<Scalar> res(4 * m_in_channels, Scalar(0));
+
+			std::copy(m_dgamma.data(), m_dgamma.data() + m_in_channels, res.begin());
+			std::copy(m_dbeta.data(), m_dbeta.data() + m_in_channels, res.begin() + m_in_channels);
+			return res;
+		}
+
+		// Only the derivatives of gamma and beta are read
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			if (static_cast<int>(deriv.size()) != 4 * m_in_channels)
+			{
+				throw std::invalid_argument("[Class BatchNormalization]: Derivative size does not match");
+			}
+
+			std::copy(deriv.begin(), deriv.begin() + m_in_channels, m_dgamma.data());
+			std::copy(deriv.begin() + m_in_channels, deriv.begin() + 2 * m_in_channels, m_dbeta.data());
+		}
+
+		std::string layer_type() const { return "BatchNormalization"; }
+
+		std::string activataion_type() const { return Activation::return_type(); }
+
+		void fill_meta_info(MetaInfo& map, int index) const
+		{
+			std::string ind = internal::to_string(index);
+			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
+			map.insert(std::make_pair("in_width" + ind, m_channel_cols));
+			map.insert(std::make_pair("in_height" + ind, m_channel_rows));
+			map.insert(std::make_pair("in_channels" + ind, m_in_channels));
+			map.insert(std::make_pair("layout" + ind, m_layout));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double size = this->m_in_size;
+			const double n = batch_size;
+			const double nparam = 4.0 * m_in_channels;
+			internal::LayerCost res;
+
+			// Mean, variance, scale and shift, activation
+			res.forward_flops = 7 * size * n;
+			// Jacobian, the two channel sums, then din if it is needed
+			res.backward_flops = size * n + 4 * size * n + (m_need_input_grad ? 5 * size * n : 0);
+
+			res.param_bytes = internal::scalar_bytes(nparam);
+			// m_z and m_a, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * size * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(size * n) : 0;
+
+			// The input is read once for each statistic and once for the normalization
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (6 * size * n + nparam);
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (8 * size * n + 2 * nparam);
+
+			return res;
+		}
+	};
+}
\ No newline at end of file
@@ -6,12 +6,22 @@
 #include "../Config.h"
 #include "../Layer.h"
 #include "../Utils/Convolution.h"
+#include "../Utils/ConvolutionChannelsLast.h"
 #include "../Utils/Random.h"
+#include "../Utils/Compress.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
 
 namespace MiniDNN
 {
+	///
+	/// Convolutional layer
+	///
+	/// Images are stored channels-first by default. With the internal::CHANNELS_LAST
+	/// layout both the input and the output of the layer keep the channel values
+	/// of each pixel together; see Utils/ConvolutionChannelsLast.h. The parameters
+	/// have the same layout in both cases.
+	///
 	template <typename Activation>
 	class Convolutional : public Layer
 	{
@@ -24,9 +34,14 @@ namespace MiniDNN
 		typedef std::map<std::string, int> MataInfo;
 
 		const internal::ConvDims m_dim;
+		const int m_layout;
 
 		Vector m_filter_data;
 		Vector m_df_data;
+		// Filters packed for convolve_full(), rebuilt when empty
+		Matrix m_full_filters;
+		// Filters packed for the channels-last kernels, updated with the filters
+		Matrix m_packed_filters;
 
 		Vector m_bias;
 		Vector m_db;
@@ -34,16 +49,31 @@ namespace MiniDNN
 		Matrix m_z;
 		Matrix m_a;
 		Matrix m_din;
+
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+		void filters_changed()
+		{
+			m_full_filters.resize(0, 0);
+			if (m_layout == internal::CHANNELS_LAST && m_filter_data.size() > 0)
+				internal::pack_channels_last_filters(m_dim, m_filter_data.data(), m_packed_filters);
+		}
 		
 	public:
 		Convolutional(const int in_width, const int in_height,
 					  const int in_channels, const int out_channels,
-					  const int window_width, const int window_height) :
+					  const int window_width, const int window_height,
+					  const int layout = internal::CHANNELS_FIRST) :
 		
 		Layer(in_width * in_height * in_channels,
 			  (in_width - window_width + 1) * (in_height - window_height + 1) * out_channels),
-		m_dim(in_channels, out_channels, in_height, in_width, window_height, window_width)
-		{}
+		m_dim(in_channels, out_channels, in_height, in_width, window_height, window_width),
+		m_layout(layout)
+		{
+			if (layout != internal::CHANNELS_FIRST && layout != internal::CHANNELS_LAST)
+				throw std::invalid_argument("[class Convolutional]: Unknown image layout");
+		}
 
 		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
 		{
@@ -54,6 +84,7 @@ namespace MiniDNN
 			internal::set_normal_random(m_filter_data.data(), filter_data_size, rng, mu, sigma);
 
 			internal::set_normal_random(m_bias.data(), m_dim.out_channels, rng, mu, sigma);
+			filters_changed();
 		}
 
 		void init()
@@ -63,29 +94,43 @@ namespace MiniDNN
 
 			m_filter_data.resize(filter_data_size);
 			m_df_data.resize(filter_data_size);
+			m_full_filters.resize(0, 0);
 
 			m_bias.resize(m_dim.out_channels);
 			m_db.resize(m_dim.out_channels);
 
 		}
 
-		void forward(const Matrix& prev_layer_data)
+		void forward(const Matrix& prev_layer_data) { predict(prev_layer_data, m_z, m_a); }
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
 		{
 			const int nobs = prev_layer_data.cols();
-			m_z.resize(this->m_out_size, nobs);
+			z.resize(this->m_out_size, nobs);
+
+			if (m_layout == internal::CHANNELS_LAST)
+			{
+				internal::convolve_valid_channels_last(m_dim, prev_layer_data.data(), nobs, m_packed_filters, z.data());
+				// Every column holds the channels of one pixel
+				Eigen::Map<Matrix>(z.data(), m_dim.out_channels, z.size() / m_dim.out_channels).colwise() += m_bias;
+
+				a.resize(this->m_out_size, nobs);
+				Activation::activate(z, a);
+				return;
+			}
 
 			internal::convolve_valid(m_dim, prev_layer_data.data(), true, nobs,
-									m_filter_data.data(), m_z.data());
+									m_filter_data.data(), z.data());
 			int channel_start_row = 0;
 			const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
 
 			for (int i = 0; i < m_dim.out_channels; i++, channel_start_row += channel_nelem)
 			{
-				m_z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+				z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
 			}
 
-			m_a.resize(this->m_out_size, nobs);
-			Activation::activate(m_z, m_a);
+			a.resize(this->m_out_size, nobs);
+			Activation::activate(z, a);
 		}
 
 		const Matrix& output() const { return m_a; }
@@ -97,27 +142,60 @@ namespace MiniDNN
 			Matrix& dLz = m_z;
 			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
 
-			internal::ConvDims back_conv_dim(nobs, m_dim.out_channels, m_dim.channel_rows,
-											m_dim.channel_cols, m_dim.conv_rows, m_dim.conv_cols);
-			internal::convolve_valid(back_conv_dim, prev_layer_data.data(), false, m_dim.in_channels,
-									dLz.data(), m_df_data.data());
+			if (m_layout == internal::CHANNELS_LAST)
+			{
+				if (m_need_param_grad)
+				{
+					internal::convolve_filter_gradient_channels_last(m_dim, prev_layer_data.data(), dLz.data(), nobs,
+																	 Scalar(1) / nobs, m_df_data.data(), m_db.data());
+				}
+
+				if (m_need_input_grad)
+				{
+					m_din.resize(this->m_in_size, nobs);
+					internal::convolve_input_gradient_channels_last(m_dim, dLz.data(), nobs, m_packed_filters,
+																	m_din.data());
+				}
+				return;
+			}
 
-			m_df_data /= nobs;
+			if (m_need_param_grad)
+			{
+				internal::convolve_filter_gradient(m_dim, prev_layer_data.data(), dLz.data(), nobs,
+												   Scalar(1) / nobs, m_df_data.data(), m_db.data());
+			}
 
-			ConstAlignedMapMat dLz_by_channel(dLz.data(), m_dim.conv_rows * m_dim.conv_cols,
-											m_dim.out_channels * nobs);
-			Vector dLb = dLz_by_channel.colwise().sum();
+			if (m_need_input_grad)
+			{
+				m_din.resize(this->m_in_size, nobs);
+				internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels, m_dim.conv_rows,
+												m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
+				if (m_full_filters.size() == 0)
+					internal::pack_full_filters(conv_full_dim, m_filter_data.data(), m_full_filters);
+				internal::convolve_full(conv_full_dim, dLz.data(), nobs, m_full_filters, m_din.data());
+			}
+		}
 
-			ConstAlignedMapMat dLb_by_obs(dLb.data(), m_dim.out_channels, nobs);
-			m_db.noalias() = dLb_by_obs.rowwise().mean();
+		const Matrix& backprop_data() const { return m_din; }
 
-			m_din.resize(this->m_in_size, nobs);
-			internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels, m_dim.conv_rows,
-											m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
-			internal::convolve_full(conv_full_dim, dLz.data(), nobs, m_filter_data.data(), m_din.data());
+		void release_state()
+		{
+			m_z.resize(0, 0);
+			m_a.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
 		}
 
-		const Matrix& backprop_data() const { return m_din; }
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
 
 		void update(Optimizer& opt)
 		{
@@ -127,6 +205,7 @@ namespace MiniDNN
 			AlignedMapVec	   b(m_bias.data(), m_bias.size());
 							   opt.update(dw, w);
 							   opt.update(db, b);
+							   filters_changed();
 		}
 
 		std::vector<Scalar> get_parameters() const
@@ -146,7 +225,9 @@ namespace MiniDNN
 				throw std::invalid_argument("[Class Convolutional]: Parameter size does not match");
 			}
 
+			std::copy(param.begin(), param.begin() + m_filter_data.size(), m_filter_data.data());
 			std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+			filters_changed();
 		}
 
 		std::vector<Scalar> get_derivatives() const
@@ -159,6 +240,17 @@ namespace MiniDNN
 			return res;
 		}
 
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			if (static_cast<int>(deriv.size()) != m_df_data.size() + m_db.size())
+			{
+				throw std::invalid_argument("[Class Convolutional]: Derivative size does not match");
+			}
+
+			std::copy(deriv.begin(), deriv.begin() + m_df_data.size(), m_df_data.data());
+			std::copy(deriv.begin() + m_df_data.size(), deriv.end(), m_db.data());
+		}
+
 		std::string layer_type() const { return "Convolutional"; }
 
 		std::string activataion_type() const { return Activation::return_type(); }
@@ -169,11 +261,56 @@ namespace MiniDNN
 			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
 			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
 			map.insert(std::make_pair("in_channels" + ind, m_dim.in_channels));
-			map.insert(std::make_pair("out_channel" + ind, m_dim.out_channels));
+			map.insert(std::make_pair("out_channels" + ind, m_dim.out_channels));
 			map.insert(std::make_pair("in_height" + ind, m_dim.channel_rows));
 			map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
 			map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
 			map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+			map.insert(std::make_pair("layout" + ind, m_layout));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double n = batch_size;
+			const double filter_size = m_dim.filter_rows * m_dim.filter_cols;
+			const double nparam = filter_size * m_dim.in_channels * m_dim.out_channels + m_dim.out_channels;
+			internal::LayerCost res;
+
+			// Every output element is a dot product of length 'in_channels * filter_size'
+			const double conv_flops = 2 * out * n * m_dim.in_channels * filter_size;
+			// Every input element receives 'out_channels * filter_size' contributions
+			const double full_flops = 2 * in * n * m_dim.out_channels * filter_size;
+			res.forward_flops = conv_flops + 2 * out * n;
+			// Jacobian, then the filter and bias gradients, and din if they are needed
+			res.backward_flops = out * n + (m_need_param_grad ? conv_flops + out * n : 0) +
+								 (m_need_input_grad ? full_flops : 0);
+
+			// The same workspaces that forward() and backprop() allocate
+			internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels, m_dim.conv_rows,
+											m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
+			const bool channels_last = (m_layout == internal::CHANNELS_LAST);
+			const double fwd_ws = channels_last ? internal::convolve_channels_last_workspace(m_dim, batch_size) :
+												  internal::convolve_valid_workspace(m_dim, batch_size);
+			const double bwd_ws = channels_last ? std::max(
+				m_need_param_grad ? internal::convolve_filter_gradient_channels_last_workspace(m_dim, batch_size) : 0.0,
+				m_need_input_grad ? internal::convolve_input_gradient_channels_last_workspace(m_dim, batch_size) : 0.0) : std::max(
+				m_need_param_grad ? internal::convolve_filter_gradient_workspace(m_dim, batch_size) : 0.0,
+				m_need_input_grad ? internal::convolve_full_workspace(conv_full_dim, batch_size) : 0.0);
+
+			res.param_bytes = internal::scalar_bytes(nparam);
+			// m_z and m_a, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * out * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+			res.forward_scratch_bytes = internal::scalar_bytes(fwd_ws);
+			res.backward_scratch_bytes = internal::scalar_bytes(bwd_ws);
+
+			// Workspaces are written once and read back once
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (in * n + nparam + 3 * out * n + 2 * fwd_ws);
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (4 * out * n + 2 * in * n + 3 * nparam + 2 * bwd_ws);
+
+			return res;
 		}
 	};
 }
\ No newline at end of file
@@ -0,0 +1,381 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <stdexcept>
+#include <algorithm>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/Convolution.h"
+#include "../Utils/FindMax.h"
+#include "../Utils/ThreadPool.h"
+#include "../Utils/Random.h"
+#include "../Utils/Compress.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+
+namespace MiniDNN
+{
+	///
+	/// A Convolutional layer directly followed by a MaxPooling layer
+	///
+	/// Computes the same function as the two layers, with the same parameter
+	/// layout as Convolutional. The convolution output is produced a few
+	/// observations at a time and pooled while it is still in cache, so only the
+	/// pooled activations, the pre-activation values at the maxima and the
+	/// one-byte position of each maximum within its window are kept. backprop()
+	/// routes the gradient straight to the maxima of the convolution output.
+	///
+	/// The activation must act elementwise, so Softmax is not supported.
+	///
+	template <typename Activation>
+	class ConvolutionalMaxPooling : public Layer
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+		typedef Eigen::Matrix<unsigned char, Eigen::Dynamic, Eigen::Dynamic> LocMatrix;
+		typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+		typedef Vector::AlignedMapType AlignedMapVec;
+		typedef std::map<std::string, int> MetaInfo;
+
+		const internal::ConvDims m_dim;
+		const int m_pool_rows;
+		const int m_pool_cols;
+		const int m_out_rows;
+		const int m_out_cols;
+
+		Vector m_filter_data;
+		Vector m_df_data;
+		// Filters packed for convolve_full(), rebuilt when empty
+		Matrix m_full_filters;
+
+		Vector m_bias;
+		Vector m_db;
+
+		// Pooled output, pre-activation value of each maximum and its position in the window
+		Matrix m_a;
+		Matrix m_z;
+		LocMatrix m_loc;
+		// Gradient with respect to the convolution output, only alive during backprop()
+		Matrix m_dlz;
+		Matrix m_din;
+
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+		// Number of observations whose convolution output fits in about 256KB
+		int chunk_obs() const
+		{
+			const int conv_size = m_dim.conv_rows * m_dim.conv_cols * m_dim.out_channels;
+			return std::max(1, int(32768 / conv_size));
+		}
+
+		// Pool the activated convolution output 'conv_a' of 'nobs' observations. 'z', 'a'
+		// and 'loc' point to the first of these observations, and 'z' and 'loc' may be NULL
+		void pool(const Matrix& conv_z, const Matrix& conv_a, const int nobs,
+				  Scalar* z, Scalar* a, unsigned char* loc) const
+		{
+			const int conv_channel = m_dim.conv_rows * m_dim.conv_cols;
+			const int col_stride = m_dim.conv_rows * m_pool_cols;
+			int offset;
+
+			for (int k = 0; k < nobs; k++)
+			{
+				const Scalar* z_obs = conv_z.data() + std::size_t(k) * conv_z.rows();
+				const Scalar* a_obs = conv_a.data() + std::size_t(k) * conv_a.rows();
+
+				for (int channel_start = 0; channel_start < conv_a.rows(); channel_start += conv_channel)
+				{
+					for (int c = 0; c < m_out_cols; c++)
+					{
+						const int col_start = channel_start + c * col_stride;
+						for (int r = 0; r < m_out_rows; r++, a++)
+						{
+							const int start = col_start + r * m_pool_rows;
+							*a = internal::find_block_max(a_obs + start, m_pool_rows, m_pool_cols,
+														  m_dim.conv_rows, offset);
+							if (z)
+								*z++ = z_obs[start + offset];
+							if (loc)
+								*loc++ = static_cast<unsigned char>(offset % m_dim.conv_rows +
+																	(offset / m_dim.conv_rows) * m_pool_rows);
+						}
+					}
+				}
+			}
+		}
+
+		// Convolution, activation and pooling, chunk by chunk
+		void run(const Matrix& prev_layer_data, Matrix& a, Matrix* z, LocMatrix* loc) const
+		{
+			const int nobs = prev_layer_data.cols();
+			const int conv_size = m_dim.conv_rows * m_dim.conv_cols * m_dim.out_channels;
+			const int conv_channel = m_dim.conv_rows * m_dim.conv_cols;
+			const int chunk = chunk_obs();
+			const int nchunk = (nobs + chunk - 1) / chunk;
+
+			a.resize(this->m_out_size, nobs);
+			if (z)
+				z->resize(this->m_out_size, nobs);
+			if (loc)
+				loc->resize(this->m_out_size, nobs);
+
+			internal::thread_pool().parallel_for(nchunk, [&](int i) {
+				const int obs_begin = i * chunk;
+				const int chunk_nobs = std::min(chunk, nobs - obs_begin);
+				Matrix conv_z(conv_size, chunk_nobs), conv_a(conv_size, chunk_nobs);
+
+				internal::convolve_valid(m_dim, prev_layer_data.data() + std::size_t(obs_begin) * this->m_in_size,
+										 true, chunk_nobs, m_filter_data.data(), conv_z.data());
+				for (int j = 0; j < m_dim.out_channels; j++)
+				{
+					conv_z.block(j * conv_channel, 0, conv_channel, chunk_nobs).array() += m_bias[j];
+				}
+				Activation::activate(conv_z, conv_a);
+
+				const std::size_t out_offset = std::size_t(obs_begin) * this->m_out_size;
+				pool(conv_z, conv_a, chunk_nobs, z ? z->data() + out_offset : NULL,
+					 a.data() + out_offset, loc ? loc->data() + out_offset : NULL);
+			});
+		}
+
+	public:
+		ConvolutionalMaxPooling(const int in_width, const int in_height,
+								const int in_channels, const int out_channels,
+								const int window_width, const int window_height,
+								const int pooling_width, const int pooling_height) :
+		Layer(in_width * in_height * in_channels,
+			  ((in_width - window_width + 1) / pooling_width) *
+			  ((in_height - window_height + 1) / pooling_height) * out_channels),
+		m_dim(in_channels, out_channels, in_height, in_width, window_height, window_width),
+		m_pool_rows(pooling_height), m_pool_cols(pooling_width),
+		m_out_rows(m_dim.conv_rows / pooling_height), m_out_cols(m_dim.conv_cols / pooling_width)
+		{
+			if (pooling_width * pooling_height > 256)
+				throw std::invalid_argument("[class ConvolutionalMaxPooling]: Pooling window has more than 256 elements");
+			if (Activation::return_type() == "Softmax")
+				throw std::invalid_argument("[class ConvolutionalMaxPooling]: Softmax activation is not supported");
+		}
+
+		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+		{
+			init();
+
+			internal::set_normal_random(m_filter_data.data(), m_filter_data.size(), rng, mu, sigma);
+			internal::set_normal_random(m_bias.data(), m_dim.out_channels, rng, mu, sigma);
+		}
+
+		void init()
+		{
+			const int filter_data_size = m_dim.in_channels * m_dim.out_channels *
+										 m_dim.filter_rows * m_dim.filter_cols;
+
+			m_filter_data.resize(filter_data_size);
+			m_df_data.resize(filter_data_size);
+			m_full_filters.resize(0, 0);
+
+			m_bias.resize(m_dim.out_channels);
+			m_db.resize(m_dim.out_channels);
+		}
+
+		void forward(const Matrix& prev_layer_data) { run(prev_layer_data, m_a, &m_z, &m_loc); }
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
+		{
+			run(prev_layer_data, a, NULL, NULL);
+		}
+
+		const Matrix& output() const { return m_a; }
+
+		void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+		{
+			const int nobs = prev_layer_data.cols();
+			const int conv_size = m_dim.conv_rows * m_dim.conv_cols * m_dim.out_channels;
+			const int conv_channel = m_dim.conv_rows * m_dim.conv_cols;
+
+			// The activation acts elementwise, so its Jacobian is only needed at the maxima
+			Matrix& dLz_max = m_z;
+			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz_max);
+
+			m_dlz.resize(conv_size, nobs);
+			m_dlz.setZero();
+			const Scalar* g = dLz_max.data();
+			const unsigned char* loc = m_loc.data();
+			for (int k = 0; k < nobs; k++)
+			{
+				Scalar* dlz_obs = m_dlz.data() + std::size_t(k) * conv_size;
+				for (int channel_start = 0; channel_start < conv_size; channel_start += conv_channel)
+				{
+					for (int c = 0; c < m_out_cols; c++)
+					{
+						for (int r = 0; r < m_out_rows; r++, g++, loc++)
+						{
+							const int local = *loc;
+							const int offset = channel_start + (c * m_pool_cols + local / m_pool_rows) * m_dim.conv_rows +
+											   r * m_pool_rows + local % m_pool_rows;
+							dlz_obs[offset] = *g;
+						}
+					}
+				}
+			}
+
+			if (m_need_param_grad)
+			{
+				internal::convolve_filter_gradient(m_dim, prev_layer_data.data(), m_dlz.data(), nobs,
+												   Scalar(1) / nobs, m_df_data.data(), m_db.data());
+			}
+
+			if (m_need_input_grad)
+			{
+				m_din.resize(this->m_in_size, nobs);
+				internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels, m_dim.conv_rows,
+												m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
+				if (m_full_filters.size() == 0)
+					internal::pack_full_filters(conv_full_dim, m_filter_data.data(), m_full_filters);
+				internal::convolve_full(conv_full_dim, m_dlz.data(), nobs, m_full_filters, m_din.data());
+			}
+
+			m_dlz.resize(0, 0);
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		void release_state()
+		{
+			m_a.resize(0, 0);
+			m_z.resize(0, 0);
+			m_loc.resize(0, 0);
+			m_dlz.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
+		}
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
+
+		void update(Optimizer& opt)
+		{
+			ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
+			ConstAlignedMapVec db(m_db.data(), m_db.size());
+			AlignedMapVec	   w(m_filter_data.data(), m_filter_data.size());
+			AlignedMapVec	   b(m_bias.data(), m_bias.size());
+			opt.update(dw, w);
+			opt.update(db, b);
+			m_full_filters.resize(0, 0);
+		}
+
+		std::vector<Scalar> get_parameters() const
+		{
+			std::vector<Scalar> res(m_filter_data.size() + m_bias.size());
+
+			std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(), res.begin());
+			std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + m_filter_data.size());
+
+			return res;
+		}
+
+		void set_parameters(const std::vector<Scalar>& param)
+		{
+			if (static_cast<int>(param.size()) != m_filter_data.size() + m_bias.size())
+			{
+				throw std::invalid_argument("[Class ConvolutionalMaxPooling]: Parameter size does not match");
+			}
+
+			std::copy(param.begin(), param.begin() + m_filter_data.size(), m_filter_data.data());
+			std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+			m_full_filters.resize(0, 0);
+		}
+
+		std::vector<Scalar> get_derivatives() const
+		{
+			std::vector<Scalar> res(m_df_data.size() + m_db.size());
+
+			std::copy(m_df_data.data(), m_df_data.data() + m_df_data.size(), res.begin());
+			std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + m_df_data.size());
+
+			return res;
+		}
+
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			if (static_cast<int>(deriv.size()) != m_df_data.size() + m_db.size())
+			{
+				throw std::invalid_argument("[Class ConvolutionalMaxPooling]: Derivative size does not match");
+			}
+
+			std::copy(deriv.begin(), deriv.begin() + m_df_data.size(), m_df_data.data());
+			std::copy(deriv.begin() + m_df_data.size(), deriv.end(), m_db.data());
+		}
+
+		std::string layer_type() const { return "ConvolutionalMaxPooling"; }
+
+		std::string activataion_type() const { return Activation::return_type(); }
+
+		void fill_meta_info(MetaInfo& map, int index) const
+		{
+			std::string ind = internal::to_string(index);
+			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
+			map.insert(std::make_pair("in_channels" + ind, m_dim.in_channels));
+			map.insert(std::make_pair("out_channels" + ind, m_dim.out_channels));
+			map.insert(std::make_pair("in_height" + ind, m_dim.channel_rows));
+			map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
+			map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
+			map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+			map.insert(std::make_pair("pooling_width" + ind, m_pool_cols));
+			map.insert(std::make_pair("pooling_height" + ind, m_pool_rows));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double conv_out = double(m_dim.conv_rows) * m_dim.conv_cols * m_dim.out_channels;
+			const double n = batch_size;
+			const double filter_size = m_dim.filter_rows * m_dim.filter_cols;
+			const double nparam = filter_size * m_dim.in_channels * m_dim.out_channels + m_dim.out_channels;
+			internal::LayerCost res;
+
+			const double conv_flops = 2 * conv_out * n * m_dim.in_channels * filter_size;
+			const double full_flops = 2 * in * n * m_dim.out_channels * filter_size;
+			// Convolution, bias, activation and one comparison per pooled element
+			res.forward_flops = conv_flops + 2 * conv_out * n + conv_out * n;
+			// Jacobian at the maxima, then the filter and bias gradients, and din if they are needed
+			res.backward_flops = out * n + (m_need_param_grad ? conv_flops + conv_out * n : 0) +
+								 (m_need_input_grad ? full_flops : 0);
+
+			// Each running chunk holds its convolution output twice, plus the convolution workspace
+			const int chunk = std::min(chunk_obs(), batch_size);
+			const int nrunning = std::min(internal::thread_pool().size(), (batch_size + chunk - 1) / chunk);
+			const double fwd_ws = nrunning * (2 * conv_out * chunk + internal::convolve_valid_workspace(m_dim, chunk));
+			internal::ConvDims conv_full_dim(m_dim.out_channels, m_dim.in_channels, m_dim.conv_rows,
+											 m_dim.conv_cols, m_dim.filter_rows, m_dim.filter_cols);
+			const double bwd_ws = conv_out * n + std::max(
+				m_need_param_grad ? internal::convolve_filter_gradient_workspace(m_dim, batch_size) : 0.0,
+				m_need_input_grad ? internal::convolve_full_workspace(conv_full_dim, batch_size) : 0.0);
+
+			res.param_bytes = internal::scalar_bytes(nparam);
+			// m_a, m_z and the one-byte m_loc, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * out * n) + static_cast<std::size_t>(out * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+			res.forward_scratch_bytes = internal::scalar_bytes(fwd_ws);
+			res.backward_scratch_bytes = internal::scalar_bytes(bwd_ws);
+
+			// The chunk buffers stay in cache, so only the input, parameters and pooled state move
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (in * n + nparam + 2 * out * n) + out * n;
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (3 * out * n + 2 * conv_out * n + 2 * in * n +
+																   3 * nparam + 2 * (bwd_ws - conv_out * n)) + out * n;
+
+			return res;
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,238 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/Convolution.h"
+#include "../Utils/DepthwiseConvolution.h"
+#include "../Utils/Random.h"
+#include "../Utils/Compress.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+
+namespace MiniDNN
+{
+	///
+	/// Depthwise convolutional layer
+	///
+	/// Every input channel is convolved with its own 'window_height x window_width'
+	/// filter, so the output has as many channels as the input. Followed by a
+	/// Convolutional layer with a 1x1 window (the pointwise stage), it forms a
+	/// depthwise-separable convolution.
+	///
+	template <typename Activation>
+	class DepthwiseConvolutional : public Layer
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+		typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+		typedef Vector::AlignedMapType AlignedMapVec;
+		typedef std::map<std::string, int> MetaInfo;
+
+		const internal::ConvDims m_dim;
+
+		Vector m_filter_data;
+		Vector m_df_data;
+
+		Vector m_bias;
+		Vector m_db;
+
+		Matrix m_z;
+		Matrix m_a;
+		Matrix m_din;
+
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+	public:
+		DepthwiseConvolutional(const int in_width, const int in_height, const int in_channels,
+							   const int window_width, const int window_height) :
+		Layer(in_width * in_height * in_channels,
+			  (in_width - window_width + 1) * (in_height - window_height + 1) * in_channels),
+		m_dim(in_channels, in_channels, in_height, in_width, window_height, window_width)
+		{}
+
+		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+		{
+			init();
+
+			internal::set_normal_random(m_filter_data.data(), m_filter_data.size(), rng, mu, sigma);
+			internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
+		}
+
+		void init()
+		{
+			const int filter_data_size = m_dim.in_channels * m_dim.filter_rows * m_dim.filter_cols;
+
+			m_filter_data.resize(filter_data_size);
+			m_df_data.resize(filter_data_size);
+
+			m_bias.resize(m_dim.in_channels);
+			m_db.resize(m_dim.in_channels);
+		}
+
+		void forward(const Matrix& prev_layer_data) { predict(prev_layer_data, m_z, m_a); }
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
+		{
+			const int nobs = prev_layer_data.cols();
+			z.resize(this->m_out_size, nobs);
+
+			internal::convolve_depthwise(m_dim, prev_layer_data.data(), nobs, m_filter_data.data(), z.data());
+			int channel_start_row = 0;
+			const int channel_nelem = m_dim.conv_rows * m_dim.conv_cols;
+
+			for (int i = 0; i < m_dim.in_channels; i++, channel_start_row += channel_nelem)
+			{
+				z.block(channel_start_row, 0, channel_nelem, nobs).array() += m_bias[i];
+			}
+
+			a.resize(this->m_out_size, nobs);
+			Activation::activate(z, a);
+		}
+
+		const Matrix& output() const { return m_a; }
+
+		void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+		{
+			const int nobs = prev_layer_data.cols();
+
+			Matrix& dLz = m_z;
+			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+
+			if (m_need_param_grad)
+			{
+				internal::convolve_depthwise_filter_gradient(m_dim, prev_layer_data.data(), dLz.data(), nobs,
+															 Scalar(1) / nobs, m_df_data.data(), m_db.data());
+			}
+
+			if (m_need_input_grad)
+			{
+				m_din.resize(this->m_in_size, nobs);
+				internal::convolve_depthwise_input_gradient(m_dim, dLz.data(), nobs, m_filter_data.data(),
+															m_din.data());
+			}
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		void release_state()
+		{
+			m_z.resize(0, 0);
+			m_a.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
+		}
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
+
+		void update(Optimizer& opt)
+		{
+			ConstAlignedMapVec dw(m_df_data.data(), m_df_data.size());
+			ConstAlignedMapVec db(m_db.data(), m_db.size());
+			AlignedMapVec	   w(m_filter_data.data(), m_filter_data.size());
+			AlignedMapVec	   b(m_bias.data(), m_bias.size());
+			opt.update(dw, w);
+			opt.update(db, b);
+		}
+
+		std::vector<Scalar> get_parameters() const
+		{
+			std::vector<Scalar> res(m_filter_data.size() + m_bias.size());
+
+			std::copy(m_filter_data.data(), m_filter_data.data() + m_filter_data.size(), res.begin());
+			std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + m_filter_data.size());
+
+			return res;
+		}
+
+		void set_parameters(const std::vector<Scalar>& param)
+		{
+			if (static_cast<int>(param.size()) != m_filter_data.size() + m_bias.size())
+			{
+				throw std::invalid_argument("[Class DepthwiseConvolutional]: Parameter size does not match");
+			}
+
+			std::copy(param.begin(), param.begin() + m_filter_data.size(), m_filter_data.data());
+			std::copy(param.begin() + m_filter_data.size(), param.end(), m_bias.data());
+		}
+
+		std::vector<Scalar> get_derivatives() const
+		{
+			std::vector<Scalar> res(m_df_data.size() + m_db.size());
+
+			std::copy(m_df_data.data(), m_df_data.data() + m_df_data.size(), res.begin());
+			std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + m_df_data.size());
+
+			return res;
+		}
+
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			if (static_cast<int>(deriv.size()) != m_df_data.size() + m_db.size())
+			{
+				throw std::invalid_argument("[Class DepthwiseConvolutional]: Derivative size does not match");
+			}
+
+			std::copy(deriv.begin(), deriv.begin() + m_df_data.size(), m_df_data.data());
+			std::copy(deriv.begin() + m_df_data.size(), deriv.end(), m_db.data());
+		}
+
+		std::string layer_type() const { return "DepthwiseConvolutional"; }
+
+		std::string activataion_type() const { return Activation::return_type(); }
+
+		void fill_meta_info(MetaInfo& map, int index) const
+		{
+			std::string ind = internal::to_string(index);
+			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
+			map.insert(std::make_pair("in_channels" + ind, m_dim.in_channels));
+			map.insert(std::make_pair("in_height" + ind, m_dim.channel_rows));
+			map.insert(std::make_pair("in_width" + ind, m_dim.channel_cols));
+			map.insert(std::make_pair("window_width" + ind, m_dim.filter_cols));
+			map.insert(std::make_pair("window_height" + ind, m_dim.filter_rows));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double n = batch_size;
+			const double filter_size = m_dim.filter_rows * m_dim.filter_cols;
+			const double nparam = filter_size * m_dim.in_channels + m_dim.in_channels;
+			internal::LayerCost res;
+
+			// Every output element is a dot product of length 'filter_size', and the
+			// two gradients have the same cost
+			const double conv_flops = 2 * out * n * filter_size;
+			res.forward_flops = conv_flops + 2 * out * n;
+			// Jacobian, then the filter and bias gradients, and din if they are needed
+			res.backward_flops = out * n + (m_need_param_grad ? conv_flops + out * n : 0) +
+								 (m_need_input_grad ? conv_flops : 0);
+
+			res.param_bytes = internal::scalar_bytes(nparam);
+			// m_z and m_a, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * out * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+
+			// The kernels need no workspace
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (in * n + nparam + 3 * out * n);
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (4 * out * n + 2 * in * n + 3 * nparam);
+
+			return res;
+		}
+	};
+}
\ No newline at end of file
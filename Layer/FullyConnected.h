@@ -2,12 +2,16 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
 #include "../Utils/Random.h"
+#include "../Utils/Compress.h"
+#include "../Utils/BFloat16.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
+#include "../Utils/ThreadPool.h"
 
 namespace MiniDNN
 {
@@ -16,6 +20,7 @@ namespace MiniDNN
 	{
 	private:
 		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> FloatMatrix;
 		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
 		typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
 		typedef Vector::AlignedMapType AlignedMapVec;
@@ -29,9 +34,48 @@ namespace MiniDNN
 		Matrix m_a;
 		Matrix m_din;
 
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+		// Copy of m_weight read by the products, see set_parameter_storage()
+		int m_param_storage;
+		internal::BFloat16Matrix m_weight_bf16;
+
+		void weights_changed()
+		{
+			if (m_param_storage == internal::BFLOAT16 && m_weight.size() > 0)
+				m_weight_bf16.assign(m_weight.data(), m_weight.rows(), m_weight.cols());
+			else
+				m_weight_bf16.clear();
+		}
+
+		// Smallest share of a single-observation product worth a task of its own
+		static const int min_task_flops = 1000000;
+
+		// z = W' * x + b for one observation. m_weight is column-major, so each output
+		// is a dot product with a contiguous column and this is a row-major GEMV on
+		// W'. Large layers are memory bound, and are split into blocks of outputs so
+		// that several cores stream the weights
+		void predict_one(const Scalar* x, Scalar* z) const
+		{
+			const int in = this->m_in_size;
+			const int out = this->m_out_size;
+			const double flops = 2.0 * in * out;
+			const int ntask = std::max(1, std::min(internal::thread_pool().size(), int(flops / min_task_flops)));
+
+			ConstAlignedMapVec xvec(x, in);
+			internal::thread_pool().parallel_for(ntask, [&](int i) {
+				const int begin = static_cast<long long>(out) * i / ntask;
+				const int end = static_cast<long long>(out) * (i + 1) / ntask;
+				Eigen::Map<Vector> zblock(z + begin, end - begin);
+				zblock.noalias() = m_bias.segment(begin, end - begin);
+				zblock.noalias() += m_weight.middleCols(begin, end - begin).transpose() * xvec;
+			});
+		}
+
 	public:
 		FullyConnected(const int in_size, const int out_size) :
-		Layer(in_size, out_size) {}
+		Layer(in_size, out_size), m_param_storage(internal::FULL_PRECISION) {}
 
 		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
 		{
@@ -39,6 +83,7 @@ namespace MiniDNN
 
 			internal::set_normal_random(m_weight.data(), m_weight.size(), rng, mu, sigma);
 			internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
+			weights_changed();
 		}
 
 		void init()
@@ -49,16 +94,34 @@ namespace MiniDNN
 			m_db.resize(this->m_out_size);
 		}
 
-		void forward(const Matrix& prev_layer_data)
+		void forward(const Matrix& prev_layer_data) { predict(prev_layer_data, m_z, m_a); }
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
 		{
 			const int nobs = prev_layer_data.cols();
 
-			m_z.resize(this->m_out_size, nobs);
-			m_z.noalias() = m_weight.transpose() * prev_layer_data;
-			m_z.colwise() += m_bias;
+			// No-ops when the buffers are reused with the same batch size
+			z.resize(this->m_out_size, nobs);
+			a.resize(this->m_out_size, nobs);
+
+			if (!m_weight_bf16.empty())
+			{
+				const FloatMatrix x = prev_layer_data.template cast<float>();
+				internal::bfloat16_product_transpose(m_weight_bf16, x, z);
+				z.colwise() += m_bias;
+			}
+			else if (nobs == 1)
+			{
+				// Latency path: GEMV with the bias as the initial value
+				predict_one(prev_layer_data.data(), z.data());
+			}
+			else
+			{
+				z.noalias() = m_weight.transpose() * prev_layer_data;
+				z.colwise() += m_bias;
+			}
 
-			m_a.resize(this->m_out_size, nobs);
-			Activation::actiavate(m_z, m_a);
+			Activation::activate(z, a);
 		}
 
 		const Matrix& output() const { return m_a; }
@@ -70,16 +133,49 @@ namespace MiniDNN
 			Matrix& dLz = m_z;
 			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
 
-			m_dw.noalias() = prev_layer_data * dLz.transpose() / nobs;
+			if (m_need_param_grad)
+			{
+				m_dw.noalias() = prev_layer_data * dLz.transpose() / nobs;
 
-			m_db.noalias() = dLz.rowwise().mean();
+				m_db.noalias() = dLz.rowwise().mean();
+			}
 
-			m_din.resize(this->m_in_size, nobs);
-			m_din.noalias() = m_weight * dLz;
+			if (m_need_input_grad)
+			{
+				m_din.resize(this->m_in_size, nobs);
+				if (!m_weight_bf16.empty())
+				{
+					const FloatMatrix g = dLz.template cast<float>();
+					internal::bfloat16_product(m_weight_bf16, g, m_din);
+				}
+				else
+				{
+					m_din.noalias() = m_weight * dLz;
+				}
+			}
 		}
 
 		const Matrix& backprop_data() const { return m_din; }
 
+		void release_state()
+		{
+			m_z.resize(0, 0);
+			m_a.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
+		}
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
+
 		void update(Optimizer& opt)
 		{
 			ConstAlignedMapVec dw(m_dw.data(), m_dw.size());
@@ -88,6 +184,7 @@ namespace MiniDNN
 			AlignedMapVec	   b(m_bias.data(), m_bias.size());
 			opt.update(dw, w);
 			opt.update(db, b);
+			weights_changed();
 		}
 
 		std::vector<Scalar> get_parameters() const
@@ -109,6 +206,13 @@ namespace MiniDNN
 
 			std::copy(param.begin(), param.begin() + m_weight.size(), m_weight.data());
 			std::copy(param.begin() + m_weight.size(), param.end(), m_bias.data());
+			weights_changed();
+		}
+
+		void set_parameter_storage(const int storage)
+		{
+			m_param_storage = storage;
+			weights_changed();
 		}
 
 		std::vector<Scalar> get_derivatives() const
@@ -120,6 +224,17 @@ namespace MiniDNN
 			return res;
 		}
 
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			if (static_cast<int>(deriv.size()) != m_dw.size() + m_db.size())
+			{
+				throw std::invalid_argument("[Class FullyConnected]: Derivative Size Does Not Match");
+			}
+
+			std::copy(deriv.begin(), deriv.begin() + m_dw.size(), m_dw.data());
+			std::copy(deriv.begin() + m_dw.size(), deriv.end(), m_db.data());
+		}
+
 		std::string layer_type() const { return "FullyConnected"; }
 
 		std::string activataion_type() const { return Activation::return_type(); }
@@ -127,10 +242,39 @@ namespace MiniDNN
 		void fill_meta_info(MetaInfo& map, int index) const
 		{
 			std::string ind = internal::to_string(index);
-			map.insert(std::make_pair("Layer " + ind, internal::layer_id(layer_type())));
-			map.insert(std::make_pair("Actiavtion " + ind, internal::activation_id(activataion_type())));
-			map.insert(std::make_pair("in_size " + ind, in_size()));
-			map.insert(std::make_pair("out_size " + ind, out_size()));
+			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
+			map.insert(std::make_pair("in_size" + ind, in_size()));
+			map.insert(std::make_pair("out_size" + ind, out_size()));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double n = batch_size;
+			const double nparam = in * out + out;
+			internal::LayerCost res;
+
+			// GEMM, bias and activation
+			res.forward_flops = 2 * in * out * n + 2 * out * n;
+			// Jacobian, then dW and db, and din if they are needed
+			res.backward_flops = out * n + (m_need_param_grad ? 2 * in * out * n + out * n : 0) +
+								 (m_need_input_grad ? 2 * in * out * n : 0);
+
+			// The bfloat16 copy of the weights is what forward() and din read
+			const bool bf16 = m_param_storage == internal::BFLOAT16;
+			const double weight_bytes = bf16 ? 2 * in * out : double(sizeof(Scalar)) * in * out;
+			res.param_bytes = internal::scalar_bytes(nparam) + (bf16 ? std::size_t(2 * in * out) : 0);
+			// m_z and m_a, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * out * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (in * n + out + 3 * out * n) + weight_bytes;
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (4 * out * n + 2 * in * n + 2 * nparam + out) +
+										 weight_bytes;
+
+			return res;
 		}
 	};
 }
\ No newline at end of file
@@ -2,15 +2,24 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <algorithm>
 #include <stdexcept>
 #include "../Config.h"
 #include "../Layer.h"
 #include "../Utils/FindMax.h"
+#include "../Utils/Compress.h"
 #include "../Utils/IO.h"
 #include "../Utils/Enum.h"
 
 namespace MiniDNN
 {
+	///
+	/// Max pooling layer
+	///
+	/// With the internal::CHANNELS_LAST layout, the input and the output keep the
+	/// channel values of each pixel together, and every window is pooled for all
+	/// the channels at once.
+	///
 //	template <typename Activation>
 	class MaxPooling : public Layer
 	{
@@ -28,19 +37,138 @@ namespace MiniDNN
 		const int m_out_rows;
 		const int m_out_cols;
 
+		const int m_layout;
+		// Distance between two rows and two columns of a channel
+		const int m_row_stride;
+		const int m_col_stride;
+
 		IntMatrix m_loc;
 		Matrix m_z;
-		Matrix m_a;
 		Matrix m_din;
 
+		// Compressed state: the output and the position of the max within each window
+		internal::CompressedMatrix m_z_saved;
+		std::vector<unsigned char> m_loc_saved;
+		int m_saved_nobs;
+
+		// Call 'f' with the offset of the top-left element of every pooling block, in output order
+		template <typename Visitor>
+		void for_each_block(const int data_size, Visitor f) const
+		{
+			if (m_layout == internal::CHANNELS_LAST)
+			{
+				// Output order: channels, then rows, then columns
+				const int col_stride = m_col_stride * m_pool_cols;
+				const int row_stride = m_row_stride * m_pool_rows;
+				const int img_size = this->m_in_size;
+
+				for (int img_start = 0; img_start < data_size; img_start += img_size)
+				{
+					const int col_end = img_start + col_stride * m_out_cols;
+					for (int col_start = img_start; col_start < col_end; col_start += col_stride)
+					{
+						const int row_end = col_start + row_stride * m_out_rows;
+						for (int row_start = col_start; row_start < row_end; row_start += row_stride)
+						{
+							for (int ch = 0; ch < m_in_channels; ch++)
+							{
+								f(row_start + ch);
+							}
+						}
+					}
+				}
+				return;
+			}
+
+			const int channel_stride = m_channel_rows * m_channel_cols;
+			const int col_end_gap = m_channel_rows * m_pool_cols * m_out_cols;
+			const int col_stride = m_channel_rows * m_pool_cols;
+			const int row_end_gap = m_out_rows * m_pool_rows;
+
+			for (int channel_start = 0; channel_start < data_size; channel_start += channel_stride)
+			{
+				const int col_end = channel_start + col_end_gap;
+
+				for (int col_start = channel_start; col_start < col_end; col_start += col_stride)
+				{
+					const int row_end = col_start + row_end_gap;
+					for (int row_start = col_start; row_start < row_end; row_start += m_pool_rows)
+					{
+						f(row_start);
+					}
+				}
+			}
+		}
+
+		// Write the offset of the top-left element of every pooling block
+		void block_starts(int* loc_data, const int data_size) const
+		{
+			for_each_block(data_size, [&loc_data](const int start) { *loc_data++ = start; });
+		}
+
+		// Channels-last pooling of 'nobs' observations. The channels of a pixel are
+		// compared together, window element by window element. 'loc' may be NULL
+		void pool_channels_last(const Scalar* src, const int nobs, Scalar* z, int* loc) const
+		{
+			const int nchannel = m_in_channels;
+			std::vector<int> best(nchannel);
+
+			for (int k = 0; k < nobs; k++, src += this->m_in_size)
+			{
+				for (int oc = 0; oc < m_out_cols; oc++)
+				{
+					for (int orow = 0; orow < m_out_rows; orow++, z += nchannel)
+					{
+						const int start = orow * m_pool_rows * m_row_stride + oc * m_pool_cols * m_col_stride;
+						std::copy(src + start, src + start + nchannel, z);
+						std::fill(best.begin(), best.end(), start);
+
+						for (int c = 0; c < m_pool_cols; c++)
+						{
+							for (int r = (c == 0 ? 1 : 0); r < m_pool_rows; r++)
+							{
+								const int offset = start + r * m_row_stride + c * m_col_stride;
+								const Scalar* x = src + offset;
+								for (int ch = 0; ch < nchannel; ch++)
+								{
+									if (x[ch] > z[ch])
+									{
+										z[ch] = x[ch];
+										best[ch] = offset;
+									}
+								}
+							}
+						}
+
+						if (loc != NULL)
+						{
+							const int obs_offset = k * this->m_in_size;
+							for (int ch = 0; ch < nchannel; ch++)
+							{
+								*loc++ = obs_offset + best[ch] + ch;
+							}
+						}
+					}
+				}
+			}
+		}
+
 	public:
 		MaxPooling(const int  in_width_, const int in_height_, const int in_channels_,
-			const int pooling_width_, const int pooling_height_) :
+			const int pooling_width_, const int pooling_height_, const int layout_ = internal::CHANNELS_FIRST) :
 			Layer(in_width_* in_height_* in_channels_, (in_width_ / pooling_width_) * (in_height_ / pooling_height_) * in_channels_),
 			m_channel_rows(in_height_), m_channel_cols(in_width_), m_in_channels(in_channels_), m_pool_rows(pooling_height_),
-			m_pool_cols(pooling_width_), m_out_rows(m_channel_rows / m_pool_rows), m_out_cols(m_channel_cols / m_pool_cols)
+			m_pool_cols(pooling_width_), m_out_rows(m_channel_rows / m_pool_rows), m_out_cols(m_channel_cols / m_pool_cols),
+			m_layout(layout_), m_row_stride(layout_ == internal::CHANNELS_LAST ? in_channels_ : 1),
+			m_col_stride(m_row_stride * in_height_), m_saved_nobs(0)
+
+		{
+			if (layout_ != internal::CHANNELS_FIRST && layout_ != internal::CHANNELS_LAST)
+				throw std::invalid_argument("[class MaxPooling]: Unknown image layout");
 
-		{}
+			// Nothing to train
+			this->m_trainable = false;
+		}
 
 		void init(const Scalar& mu, const Scalar& sigma, RNG& rng) {}
 
@@ -52,51 +180,57 @@ namespace MiniDNN
 			m_loc.resize(this->m_out_size, nobs);
 			m_z.resize(this->m_out_size, nobs);
 
-			int* loc_data = m_loc.data();
-			const int channel_end = prev_layer_data.size();
-			const int channel_stride = m_channel_rows * m_channel_cols;
-			const int col_ens_gap = m_channel_rows * m_pool_cols;
-			const int col_stride = m_channel_rows * m_pool_cols;
-			const int row_end_gap = m_out_rows * m_pool_rows;
-
-			for (int channel_start = 0; channel_start < channel_end; channel_start += channel_stride)
+			if (m_layout == internal::CHANNELS_LAST)
 			{
-				const int col_end = channel_start + col_ens_gap;
-
-				for (int col_start = 0; col_start < col_end; col_start += col_stride)
-				{
-					const int row_end = col_start + row_end_gap;
-					for (int row_start = 0; row_start < row_end; row_start += m_pool_rows, loc_data++)
-					{
-						*loc_data = row_start;
-					}
-				}
+				pool_channels_last(prev_layer_data.data(), nobs, m_z.data(), m_loc.data());
+				return;
 			}
 
-			loc_data = m_loc.data();
+			block_starts(m_loc.data(), prev_layer_data.size());
+
+			int* loc_data = m_loc.data();
 			const int* const loc_end = loc_data + m_loc.size();
 			Scalar* z_data = m_z.data();
 			const Scalar* src = prev_layer_data.data();
 
-			for (; loc_data < loc_end; loc_data++, z_data)
+			for (; loc_data < loc_end; loc_data++, z_data++)
 			{
 				const int offset = *loc_data;
 				*z_data = internal::find_block_max(src + offset, m_pool_rows, m_pool_cols, m_channel_rows, *loc_data);
 				*loc_data += offset;
 			}
+		}
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
+		{
+			const int nobs = prev_layer_data.cols();
+			a.resize(this->m_out_size, nobs);
+
+			if (m_layout == internal::CHANNELS_LAST)
+			{
+				pool_channels_last(prev_layer_data.data(), nobs, a.data(), NULL);
+				return;
+			}
 
-			m_a.resize(this->m_out_size, nobs);
-//			Activation::activate(m_z, m_a);
+			Scalar* a_data = a.data();
+			const Scalar* src = prev_layer_data.data();
+			int loc;
+			for_each_block(prev_layer_data.size(), [&](const int start)
+			{
+				*a_data++ = internal::find_block_max(src + start, m_pool_rows, m_pool_cols, m_channel_rows, loc);
+			});
 		}
 
-		const Matrix& output() const { return m_a; }
+		const Matrix& output() const { return m_z; }
 
 		void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
 		{
 			const int nobs = prev_layer_data.cols();
 
-			Matrix& dLz = m_z;
-//			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+			const Matrix& dLz = next_layer_data;
+
+			if (!m_need_input_grad)
+				return;
 
 			m_din.resize(this->m_in_size, nobs);
 			m_din.setZero();
@@ -114,6 +248,69 @@ namespace MiniDNN
 
 		const Matrix& backprop_data() const { return m_din; }
 
+		void release_state()
+		{
+			m_loc.resize(0, 0);
+			m_z.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			std::vector<unsigned char>().swap(m_loc_saved);
+			m_saved_nobs = 0;
+		}
+
+		bool backprop_reads_input() const { return false; }
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			// The window-local index of the max has to fit in one byte
+			if (storage == internal::FULL_PRECISION || m_pool_rows * m_pool_cols > 256)
+				return;
+
+			m_saved_nobs = m_loc.cols();
+			const int n = m_loc.size();
+			m_loc_saved.resize(n);
+
+			std::vector<int> starts(n);
+			block_starts(&starts[0], this->m_in_size * m_saved_nobs);
+			const int* loc_data = m_loc.data();
+			for (int i = 0; i < n; i++)
+			{
+				const int offset = loc_data[i] - starts[i];
+				m_loc_saved[i] = static_cast<unsigned char>((offset % m_col_stride) / m_row_stride +
+															(offset / m_col_stride) * m_pool_rows);
+			}
+			m_loc.resize(0, 0);
+
+			if (keep_output)
+				m_z_saved.compress(m_z, storage, false);
+			else
+				m_z.resize(0, 0);
+		}
+
+		void decompress_state()
+		{
+			if (m_saved_nobs == 0)
+				return;
+
+			m_loc.resize(this->m_out_size, m_saved_nobs);
+			block_starts(m_loc.data(), this->m_in_size * m_saved_nobs);
+			const int n = m_loc.size();
+			int* loc_data = m_loc.data();
+			for (int i = 0; i < n; i++)
+			{
+				const int local = m_loc_saved[i];
+				loc_data[i] += (local % m_pool_rows) * m_row_stride + (local / m_pool_rows) * m_col_stride;
+			}
+
+			if (m_z_saved.empty())
+				m_z.resize(this->m_out_size, m_saved_nobs);
+			else
+				m_z_saved.decompress(m_z);
+
+			std::vector<unsigned char>().swap(m_loc_saved);
+			m_saved_nobs = 0;
+		}
+
 		void update(Optimizer& opt) {}
 
 		std::vector<Scalar> get_parameters() const { return std::vector<Scalar>(); }
@@ -124,7 +321,7 @@ namespace MiniDNN
 
 		std::string layer_type() const { return "MaxPooling"; }
 
-		std::string activataion_type() const { /*return Activation::return_type();*/ }
+		std::string activataion_type() const { return "Identity"; }
 
 		void fill_meta_info(MetaInfo& map, int index) const
 		{
@@ -132,10 +329,33 @@ namespace MiniDNN
 			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
 			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
 			map.insert(std::make_pair("in_width" + ind, m_channel_cols));
-			map.insert(std::make_pair("in_height" + ind, m_channel_cols));
+			map.insert(std::make_pair("in_height" + ind, m_channel_rows));
 			map.insert(std::make_pair("in_channels" + ind, m_in_channels));
 			map.insert(std::make_pair("pooling_width" + ind, m_pool_cols));
 			map.insert(std::make_pair("pooling_height" + ind, m_pool_rows));
+			map.insert(std::make_pair("layout" + ind, m_layout));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double n = batch_size;
+			internal::LayerCost res;
+
+			// One comparison per pooled element, one addition per routed gradient
+			res.forward_flops = out * n * m_pool_rows * m_pool_cols;
+			res.backward_flops = m_need_input_grad ? out * n : 0;
+
+			// m_z and the integer m_loc, then m_din
+			res.activation_bytes = internal::scalar_bytes(out * n) +
+								   static_cast<std::size_t>(out * n) * sizeof(int);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (in * n + out * n) + sizeof(int) * 2 * out * n;
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (out * n + in * n) + sizeof(int) * out * n;
+
+			return res;
 		}
 	};
 }
\ No newline at end of file
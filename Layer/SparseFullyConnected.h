@@ -0,0 +1,355 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Utils/Random.h"
+#include "../Utils/Compress.h"
+#include "../Utils/IO.h"
+#include "../Utils/Enum.h"
+#include "../Utils/ThreadPool.h"
+
+namespace MiniDNN
+{
+	///
+	/// Fully connected layer with sparse weights
+	///
+	/// The weights are stored in CSR format with one row per output, and only the
+	/// non-zero weights are multiplied and trained. The sparsity pattern is taken
+	/// from the zeros of the parameters given to set_parameters(), so a pruned
+	/// FullyConnected layer converts to this layer through its parameters, and
+	/// get_parameters() returns the dense layout of FullyConnected.
+	///
+	/// Batches are multiplied in row-major order, so that every non-zero weight
+	/// scales a contiguous row of observations.
+	///
+	template <typename Activation>
+	class SparseFullyConnected : public Layer
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> RowMajorMatrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+		typedef Vector::ConstAlignedMapType ConstAlignedMapVec;
+		typedef Vector::AlignedMapType AlignedMapVec;
+		typedef Eigen::Map<const Eigen::SparseMatrix<Scalar, Eigen::RowMajor, int> > ConstSparseMap;
+		typedef std::map<std::string, int> MetaInfo;
+
+		// CSR weights: the non-zeros of output 'o' are m_value[m_row_start[o] .. m_row_start[o + 1])
+		// and multiply the inputs m_col[...]
+		std::vector<int> m_row_start;
+		std::vector<int> m_col;
+		Vector m_value;
+		Vector m_bias;
+		Vector m_dvalue;
+		Vector m_db;
+		Matrix m_z;
+		Matrix m_a;
+		Matrix m_din;
+
+		internal::CompressedMatrix m_z_saved;
+		internal::CompressedMatrix m_a_saved;
+
+		// Smallest share of a product worth a task of its own
+		static const int min_task_flops = 1000000;
+
+		ConstSparseMap weight() const
+		{
+			return ConstSparseMap(this->m_out_size, this->m_in_size, nnz(), m_row_start.data(), m_col.data(),
+								  m_value.data());
+		}
+
+		int num_tasks(const int nobs) const
+		{
+			const double flops = 2.0 * nnz() * nobs;
+			return std::max(1, std::min(internal::thread_pool().size(), int(flops / min_task_flops)));
+		}
+
+		// First output of task 't' out of 'ntask'. The outputs are split so that the
+		// tasks get about the same number of non-zeros
+		int task_begin(const int t, const int ntask) const
+		{
+			if (t >= ntask)
+				return this->m_out_size;
+
+			const long long target = static_cast<long long>(nnz()) * t / ntask;
+			return std::lower_bound(m_row_start.begin(), m_row_start.end() - 1, target) - m_row_start.begin();
+		}
+
+		// Build the CSR arrays from the column-major 'in_size x out_size' weights
+		void set_weights(const Scalar* dense)
+		{
+			const int in = this->m_in_size;
+			const int out = this->m_out_size;
+
+			m_row_start.resize(out + 1);
+			m_col.clear();
+			std::vector<Scalar> value;
+			for (int o = 0; o < out; o++)
+			{
+				m_row_start[o] = m_col.size();
+				const Scalar* w = dense + std::size_t(o) * in;
+				for (int i = 0; i < in; i++)
+				{
+					if (w[i] != Scalar(0))
+					{
+						m_col.push_back(i);
+						value.push_back(w[i]);
+					}
+				}
+			}
+			m_row_start[out] = m_col.size();
+
+			m_value = Eigen::Map<const Vector>(value.data(), value.size());
+			m_dvalue.resize(m_value.size());
+		}
+
+		// Scatter the CSR values 'val' into the dense layout of get_parameters()
+		void get_weights(const Vector& val, Scalar* dense) const
+		{
+			const int in = this->m_in_size;
+			const int out = this->m_out_size;
+
+			std::fill(dense, dense + std::size_t(in) * out, Scalar(0));
+			for (int o = 0; o < out; o++)
+			{
+				for (int k = m_row_start[o]; k < m_row_start[o + 1]; k++)
+					dense[std::size_t(o) * in + m_col[k]] = val[k];
+			}
+		}
+
+	public:
+		SparseFullyConnected(const int in_size, const int out_size) :
+		Layer(in_size, out_size) {}
+
+		// Number of non-zero weights
+		int nnz() const { return m_value.size(); }
+
+		void init(const Scalar& mu, const Scalar& sigma, RNG& rng)
+		{
+			init();
+
+			// Dense pattern
+			std::vector<Scalar> w(std::size_t(this->m_in_size) * this->m_out_size);
+			internal::set_normal_random(w.data(), w.size(), rng, mu, sigma);
+			set_weights(w.data());
+			internal::set_normal_random(m_bias.data(), m_bias.size(), rng, mu, sigma);
+		}
+
+		void init()
+		{
+			m_row_start.assign(this->m_out_size + 1, 0);
+			m_col.clear();
+			m_value.resize(0);
+			m_dvalue.resize(0);
+			m_bias.resize(this->m_out_size);
+			m_db.resize(this->m_out_size);
+		}
+
+		void forward(const Matrix& prev_layer_data) { predict(prev_layer_data, m_z, m_a); }
+
+		void predict(const Matrix& prev_layer_data, Matrix& z, Matrix& a) const
+		{
+			const int nobs = prev_layer_data.cols();
+			const int ntask = num_tasks(nobs);
+
+			z.resize(this->m_out_size, nobs);
+			a.resize(this->m_out_size, nobs);
+
+			if (nobs == 1)
+			{
+				// Sparse GEMV: one gathered dot product per output
+				const Scalar* x = prev_layer_data.data();
+				Scalar* zp = z.data();
+				internal::thread_pool().parallel_for(ntask, [&](int t) {
+					const int end = task_begin(t + 1, ntask);
+					for (int o = task_begin(t, ntask); o < end; o++)
+					{
+						Scalar sum = m_bias[o];
+						for (int k = m_row_start[o]; k < m_row_start[o + 1]; k++)
+							sum += m_value[k] * x[m_col[k]];
+						zp[o] = sum;
+					}
+				});
+			}
+			else
+			{
+				const RowMajorMatrix x = prev_layer_data;
+				RowMajorMatrix zr(this->m_out_size, nobs);
+				const ConstSparseMap w = weight();
+				internal::thread_pool().parallel_for(ntask, [&](int t) {
+					const int begin = task_begin(t, ntask);
+					const int end = task_begin(t + 1, ntask);
+					zr.middleRows(begin, end - begin).noalias() = w.middleRows(begin, end - begin) * x;
+				});
+				z.noalias() = zr;
+				z.colwise() += m_bias;
+			}
+
+			Activation::activate(z, a);
+		}
+
+		const Matrix& output() const { return m_a; }
+
+		void backprop(const Matrix& prev_layer_data, const Matrix& next_layer_data)
+		{
+			const int nobs = prev_layer_data.cols();
+
+			Matrix& dLz = m_z;
+			Activation::apply_jacobian(m_z, m_a, next_layer_data, dLz);
+			const RowMajorMatrix dlz = dLz;
+
+			if (m_need_param_grad)
+			{
+				// Only the weights in the pattern get a gradient, so the pruned ones stay zero
+				const RowMajorMatrix x = prev_layer_data;
+				const int ntask = num_tasks(nobs);
+				internal::thread_pool().parallel_for(ntask, [&](int t) {
+					const int end = task_begin(t + 1, ntask);
+					for (int o = task_begin(t, ntask); o < end; o++)
+					{
+						for (int k = m_row_start[o]; k < m_row_start[o + 1]; k++)
+							m_dvalue[k] = x.row(m_col[k]).dot(dlz.row(o)) / nobs;
+					}
+				});
+
+				m_db.noalias() = dLz.rowwise().mean();
+			}
+
+			if (m_need_input_grad)
+			{
+				const RowMajorMatrix din = weight().transpose() * dlz;
+				m_din.noalias() = din;
+			}
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		void release_state()
+		{
+			m_z.resize(0, 0);
+			m_a.resize(0, 0);
+			m_din.resize(0, 0);
+			m_z_saved.clear();
+			m_a_saved.clear();
+		}
+
+		void compress_state(const int storage, const bool keep_output)
+		{
+			internal::compress_layer_state<Activation>(m_z, m_a, m_z_saved, m_a_saved, storage, keep_output);
+		}
+
+		void decompress_state()
+		{
+			internal::decompress_layer_state(m_z, m_a, m_z_saved, m_a_saved);
+		}
+
+		void update(Optimizer& opt)
+		{
+			ConstAlignedMapVec dw(m_dvalue.data(), m_dvalue.size());
+			ConstAlignedMapVec db(m_db.data(), m_db.size());
+			AlignedMapVec	   w(m_value.data(), m_value.size());
+			AlignedMapVec	   b(m_bias.data(), m_bias.size());
+			opt.update(dw, w);
+			opt.update(db, b);
+		}
+
+		std::vector<Scalar> get_parameters() const
+		{
+			const std::size_t nweight = std::size_t(this->m_in_size) * this->m_out_size;
+			std::vector<Scalar> res(nweight + m_bias.size());
+
+			get_weights(m_value, res.data());
+			std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + nweight);
+
+			return res;
+		}
+
+		// The non-zero weights in 'param' become the new sparsity pattern
+		void set_parameters(const std::vector<Scalar>& param)
+		{
+			const std::size_t nweight = std::size_t(this->m_in_size) * this->m_out_size;
+			if (param.size() != nweight + m_bias.size())
+			{
+				throw std::invalid_argument("[Class SparseFullyConnected]: Parameter Size Does Not Match");
+			}
+
+			set_weights(param.data());
+			std::copy(param.begin() + nweight, param.end(), m_bias.data());
+		}
+
+		std::vector<Scalar> get_derivatives() const
+		{
+			const std::size_t nweight = std::size_t(this->m_in_size) * this->m_out_size;
+			std::vector<Scalar> res(nweight + m_db.size());
+
+			get_weights(m_dvalue, res.data());
+			std::copy(m_db.data(), m_db.data() + m_db.size(), res.begin() + nweight);
+			return res;
+		}
+
+		// Only the derivatives of the weights in the pattern are read
+		void set_derivatives(const std::vector<Scalar>& deriv)
+		{
+			const std::size_t nweight = std::size_t(this->m_in_size) * this->m_out_size;
+			if (deriv.size() != nweight + m_db.size())
+			{
+				throw std::invalid_argument("[Class SparseFullyConnected]: Derivative Size Does Not Match");
+			}
+
+			for (int o = 0; o < this->m_out_size; o++)
+			{
+				for (int k = m_row_start[o]; k < m_row_start[o + 1]; k++)
+					m_dvalue[k] = deriv[std::size_t(o) * this->m_in_size + m_col[k]];
+			}
+			std::copy(deriv.begin() + nweight, deriv.end(), m_db.data());
+		}
+
+		std::string layer_type() const { return "SparseFullyConnected"; }
+
+		std::string activataion_type() const { return Activation::return_type(); }
+
+		void fill_meta_info(MetaInfo& map, int index) const
+		{
+			std::string ind = internal::to_string(index);
+			map.insert(std::make_pair("Layer" + ind, internal::layer_id(layer_type())));
+			map.insert(std::make_pair("Activation" + ind, internal::activation_id(activataion_type())));
+			map.insert(std::make_pair("in_size" + ind, in_size()));
+			map.insert(std::make_pair("out_size" + ind, out_size()));
+		}
+
+		internal::LayerCost cost(const int batch_size) const
+		{
+			const double in = this->m_in_size;
+			const double out = this->m_out_size;
+			const double n = batch_size;
+			const double nz = nnz();
+			const double nparam = nz + out;
+			// Column indices and row offsets
+			const double index_bytes = double(sizeof(int)) * (nz + out + 1);
+			internal::LayerCost res;
+
+			// SpMM, bias and activation
+			res.forward_flops = 2 * nz * n + 2 * out * n;
+			// Jacobian, then the weight and bias gradients, and din if they are needed
+			res.backward_flops = out * n + (m_need_param_grad ? 2 * nz * n + out * n : 0) +
+								 (m_need_input_grad ? 2 * nz * n : 0);
+
+			res.param_bytes = internal::scalar_bytes(nparam) + std::size_t(index_bytes);
+			// m_z and m_a, then m_din
+			res.activation_bytes = internal::scalar_bytes(2 * out * n);
+			res.input_grad_bytes = m_need_input_grad ? internal::scalar_bytes(in * n) : 0;
+
+			// Including the row-major copies of the input and the result
+			res.forward_traffic_bytes = double(sizeof(Scalar)) * (3 * in * n + nparam + 5 * out * n) + index_bytes;
+			res.backward_traffic_bytes = double(sizeof(Scalar)) * (6 * out * n + 4 * in * n + 3 * nparam) +
+										 2 * index_bytes;
+
+			return res;
+		}
+	};
+}
\ No newline at end of file
@@ -10,10 +10,28 @@
 #include "Layer/FullyConnected.h"
 #include "Layer/Convolutional.h"
 #include "Layer/MaxPooling.h"
+#include "Layer/ConvolutionalMaxPooling.h"
+#include "Layer/DepthwiseConvolutional.h"
+#include "Layer/SparseFullyConnected.h"
+#include "Layer/BatchNormalization.h"
 
 #include "Activation/Indentity.h"
 #include "Activation/Mish.h"
 #include "Activation/ReLU.h"
 #include "Activation/Sigmoid.h"
 #include "Activation/Tanh.h"
-#include "Activation/Softmax.h"
\ No newline at end of file
+#include "Activation/Softmax.h"
+
+#include "Output.h"
+#include "Output/RegressionMSE.h"
+#include "Output/MultiClassEntropy.h"
+
+#include "Optimizer.h"
+#include "Optimizer/SGD.h"
+
+#include "Network.h"
+#include "InferenceContext.h"
+#include "CodeGen.h"
+#include "Pruning.h"
+#include "Folding.h"
+#include "Hogwild.h"
\ No newline at end of file
@@ -1 +1,977 @@
 #pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <stdexcept>
+#include <ostream>
+#include <iomanip>
+#include <algorithm>
+#include <memory>
+#include "Config.h"
+#include "RNG.h"
+#include "Layer.h"
+#include "Output.h"
+#include "Optimizer.h"
+#include "Callback.h"
+#include "Utils/Cost.h"
+#include "Utils/Random.h"
+#include "Utils/Compress.h"
+#include "Utils/IO.h"
+#include "Utils/Factory.h"
+#include "Utils/Pipeline.h"
+#include "Utils/UpdateQueue.h"
+
+namespace MiniDNN
+{
+	///
+	/// A sequential stack of hidden layers
+	///
+	/// The network owns the layers and the output layer added to it and releases
+	/// them on destruction.
+	///
+	/// With gradient checkpointing enabled only the layers marked as checkpoints
+	/// keep their forward state after the next layer has consumed it. The
+	/// layers in between are recomputed segment by segment during backprop().
+	///
+	/// With a reduced activation storage (and no checkpoints) every layer
+	/// compresses its saved state after the forward pass and restores it right
+	/// before its own backprop().
+	///
+	/// Frozen layers are not updated. backprop() stops at the first trainable
+	/// layer, which does not compute the gradient of its input.
+	///
+	class Network
+	{
+	private:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef std::map<std::string, int> MetaInfo;
+
+		RNG m_default_rng;
+		RNG& m_rng;
+
+		std::vector<Layer*> m_layers;
+		Output* m_output;
+
+		Callback m_default_callback;
+		Callback* m_callback;
+
+		// m_checkpoint[i] is true if layer i keeps its state during training.
+		// Empty if checkpointing is disabled
+		std::vector<bool> m_checkpoint;
+
+		bool is_checkpoint(const int i) const { return m_checkpoint.empty() || m_checkpoint[i]; }
+
+		// Storage precision of the saved activations, see internal::STORAGE_ENUM
+		int m_storage;
+
+		// Whether fit() overlaps the parameter updates with backprop()
+		bool m_overlap_update;
+
+		// Precision of the weights read by the layers, see set_parameter_storage()
+		int m_param_storage;
+
+		bool compress_activations() const
+		{
+			return m_storage != internal::FULL_PRECISION && m_checkpoint.empty();
+		}
+
+		// Compress the state of all layers but the last one, whose output is read
+		// by the output layer
+		void compress_state()
+		{
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer - 1; i++)
+			{
+				m_layers[i]->compress_state(m_storage, m_layers[i + 1]->backprop_reads_input());
+			}
+		}
+
+		// Index of the first trainable layer, or the number of layers if all are frozen
+		int first_trainable() const
+		{
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer; i++)
+			{
+				if (m_layers[i]->trainable())
+					return i;
+			}
+
+			return nlayer;
+		}
+
+		// Parameter gradients are needed by trainable layers, and input gradients
+		// only by the layers above the first trainable one
+		void set_gradient_need()
+		{
+			const int nlayer = num_layers();
+			const int first = first_trainable();
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->set_gradient_need(m_layers[i]->trainable(), i > first);
+			}
+		}
+
+		// Check dimensions of consecutive layers
+		void check_unit_sizes() const
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 1)
+				return;
+
+			for (int i = 1; i < nlayer; i++)
+			{
+				if (m_layers[i]->in_size() != m_layers[i - 1]->out_size())
+					throw std::invalid_argument("[class Network]: Unit sizes do not match");
+			}
+		}
+
+		void forward(const Matrix& input)
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 0)
+				return;
+
+			if (input.rows() != m_layers[0]->in_size())
+				throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
+
+			m_layers[0]->forward(input);
+
+			// Without checkpoints, backprop() reads no state below the input of the
+			// first trainable layer
+			const int first = m_checkpoint.empty() ? first_trainable() : 0;
+			for (int i = 1; i < nlayer; i++)
+			{
+				m_layers[i]->forward(m_layers[i - 1]->output());
+
+				if (!is_checkpoint(i - 1) || i < first)
+					m_layers[i - 1]->release_state();
+			}
+		}
+
+		// With an update queue, each trainable layer is submitted for its update
+		// right after its backprop()
+		void backprop(const Matrix& input, const Matrix& target, internal::UpdateQueue* updater = NULL)
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 0)
+				return;
+
+			m_output->evaluate(m_layers[nlayer - 1]->output(), target);
+			const int first = first_trainable();
+
+			if (m_checkpoint.empty())
+			{
+				const bool compressed = compress_activations();
+
+				for (int i = nlayer - 1; i >= first; i--)
+				{
+					if (compressed)
+					{
+						m_layers[i]->decompress_state();
+						if (i > 0)
+							m_layers[i - 1]->decompress_state();
+					}
+
+					const Matrix& prev = (i == 0) ? input : m_layers[i - 1]->output();
+					const Matrix& next = (i == nlayer - 1) ? m_output->backprop_data() :
+														   m_layers[i + 1]->backprop_data();
+					m_layers[i]->backprop(prev, next);
+					if (m_layers[i]->trainable())
+					{
+						m_callback->gradients_ready(*this, i);
+						if (updater)
+							updater->submit(m_layers[i]);
+					}
+
+					// Keep only the restored state that is still needed
+					if (compressed && i < nlayer - 1)
+						m_layers[i + 1]->release_state();
+				}
+
+				for (int i = 0; i < first && i < nlayer; i++)
+				{
+					m_layers[i]->release_state();
+				}
+
+				return;
+			}
+
+			// Walk the segments from the back. Each segment ends at a checkpoint and
+			// starts right after the previous one (or at the input)
+			for (int seg_end = nlayer - 1; seg_end >= first; )
+			{
+				int seg_start = seg_end;
+				while (seg_start > 0 && !m_checkpoint[seg_start - 1])
+					seg_start--;
+
+				// Recompute the released layers of this segment
+				for (int i = seg_start; i < seg_end; i++)
+				{
+					m_layers[i]->forward((i == 0) ? input : m_layers[i - 1]->output());
+				}
+
+				for (int i = seg_end; i >= std::max(seg_start, first); i--)
+				{
+					const Matrix& prev = (i == 0) ? input : m_layers[i - 1]->output();
+					const Matrix& next = (i == nlayer - 1) ? m_output->backprop_data() :
+														   m_layers[i + 1]->backprop_data();
+					m_layers[i]->backprop(prev, next);
+					if (m_layers[i]->trainable())
+					{
+						m_callback->gradients_ready(*this, i);
+						if (updater)
+							updater->submit(m_layers[i]);
+					}
+
+					// The gradient of layer i + 1 has been consumed
+					if (i < nlayer - 1)
+						m_layers[i + 1]->release_state();
+				}
+
+				seg_end = seg_start - 1;
+			}
+
+			for (int i = 0; i <= first && i < nlayer; i++)
+			{
+				m_layers[i]->release_state();
+			}
+		}
+
+		void update(Optimizer& opt)
+		{
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer; i++)
+			{
+				if (m_layers[i]->trainable())
+					m_layers[i]->update(opt);
+			}
+		}
+
+		// Peak per-batch layer state (activations and input gradients) and the
+		// number of FLOPs spent on recomputation for the current checkpoint layout
+		void training_state_cost(const std::vector<internal::LayerCost>& costs, const std::vector<bool>& checkpoint,
+								 std::size_t& state_bytes, double& recompute_flops) const
+		{
+			const int nlayer = costs.size();
+			state_bytes = 0;
+			recompute_flops = 0;
+
+			if (checkpoint.empty())
+			{
+				for (int i = 0; i < nlayer; i++)
+				{
+					state_bytes += costs[i].activation_bytes + costs[i].input_grad_bytes;
+				}
+				return;
+			}
+
+			// Checkpoints stay alive, the other layers only within their segment,
+			// and at most two input gradients exist at a time
+			std::size_t kept = 0, segment = 0, max_segment = 0, max_grad = 0;
+			for (int i = 0; i < nlayer; i++)
+			{
+				max_grad = std::max(max_grad, costs[i].input_grad_bytes);
+				if (checkpoint[i])
+				{
+					kept += costs[i].activation_bytes;
+					max_segment = std::max(max_segment, segment);
+					segment = 0;
+				}
+				else
+				{
+					segment += costs[i].activation_bytes;
+					recompute_flops += costs[i].forward_flops;
+				}
+			}
+
+			state_bytes = kept + std::max(max_segment, segment) + 2 * max_grad;
+		}
+
+	public:
+		Network() :
+		m_default_rng(1), m_rng(m_default_rng), m_output(NULL), m_callback(&m_default_callback),
+		m_storage(internal::FULL_PRECISION), m_overlap_update(false),
+		m_param_storage(internal::FULL_PRECISION) {}
+
+		Network(RNG& rng) :
+		m_default_rng(1), m_rng(rng), m_output(NULL), m_callback(&m_default_callback),
+		m_storage(internal::FULL_PRECISION), m_overlap_update(false),
+		m_param_storage(internal::FULL_PRECISION) {}
+
+		virtual ~Network()
+		{
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer; i++)
+			{
+				delete m_layers[i];
+			}
+
+			if (m_output)
+				delete m_output;
+		}
+
+		int num_layers() const { return m_layers.size(); }
+
+		std::vector<const Layer*> get_layers() const
+		{
+			return std::vector<const Layer*>(m_layers.begin(), m_layers.end());
+		}
+
+		const Output* get_output() const { return m_output; }
+
+		void add_layer(Layer* layer)
+		{
+			layer->set_parameter_storage(m_param_storage);
+			m_layers.push_back(layer);
+			m_checkpoint.clear();
+			set_gradient_need();
+		}
+
+		///
+		/// Replace a layer, which is deleted
+		///
+		/// The new layer keeps the trainable flag of the old one. Its sizes may differ
+		/// as long as the caller replaces the neighbouring layers to match
+		///
+		void replace_layer(const int layer, Layer* new_layer)
+		{
+			if (layer < 0 || layer >= num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			new_layer->set_trainable(m_layers[layer]->trainable());
+			new_layer->set_parameter_storage(m_param_storage);
+			delete m_layers[layer];
+			m_layers[layer] = new_layer;
+			m_checkpoint.clear();
+			set_gradient_need();
+		}
+
+		///
+		/// Insert a layer before the layer at index 'layer', or at the end if it equals
+		/// num_layers(). The sizes of the neighbouring layers have to match
+		///
+		void insert_layer(const int layer, Layer* new_layer)
+		{
+			if (layer < 0 || layer > num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			new_layer->set_parameter_storage(m_param_storage);
+			m_layers.insert(m_layers.begin() + layer, new_layer);
+			m_checkpoint.clear();
+			set_gradient_need();
+		}
+
+		///
+		/// Remove and delete a layer. The sizes of the remaining layers have to match
+		///
+		void remove_layer(const int layer)
+		{
+			if (layer < 0 || layer >= num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			delete m_layers[layer];
+			m_layers.erase(m_layers.begin() + layer);
+			m_checkpoint.clear();
+			set_gradient_need();
+		}
+
+		///
+		/// Freeze or unfreeze a layer
+		///
+		/// Frozen layers keep their parameters during fit(), and no gradient is
+		/// computed for them or for the layers below the first trainable one.
+		/// Layers without parameters, such as MaxPooling, start frozen
+		///
+		void set_trainable(const int layer, const bool trainable)
+		{
+			if (layer < 0 || layer >= num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			m_layers[layer]->set_trainable(trainable);
+			set_gradient_need();
+		}
+
+		void set_output(Output* output)
+		{
+			if (m_output)
+				delete m_output;
+
+			m_output = output;
+		}
+
+		// The callback is not owned by the network
+		void set_callback(Callback& callback) { m_callback = &callback; }
+
+		void set_default_callback() { m_callback = &m_default_callback; }
+
+		Callback& get_callback() const { return *m_callback; }
+
+		///
+		/// Overlap the parameter updates of fit() with the backward pass
+		///
+		/// The update of a layer runs on a background thread as soon as its
+		/// backprop() has returned, while backprop() continues with the layers
+		/// below it. Layers compute their input gradient before returning from
+		/// backprop(), so the update does not change the weights that it reads.
+		/// The layers are updated from the last to the first. Since a callback may
+		/// change the gradients in pre_update(), updates are not overlapped while a
+		/// callback other than the default one is set.
+		///
+		void set_overlap_update(const bool overlap) { m_overlap_update = overlap; }
+
+		///
+		/// Enable gradient checkpointing
+		///
+		/// \param layers     Indices of the layers whose state is kept during training.
+		///                   The last layer is always kept
+		///
+		void set_checkpoints(const std::vector<int>& layers)
+		{
+			const int nlayer = num_layers();
+			m_checkpoint.assign(nlayer, false);
+
+			for (std::size_t i = 0; i < layers.size(); i++)
+			{
+				if (layers[i] < 0 || layers[i] >= nlayer)
+					throw std::invalid_argument("[class Network]: Checkpoint index out of range");
+
+				m_checkpoint[layers[i]] = true;
+			}
+
+			if (nlayer > 0)
+				m_checkpoint[nlayer - 1] = true;
+		}
+
+		void clear_checkpoints() { m_checkpoint.clear(); }
+
+		///
+		/// Set how layers store the state they keep between forward() and backprop()
+		///
+		/// \param storage    internal::FULL_PRECISION, internal::HALF or internal::BFLOAT16.
+		///                   ReLU layers whose output is not read by the next backprop()
+		///                   keep a one-bit mask instead. Ignored while checkpoints are set
+		///
+		void set_activation_storage(const int storage) { m_storage = storage; }
+
+		///
+		/// Set the precision of the weights that layers read in forward(), predict()
+		/// and backprop()
+		///
+		/// With internal::BFLOAT16, FullyConnected layers keep a bfloat16 copy of
+		/// their weights next to the full precision ones, and compute their products
+		/// in float. get_parameters(), the gradients and the optimizer still use the
+		/// full precision weights, and the copy is refreshed after each update.
+		/// Applies to the current layers and to the layers added later.
+		///
+		/// \param storage    internal::FULL_PRECISION or internal::BFLOAT16
+		///
+		void set_parameter_storage(const int storage)
+		{
+			if (storage != internal::FULL_PRECISION && storage != internal::BFLOAT16)
+				throw std::invalid_argument("[class Network]: Unsupported parameter storage");
+
+			m_param_storage = storage;
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->set_parameter_storage(storage);
+			}
+		}
+
+		std::vector<int> get_checkpoints() const
+		{
+			std::vector<int> res;
+			for (std::size_t i = 0; i < m_checkpoint.size(); i++)
+			{
+				if (m_checkpoint[i])
+					res.push_back(i);
+			}
+
+			return res;
+		}
+
+		///
+		/// Choose checkpoints automatically from a memory budget
+		///
+		/// Among the layouts produced by a greedy segmentation, pick the one with the
+		/// least recomputation whose predicted training memory fits in the budget.
+		///
+		/// \param batch_size    Number of observations in one batch
+		/// \param budget_bytes  Memory available for training
+		/// \return              \c true if the budget can be met. Otherwise the layout
+		///                      with the lowest predicted memory is used
+		///
+		bool set_checkpoint_budget(const int batch_size, const std::size_t budget_bytes)
+		{
+			check_unit_sizes();
+			const int nlayer = num_layers();
+			if (nlayer <= 0)
+				return true;
+
+			std::vector<internal::LayerCost> costs(nlayer);
+			std::size_t fixed_bytes = internal::scalar_bytes(double(m_layers[0]->in_size()) * batch_size);
+			std::size_t max_scratch = 0;
+			for (int i = 0; i < nlayer; i++)
+			{
+				costs[i] = m_layers[i]->cost(batch_size);
+				fixed_bytes += 2 * costs[i].param_bytes;
+				max_scratch = std::max(max_scratch, std::max(costs[i].forward_scratch_bytes,
+															 costs[i].backward_scratch_bytes));
+			}
+			fixed_bytes += max_scratch;
+
+			// Candidate segment capacities: the activation size of every contiguous range
+			std::vector<std::size_t> caps(1, 0);
+			for (int i = 0; i < nlayer; i++)
+			{
+				std::size_t sum = 0;
+				for (int j = i; j < nlayer - 1; j++)
+				{
+					sum += costs[j].activation_bytes;
+					caps.push_back(sum);
+				}
+			}
+
+			std::vector<bool> best, best_fit, layout(nlayer);
+			std::size_t best_bytes = 0;
+			double best_fit_flops = 0;
+			for (std::size_t c = 0; c < caps.size(); c++)
+			{
+				std::size_t segment = 0;
+				for (int i = 0; i < nlayer - 1; i++)
+				{
+					layout[i] = (segment + costs[i].activation_bytes > caps[c]);
+					segment = layout[i] ? 0 : (segment + costs[i].activation_bytes);
+				}
+				layout[nlayer - 1] = true;
+
+				std::size_t state_bytes;
+				double recompute_flops;
+				training_state_cost(costs, layout, state_bytes, recompute_flops);
+				const std::size_t total = fixed_bytes + state_bytes;
+
+				if (best.empty() || total < best_bytes)
+				{
+					best = layout;
+					best_bytes = total;
+				}
+				if (total <= budget_bytes && (best_fit.empty() || recompute_flops < best_fit_flops))
+				{
+					best_fit = layout;
+					best_fit_flops = recompute_flops;
+				}
+			}
+
+			m_checkpoint = best_fit.empty() ? best : best_fit;
+			return !best_fit.empty();
+		}
+
+		void init(const Scalar& mu = Scalar(0), const Scalar& sigma = Scalar(0.01), int seed = -1)
+		{
+			check_unit_sizes();
+
+			if (seed > 0)
+				m_rng.seed(seed);
+
+			const int nlayer = num_layers();
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->init(mu, sigma, m_rng);
+			}
+		}
+
+		std::vector< std::vector<Scalar> > get_parameters() const
+		{
+			const int nlayer = num_layers();
+			std::vector< std::vector<Scalar> > res;
+			res.reserve(nlayer);
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				res.push_back(m_layers[i]->get_parameters());
+			}
+
+			return res;
+		}
+
+		void set_parameters(const std::vector< std::vector<Scalar> >& param)
+		{
+			const int nlayer = num_layers();
+			if (static_cast<int>(param.size()) != nlayer)
+				throw std::invalid_argument("[class Network]: Parameter size does not match");
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->set_parameters(param[i]);
+			}
+		}
+
+		void set_parameters(const int layer, const std::vector<Scalar>& param)
+		{
+			if (layer < 0 || layer >= num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			m_layers[layer]->set_parameters(param);
+		}
+
+		std::vector< std::vector<Scalar> > get_derivatives() const
+		{
+			const int nlayer = num_layers();
+			std::vector< std::vector<Scalar> > res;
+			res.reserve(nlayer);
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				res.push_back(m_layers[i]->get_derivatives());
+			}
+
+			return res;
+		}
+
+		// Overwrite the gradients used by the next parameter update
+		void set_derivatives(const std::vector< std::vector<Scalar> >& deriv)
+		{
+			const int nlayer = num_layers();
+			if (static_cast<int>(deriv.size()) != nlayer)
+				throw std::invalid_argument("[class Network]: Derivative size does not match");
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->set_derivatives(deriv[i]);
+			}
+		}
+
+		void set_derivatives(const int layer, const std::vector<Scalar>& deriv)
+		{
+			if (layer < 0 || layer >= num_layers())
+				throw std::invalid_argument("[class Network]: Layer index out of range");
+
+			m_layers[layer]->set_derivatives(deriv);
+		}
+
+		///
+		/// Train the network with mini-batch gradient descent
+		///
+		/// The data are shuffled into mini-batches once, and every epoch goes through
+		/// the same batches. The callback may stop the training after any epoch.
+		///
+		/// \param opt           The optimizer used to update parameters
+		/// \param x             Predictors, one observation per column
+		/// \param y             Targets, one observation per column
+		/// \param batch_size    Mini-batch size
+		/// \param epoch         Number of passes over the data
+		/// \param seed          Seed of the shuffling RNG, ignored if not positive
+		///
+		template <typename DerivedX, typename DerivedY>
+		bool fit(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+				 int batch_size, int epoch, int seed = -1)
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 0 || m_output == NULL)
+				return false;
+
+			opt.reset();
+			if (seed > 0)
+				m_rng.seed(seed);
+
+			// Layers may have been frozen through their own pointers
+			set_gradient_need();
+
+			std::vector<Matrix> x_batches, y_batches;
+			const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches);
+			m_output->check_target_data(y);
+
+			std::unique_ptr<internal::UpdateQueue> updater;
+			if (m_overlap_update && m_callback == &m_default_callback)
+				updater.reset(new internal::UpdateQueue(opt));
+
+			for (int k = 0; k < epoch; k++)
+			{
+				for (int i = 0; i < nbatch; i++)
+				{
+					forward(x_batches[i]);
+					if (compress_activations())
+						compress_state();
+					backprop(x_batches[i], y_batches[i], updater.get());
+					if (updater)
+					{
+						updater->wait();
+					}
+					else
+					{
+						m_callback->pre_update(*this);
+						update(opt);
+					}
+				}
+
+				if (!m_callback->epoch_end(*this, k + 1))
+					break;
+			}
+
+			return true;
+		}
+
+		///
+		/// Train the network with pipeline parallelism over the layers
+		///
+		/// The layers are split into 'nstage' contiguous stages of balanced cost,
+		/// each run by its own thread, and every mini-batch into 'nmicro'
+		/// micro-batches that flow through the stages as in GPipe, so that
+		/// consecutive stages work on different micro-batches at the same time.
+		/// Stages keep the input of each micro-batch and recompute their forward
+		/// pass before backprop() when needed. The gradients of the micro-batches
+		/// are accumulated before update(), so unless a layer depends on the batch
+		/// statistics, such as BatchNormalization, each update is the one of fit()
+		/// up to rounding.
+		///
+		/// Checkpointing and activation storage settings do not apply, and the
+		/// callback only receives pre_update() and epoch_end().
+		///
+		/// \param opt           The optimizer used to update parameters
+		/// \param x             Predictors, one observation per column
+		/// \param y             Targets, one observation per column
+		/// \param batch_size    Mini-batch size
+		/// \param epoch         Number of passes over the data
+		/// \param nstage        Number of pipeline stages (threads)
+		/// \param nmicro        Number of micro-batches per mini-batch
+		/// \param seed          Seed of the shuffling RNG, ignored if not positive
+		///
+		template <typename DerivedX, typename DerivedY>
+		bool fit_pipeline(Optimizer& opt, const Eigen::MatrixBase<DerivedX>& x, const Eigen::MatrixBase<DerivedY>& y,
+						  int batch_size, int epoch, int nstage, int nmicro, int seed = -1)
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 0 || m_output == NULL)
+				return false;
+
+			opt.reset();
+			if (seed > 0)
+				m_rng.seed(seed);
+
+			set_gradient_need();
+
+			std::vector<Matrix> x_batches, y_batches;
+			const int nbatch = internal::create_shuffled_batches(x, y, batch_size, m_rng, x_batches, y_batches);
+			m_output->check_target_data(y);
+
+			// Balance the stages with the predicted cost of a micro-batch
+			const int micro_size = std::max(1, batch_size / std::max(nmicro, 1));
+			std::vector<double> cost(nlayer);
+			for (int i = 0; i < nlayer; i++)
+			{
+				const internal::LayerCost c = m_layers[i]->cost(micro_size);
+				cost[i] = c.forward_flops + c.backward_flops;
+			}
+
+			internal::PipelineTrainer trainer(m_layers, m_output, first_trainable(),
+											  internal::balance_stages(cost, nstage));
+			for (int k = 0; k < epoch; k++)
+			{
+				for (int i = 0; i < nbatch; i++)
+				{
+					trainer.run_batch(x_batches[i], y_batches[i], nmicro);
+					m_callback->pre_update(*this);
+					update(opt);
+				}
+
+				if (!m_callback->epoch_end(*this, k + 1))
+					break;
+			}
+
+			return true;
+		}
+
+		///
+		/// Predict with the inference pass of the layers, Layer::predict(). Unlike
+		/// training, layers such as BatchNormalization use their learned statistics
+		///
+		Matrix predict(const Matrix& x) const
+		{
+			const int nlayer = num_layers();
+			if (nlayer <= 0)
+				return Matrix();
+
+			if (x.rows() != m_layers[0]->in_size())
+				throw std::invalid_argument("[class Network]: Input data have incorrect dimension");
+
+			Matrix z, a[2];
+			const Matrix* input = &x;
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->predict(*input, z, a[i % 2]);
+				input = &a[i % 2];
+			}
+
+			return *input;
+		}
+
+		///
+		/// Loss of predict() on the data, as computed by the output layer
+		///
+		Scalar loss(const Matrix& x, const Matrix& y) const
+		{
+			if (m_output == NULL)
+				throw std::logic_error("[class Network]: Output layer is not set");
+
+			// A fresh output layer, so that the state of m_output is left untouched
+			MetaInfo map;
+			map.insert(std::make_pair("OutputLayer", internal::output_id(m_output->output_type())));
+			Output* output = internal::create_output(map);
+			output->evaluate(predict(x), y);
+			const Scalar res = output->loss();
+			delete output;
+
+			return res;
+		}
+
+		///
+		/// Export the network to a folder: a meta information file named 'filename'
+		/// and one parameter file per layer
+		///
+		void export_net(const std::string& folder, const std::string& filename) const
+		{
+			if (!internal::create_directory(folder))
+				throw std::runtime_error("[class Network]: Folder creation failed");
+
+			MetaInfo map;
+			const int nlayer = num_layers();
+			map.insert(std::make_pair("Nlayers", nlayer));
+			for (int i = 0; i < nlayer; i++)
+			{
+				m_layers[i]->fill_meta_info(map, i);
+			}
+
+			if (m_output)
+				map.insert(std::make_pair("OutputLayer", internal::output_id(m_output->output_type())));
+
+			internal::write_map(folder + "/" + filename, map);
+			internal::write_parameters(folder, filename, get_parameters());
+		}
+
+		///
+		/// Read a network previously written by export_net(), replacing the current layers
+		///
+		void read_net(const std::string& folder, const std::string& filename)
+		{
+			MetaInfo map;
+			internal::read_map(folder + "/" + filename, map);
+			const int nlayer = internal::meta_value(map, "Nlayers");
+			std::vector< std::vector<Scalar> > params = internal::read_parameters(folder, filename, nlayer);
+
+			for (int i = 0; i < num_layers(); i++)
+			{
+				delete m_layers[i];
+			}
+			m_layers.clear();
+			m_checkpoint.clear();
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				add_layer(internal::create_layer(map, i));
+			}
+
+			set_parameters(params);
+
+			if (map.find("OutputLayer") != map.end())
+				set_output(internal::create_output(map));
+		}
+
+		///
+		/// Predict the cost of running the network without allocating anything
+		///
+		/// \param batch_size     Number of observations in one batch
+		/// \param peak_gflops    Peak arithmetic throughput of the machine, in GFLOP/s
+		/// \param peak_gbs       Peak memory bandwidth of the machine, in GB/s
+		///
+		internal::NetworkCost cost(const int batch_size, const double peak_gflops, const double peak_gbs) const
+		{
+			check_unit_sizes();
+
+			internal::NetworkCost res;
+			const int nlayer = num_layers();
+			if (nlayer <= 0)
+				return res;
+
+			// The input batch is owned by the caller but has to fit as well
+			const std::size_t input_bytes = internal::scalar_bytes(double(m_layers[0]->in_size()) * batch_size);
+			std::size_t state_bytes = 0;
+			std::size_t max_fwd_scratch = 0, max_bwd_scratch = 0;
+			std::vector<internal::LayerCost> costs(nlayer);
+
+			for (int i = 0; i < nlayer; i++)
+			{
+				const internal::LayerCost& c = costs[i] = m_layers[i]->cost(batch_size);
+
+				res.forward_flops += c.forward_flops;
+				res.backward_flops += c.backward_flops;
+				res.param_bytes += c.param_bytes;
+				res.forward_seconds += internal::roofline_seconds(c.forward_flops, c.forward_traffic_bytes,
+																  peak_gflops, peak_gbs);
+				res.backward_seconds += internal::roofline_seconds(c.backward_flops, c.backward_traffic_bytes,
+																   peak_gflops, peak_gbs);
+				if (!is_checkpoint(i))
+					res.backward_seconds += internal::roofline_seconds(c.forward_flops, c.forward_traffic_bytes,
+																	   peak_gflops, peak_gbs);
+
+				state_bytes += c.activation_bytes;
+				max_fwd_scratch = std::max(max_fwd_scratch, c.forward_scratch_bytes);
+				max_bwd_scratch = std::max(max_bwd_scratch, c.backward_scratch_bytes);
+			}
+
+			res.inference_peak_bytes = res.param_bytes + input_bytes + state_bytes + max_fwd_scratch;
+
+			// Weights plus gradients, and the layer state under the current checkpoint layout
+			std::size_t train_state_bytes;
+			training_state_cost(costs, m_checkpoint, train_state_bytes, res.recompute_flops);
+			res.training_peak_bytes = 2 * res.param_bytes + input_bytes + train_state_bytes +
+									  std::max(max_fwd_scratch, max_bwd_scratch);
+
+			return res;
+		}
+
+		///
+		/// Print a per-layer cost table and the predicted peak memory and latency
+		///
+		void summary(std::ostream& os, const int batch_size,
+					 const double peak_gflops, const double peak_gbs) const
+		{
+			// The format settings of the caller's stream are restored at the end
+			const std::ios_base::fmtflags flags = os.flags();
+			const std::streamsize precision = os.precision();
+
+			const double mb = 1024.0 * 1024.0;
+			const int nlayer = num_layers();
+
+			os << "Layer  Type                     Fwd MFLOP  Bwd MFLOP  Param MB  Act MB  Scratch MB  Fwd ms  Bwd ms\n";
+			for (int i = 0; i < nlayer; i++)
+			{
+				const internal::LayerCost c = m_layers[i]->cost(batch_size);
+				const double fwd_ms = 1e3 * internal::roofline_seconds(c.forward_flops, c.forward_traffic_bytes,
+																	   peak_gflops, peak_gbs);
+				const double bwd_ms = 1e3 * internal::roofline_seconds(c.backward_flops, c.backward_traffic_bytes,
+																	   peak_gflops, peak_gbs);
+				os << std::left << std::setw(7) << i << std::setw(25) << m_layers[i]->layer_type()
+				   << std::right << std::fixed << std::setprecision(2)
+				   << std::setw(9) << c.forward_flops / 1e6 << "  "
+				   << std::setw(9) << c.backward_flops / 1e6 << "  "
+				   << std::setw(8) << c.param_bytes / mb << "  "
+				   << std::setw(6) << (c.activation_bytes + c.input_grad_bytes) / mb << "  "
+				   << std::setw(10) << std::max(c.forward_scratch_bytes, c.backward_scratch_bytes) / mb << "  "
+				   << std::setw(6) << fwd_ms << "  "
+				   << std::setw(6) << bwd_ms << "\n";
+			}
+
+			const internal::NetworkCost total = cost(batch_size, peak_gflops, peak_gbs);
+			os << "Batch size " << batch_size << "\n"
+			   << "Inference peak memory: " << total.inference_peak_bytes / mb << " MB, "
+			   << "estimated latency " << 1e3 * total.forward_seconds << " ms\n"
+			   << "Training peak memory:  " << total.training_peak_bytes / mb << " MB, "
+			   << "estimated step time " << 1e3 * (total.forward_seconds + total.backward_seconds) << " ms\n";
+			if (total.recompute_flops > 0)
+				os << "Checkpointing recomputes " << total.recompute_flops / 1e6 << " MFLOP per step\n";
+
+			os.flags(flags);
+			os.precision(precision);
+		}
+	};
+}
\ No newline at end of file
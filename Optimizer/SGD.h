@@ -0,0 +1,26 @@
+#pragma once
+
+#include <Eigen/Core>
+#include "../Config.h"
+#include "../Optimizer.h"
+
+namespace MiniDNN
+{
+	///
+	/// Plain stochastic gradient descent with optional L2 weight decay
+	///
+	class SGD : public Optimizer
+	{
+	public:
+		Scalar m_lrate;
+		Scalar m_decay;
+
+		SGD(const Scalar& lrate = Scalar(0.001), const Scalar& decay = Scalar(0)) :
+		m_lrate(lrate), m_decay(decay) {}
+
+		void update(ConstAlignedMapVec& dvec, AlignedMapVec& vec)
+		{
+			vec.noalias() -= m_lrate * (dvec + m_decay * vec);
+		}
+	};
+}
\ No newline at end of file
@@ -1 +1,33 @@
 #pragma once
+
+#include <Eigen/Core>
+#include <string>
+#include <stdexcept>
+#include "Config.h"
+
+namespace MiniDNN
+{
+	///
+	/// The interface of the output layer, which evaluates the loss and its
+	/// derivative with respect to the output of the last hidden layer
+	///
+	class Output
+	{
+	protected:
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+	public:
+		virtual ~Output() {}
+
+		virtual void check_target_data(const Matrix& target) {}
+
+		virtual void evaluate(const Matrix& prev_layer_data, const Matrix& target) = 0;
+
+		virtual const Matrix& backprop_data() const = 0;
+
+		virtual Scalar loss() const = 0;
+
+		virtual std::string output_type() const = 0;
+	};
+}
\ No newline at end of file
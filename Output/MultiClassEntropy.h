@@ -0,0 +1,78 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <cmath>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Output.h"
+
+namespace MiniDNN
+{
+	// Expects the last hidden layer to use the Softmax activation and the
+	// target to be one-hot encoded
+	class MultiClassEntropy : public Output
+	{
+	private:
+		Matrix m_din;
+
+	public:
+		void check_target_data(const Matrix& target)
+		{
+			const int nobs = target.cols();
+			const int nclass = target.rows();
+
+			for (int i = 0; i < nobs; i++)
+			{
+				int one = 0;
+				for (int j = 0; j < nclass; j++)
+				{
+					if (target(j, i) == Scalar(1))
+					{
+						one++;
+						continue;
+					}
+					if (target(j, i) != Scalar(0))
+						throw std::invalid_argument("[Class MultiClassEntropy]: Target data should only contain zero or one");
+				}
+
+				if (one != 1)
+					throw std::invalid_argument("[Class MultiClassEntropy]: Each column of target data should only contain one \"1\"");
+			}
+		}
+
+		void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+		{
+			const int nobs = prev_layer_data.cols();
+			const int nclass = prev_layer_data.rows();
+
+			if ((target.cols() != nobs) || (target.rows() != nclass))
+			{
+				throw std::invalid_argument("[Class MultiClassEntropy]: Target data have incorrect dimension");
+			}
+
+			// L = -sum(log(phat) * y), dL / dphat = -y / phat
+			m_din.resize(nclass, nobs);
+			m_din.array() = -target.array() / prev_layer_data.array();
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		Scalar loss() const
+		{
+			// m_din contains 0 if y = 0, and -1/phat if y = 1
+			Scalar res = 0;
+			const int nelem = m_din.size();
+			const Scalar* din_data = m_din.data();
+
+			for (int i = 0; i < nelem; i++)
+			{
+				if (din_data[i] < Scalar(0))
+					res += std::log(-din_data[i]);
+			}
+
+			return res / m_din.cols();
+		}
+
+		std::string output_type() const { return "MultiClassEntropy"; }
+	};
+}
\ No newline at end of file
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Output.h"
+
+namespace MiniDNN
+{
+	class RegressionMSE : public Output
+	{
+	private:
+		Matrix m_din;
+
+	public:
+		void evaluate(const Matrix& prev_layer_data, const Matrix& target)
+		{
+			const int nobs = prev_layer_data.cols();
+			const int nvar = prev_layer_data.rows();
+
+			if ((target.cols() != nobs) || (target.rows() != nvar))
+			{
+				throw std::invalid_argument("[Class RegressionMSE]: Target data have incorrect dimension");
+			}
+
+			m_din.resize(nvar, nobs);
+			m_din.noalias() = prev_layer_data - target;
+		}
+
+		const Matrix& backprop_data() const { return m_din; }
+
+		Scalar loss() const { return m_din.squaredNorm() / m_din.cols() * Scalar(0.5); }
+
+		std::string output_type() const { return "RegressionMSE"; }
+	};
+}
\ No newline at end of file
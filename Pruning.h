@@ -0,0 +1,567 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <Eigen/SVD>
+#include <vector>
+#include <map>
+#include <string>
+#include <ostream>
+#include <iomanip>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include "Config.h"
+#include "RNG.h"
+#include "Layer.h"
+#include "Network.h"
+#include "Optimizer.h"
+#include "Utils/Enum.h"
+#include "Utils/Factory.h"
+#include "Utils/Random.h"
+
+namespace MiniDNN
+{
+	namespace internal
+	{
+		inline bool is_fully_connected(const Layer& layer)
+		{
+			const int id = layer_id(layer.layer_type());
+			return id == FULLY_CONNECTED || id == SPARSE_FULLY_CONNECTED;
+		}
+
+		// A copy of 'layer' as the layer type 'lay_id', with the same activation,
+		// sizes and parameters. The two types must read the same meta information
+		inline Layer* convert_layer(const Layer& layer, const int lay_id)
+		{
+			std::map<std::string, int> map;
+			layer.fill_meta_info(map, 0);
+			map["Layer0"] = lay_id;
+
+			Layer* res = create_layer(map, 0);
+			res->set_parameters(layer.get_parameters());
+			return res;
+		}
+
+		// Shortest of 'repeat' timings of layer.predict(x), in seconds
+		inline double predict_seconds(const Layer& layer, const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& x,
+									  const int repeat)
+		{
+			typedef std::chrono::steady_clock Clock;
+			Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> z, a;
+
+			// The first call allocates the buffers
+			layer.predict(x, z, a);
+			double best = 0;
+			for (int i = 0; i < repeat; i++)
+			{
+				const Clock::time_point start = Clock::now();
+				layer.predict(x, z, a);
+				const double t = std::chrono::duration<double>(Clock::now() - start).count();
+				best = (i == 0) ? t : std::min(best, t);
+			}
+
+			return best;
+		}
+
+		// 'src' holds 'nouter' groups of 'nchannel' blocks of 'block' values. Keep
+		// the blocks of the channels in 'kept' in every group
+		inline std::vector<Scalar> select_channels(const Scalar* src, const int nouter, const int nchannel,
+												   const int block, const std::vector<int>& kept)
+		{
+			const int nkept = kept.size();
+			std::vector<Scalar> res(std::size_t(nouter) * nkept * block);
+			Scalar* dest = res.data();
+			for (int i = 0; i < nouter; i++)
+			{
+				const Scalar* group = src + std::size_t(i) * nchannel * block;
+				for (int k = 0; k < nkept; k++, dest += block)
+					std::copy(group + std::size_t(kept[k]) * block, group + std::size_t(kept[k] + 1) * block, dest);
+			}
+
+			return res;
+		}
+
+		// Weights of a fully connected layer as the 'in_size x out_size' matrix of FullyConnected
+		inline Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> dense_weights(const Layer& layer)
+		{
+			const std::vector<Scalar> param = layer.get_parameters();
+			return Eigen::Map<const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >(
+				param.data(), layer.in_size(), layer.out_size());
+		}
+
+		// A FullyConnected layer with the given activation and parameters
+		inline Layer* create_fully_connected(const int in_size, const int out_size, const int act_id,
+											 const Scalar* weight, const Scalar* bias)
+		{
+			std::map<std::string, int> map;
+			map["Layer0"] = FULLY_CONNECTED;
+			map["Activation0"] = act_id;
+			map["in_size0"] = in_size;
+			map["out_size0"] = out_size;
+
+			std::vector<Scalar> param(weight, weight + std::size_t(in_size) * out_size);
+			param.insert(param.end(), bias, bias + out_size);
+			Layer* res = create_layer(map, 0);
+			res->set_parameters(param);
+			return res;
+		}
+
+		// Time of a fully connected layer of rank 'rank' factored into two, in seconds
+		inline double low_rank_seconds(const int in_size, const int out_size, const int rank, const int batch_size,
+									   RNG& rng)
+		{
+			typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+			// The values do not matter for the timing
+			Matrix w1(in_size, rank), w2(rank, out_size), b(out_size, 1), x(in_size, batch_size);
+			set_normal_random(w1.data(), w1.size(), rng);
+			set_normal_random(w2.data(), w2.size(), rng);
+			set_normal_random(b.data(), b.size(), rng);
+			set_normal_random(x.data(), x.size(), rng);
+			b.topRows(rank).setZero();
+
+			Layer* first = create_fully_connected(in_size, rank, IDENTITY, w1.data(), b.data());
+			Layer* second = create_fully_connected(rank, out_size, IDENTITY, w2.data(), b.data());
+			Matrix z, h;
+			first->predict(x, z, h);
+			const double res = predict_seconds(*first, x, 5) + predict_seconds(*second, h, 5);
+			delete first;
+			delete second;
+			return res;
+		}
+	}
+
+	///
+	/// Magnitude pruning of a fully connected layer
+	///
+	/// Set the smallest weights in absolute value to zero. Weights that are already
+	/// zero count towards the target, so calling this with increasing sparsity
+	/// between rounds of training prunes gradually. Biases are kept.
+	///
+	/// \param net         The network
+	/// \param layer       Index of a FullyConnected or SparseFullyConnected layer
+	/// \param sparsity    Fraction of the weights that are zero afterwards, in [0, 1]
+	/// \return            The number of zero weights
+	///
+	inline int prune_fully_connected(Network& net, const int layer, const double sparsity)
+	{
+		if (layer < 0 || layer >= net.num_layers())
+			throw std::invalid_argument("[function prune_fully_connected]: Layer index out of range");
+		if (sparsity < 0 || sparsity > 1)
+			throw std::invalid_argument("[function prune_fully_connected]: Sparsity must be in [0, 1]");
+
+		const Layer& target = *net.get_layers()[layer];
+		if (!internal::is_fully_connected(target))
+			throw std::invalid_argument("[function prune_fully_connected]: Layer is not fully connected");
+
+		std::vector< std::vector<Scalar> > param = net.get_parameters();
+		Scalar* w = param[layer].data();
+		const int nweight = target.in_size() * target.out_size();
+		const int nzero = static_cast<int>(std::floor(sparsity * nweight + 0.5));
+
+		// The 'nzero' weights of the smallest magnitude
+		std::vector<int> order(nweight);
+		for (int i = 0; i < nweight; i++)
+			order[i] = i;
+		std::nth_element(order.begin(), order.begin() + nzero, order.end(),
+						 [w](int i, int j) { return std::abs(w[i]) < std::abs(w[j]); });
+		for (int i = 0; i < nzero; i++)
+			w[order[i]] = Scalar(0);
+
+		net.set_parameters(param);
+		return nzero;
+	}
+
+	///
+	/// Choose between dense and sparse storage for every fully connected layer
+	///
+	/// Each FullyConnected and SparseFullyConnected layer is timed in both forms on
+	/// random input, and replaced by the faster one. The parameters are unchanged, so
+	/// the predictions are the same up to rounding. Sparse storage usually starts to
+	/// win between 50% and 80% sparsity, depending on the layer and batch sizes.
+	///
+	/// \param net           The network, typically after prune_fully_connected()
+	/// \param batch_size    Number of observations per prediction to optimize for
+	/// \param repeat        Number of timed runs of each form
+	/// \return              The number of layers stored as sparse
+	///
+	inline int select_sparse_layers(Network& net, const int batch_size, const int repeat = 5)
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+		RNG rng(1);
+		int nsparse = 0;
+		const int nlayer = net.num_layers();
+		for (int i = 0; i < nlayer; i++)
+		{
+			const Layer& current = *net.get_layers()[i];
+			if (!internal::is_fully_connected(current))
+				continue;
+
+			const bool sparse = internal::layer_id(current.layer_type()) == internal::SPARSE_FULLY_CONNECTED;
+			Layer* other = internal::convert_layer(current,
+												   sparse ? internal::FULLY_CONNECTED : internal::SPARSE_FULLY_CONNECTED);
+
+			Matrix x(current.in_size(), batch_size);
+			internal::set_normal_random(x.data(), x.size(), rng);
+			const double current_time = internal::predict_seconds(current, x, repeat);
+			const double other_time = internal::predict_seconds(*other, x, repeat);
+
+			if (other_time < current_time)
+			{
+				net.replace_layer(i, other);
+				nsparse += !sparse;
+			}
+			else
+			{
+				delete other;
+				nsparse += sparse;
+			}
+		}
+
+		return nsparse;
+	}
+
+	///
+	/// Structured pruning of the output channels of a convolutional layer
+	///
+	/// Rank the output channels of a Convolutional or ConvolutionalMaxPooling layer
+	/// by the L2 norm of their filters and remove the weakest ones, together with
+	/// their biases. The layers that read the removed channels are rewritten to
+	/// match: MaxPooling, DepthwiseConvolutional and BatchNormalization layers lose
+	/// the same channels and pass them on, and the next Convolutional,
+	/// ConvolutionalMaxPooling or fully connected layer drops the corresponding
+	/// inputs. The result is a smaller dense network that is saved in the usual
+	/// format.
+	///
+	/// \param net         The network
+	/// \param layer       Index of a Convolutional or ConvolutionalMaxPooling layer,
+	///                    which cannot be the last layer
+	/// \param keep        Number of output channels to keep
+	/// \return            The original indices of the kept channels, in increasing order
+	///
+	inline std::vector<int> prune_channels(Network& net, const int layer, const int keep)
+	{
+		typedef std::map<std::string, int> MetaInfo;
+
+		const int nlayer = net.num_layers();
+		if (layer < 0 || layer >= nlayer - 1)
+			throw std::invalid_argument("[function prune_channels]: Layer index out of range");
+
+		const std::vector<const Layer*> layers = net.get_layers();
+		MetaInfo map;
+		for (int i = 0; i < nlayer; i++)
+			layers[i]->fill_meta_info(map, i);
+		std::vector< std::vector<Scalar> > param = net.get_parameters();
+
+		std::string ind = internal::to_string(layer);
+		int lay_id = internal::meta_value(map, "Layer" + ind);
+		if (lay_id != internal::CONVOLUTIONAL && lay_id != internal::CONVOLUTIONAL_MAX_POOLING)
+			throw std::invalid_argument("[function prune_channels]: Layer is not convolutional");
+
+		const int nchannel = internal::meta_value(map, "out_channels" + ind);
+		if (keep < 1 || keep > nchannel)
+			throw std::invalid_argument("[function prune_channels]: Number of kept channels out of range");
+
+		// Filter norms. The filter of (input channel 'i', output channel 'o') is block
+		// 'i * nchannel + o' of the filter data
+		const int in_channels = internal::meta_value(map, "in_channels" + ind);
+		const int filter_size = internal::meta_value(map, "window_width" + ind) *
+								internal::meta_value(map, "window_height" + ind);
+		std::vector<Scalar> norm(nchannel, Scalar(0));
+		for (int i = 0; i < in_channels; i++)
+		{
+			for (int o = 0; o < nchannel; o++)
+			{
+				const Scalar* filter = param[layer].data() + (std::size_t(i) * nchannel + o) * filter_size;
+				for (int q = 0; q < filter_size; q++)
+					norm[o] += filter[q] * filter[q];
+			}
+		}
+
+		std::vector<int> kept(nchannel);
+		for (int o = 0; o < nchannel; o++)
+			kept[o] = o;
+		std::stable_sort(kept.begin(), kept.end(), [&norm](int i, int j) { return norm[i] > norm[j]; });
+		kept.resize(keep);
+		std::sort(kept.begin(), kept.end());
+
+		// The pruned layer itself
+		const std::size_t nfilter = std::size_t(in_channels) * nchannel * filter_size;
+		std::vector<Scalar> filters = internal::select_channels(param[layer].data(), in_channels, nchannel,
+																 filter_size, kept);
+		std::vector<Scalar> bias = internal::select_channels(param[layer].data() + nfilter, 1, nchannel, 1, kept);
+		filters.insert(filters.end(), bias.begin(), bias.end());
+		param[layer].swap(filters);
+		map["out_channels" + ind] = keep;
+
+		// Walk through the layers that pass the channels on, up to the one that mixes them
+		std::vector<int> changed(1, layer);
+		int npixel = layers[layer]->out_size() / nchannel;
+		int layout = internal::meta_value(map, "layout" + ind, internal::CHANNELS_FIRST);
+		bool consumed = false;
+		for (int j = layer + 1; j < nlayer && !consumed; j++)
+		{
+			ind = internal::to_string(j);
+			lay_id = internal::meta_value(map, "Layer" + ind);
+			std::vector<Scalar>& p = param[j];
+			changed.push_back(j);
+
+			if (lay_id == internal::MAX_POOLING)
+			{
+				map["in_channels" + ind] = keep;
+				npixel = layers[j]->out_size() / nchannel;
+				layout = internal::meta_value(map, "layout" + ind, internal::CHANNELS_FIRST);
+			}
+			else if (lay_id == internal::DEPTHWISE_CONVOLUTIONAL)
+			{
+				const int size = internal::meta_value(map, "window_width" + ind) *
+								 internal::meta_value(map, "window_height" + ind);
+				std::vector<Scalar> w = internal::select_channels(p.data(), 1, nchannel, size, kept);
+				std::vector<Scalar> b = internal::select_channels(p.data() + std::size_t(nchannel) * size, 1, nchannel,
+																  1, kept);
+				w.insert(w.end(), b.begin(), b.end());
+				p.swap(w);
+				map["in_channels" + ind] = keep;
+				npixel = layers[j]->out_size() / nchannel;
+				layout = internal::CHANNELS_FIRST;
+			}
+			else if (lay_id == internal::BATCH_NORMALIZATION)
+			{
+				// gamma, beta, running mean and running variance, one block each
+				std::vector<Scalar> w = internal::select_channels(p.data(), 4, nchannel, 1, kept);
+				p.swap(w);
+				map["in_channels" + ind] = keep;
+				layout = internal::meta_value(map, "layout" + ind, internal::CHANNELS_FIRST);
+			}
+			else if (lay_id == internal::CONVOLUTIONAL || lay_id == internal::CONVOLUTIONAL_MAX_POOLING)
+			{
+				// All the filters of an input channel are stored together
+				const int out_channels = internal::meta_value(map, "out_channels" + ind);
+				const int size = out_channels * internal::meta_value(map, "window_width" + ind) *
+								 internal::meta_value(map, "window_height" + ind);
+				std::vector<Scalar> w = internal::select_channels(p.data(), 1, nchannel, size, kept);
+				w.insert(w.end(), p.begin() + std::size_t(nchannel) * size, p.end());
+				p.swap(w);
+				map["in_channels" + ind] = keep;
+				consumed = true;
+			}
+			else if (lay_id == internal::FULLY_CONNECTED || lay_id == internal::SPARSE_FULLY_CONNECTED)
+			{
+				// Column 'o' of the weights holds the inputs of output 'o'
+				const int out_size = internal::meta_value(map, "out_size" + ind);
+				std::vector<Scalar> w = (layout == internal::CHANNELS_LAST) ?
+					internal::select_channels(p.data(), out_size * npixel, nchannel, 1, kept) :
+					internal::select_channels(p.data(), out_size, nchannel, npixel, kept);
+				w.insert(w.end(), p.end() - out_size, p.end());
+				p.swap(w);
+				map["in_size" + ind] = keep * npixel;
+				consumed = true;
+			}
+			else
+			{
+				throw std::invalid_argument("[function prune_channels]: Layer type cannot follow a pruned layer");
+			}
+		}
+
+		if (!consumed)
+			throw std::invalid_argument("[function prune_channels]: The pruned channels reach the network output");
+
+		for (std::size_t k = 0; k < changed.size(); k++)
+		{
+			Layer* pruned = internal::create_layer(map, changed[k]);
+			pruned->set_parameters(param[changed[k]]);
+			net.replace_layer(changed[k], pruned);
+		}
+
+		return kept;
+	}
+
+	///
+	/// Smallest rank whose singular values keep the fraction 'energy' of the squared
+	/// Frobenius norm of the weights of a fully connected layer
+	///
+	inline int rank_for_energy(const Network& net, const int layer, const double energy)
+	{
+		if (layer < 0 || layer >= net.num_layers() || !internal::is_fully_connected(*net.get_layers()[layer]))
+			throw std::invalid_argument("[function rank_for_energy]: Layer is not fully connected");
+
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+		const Vector s = Eigen::BDCSVD< Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> >(
+			internal::dense_weights(*net.get_layers()[layer])).singularValues();
+
+		const double total = s.squaredNorm();
+		double kept = 0;
+		for (int r = 0; r < s.size(); r++)
+		{
+			kept += s[r] * s[r];
+			if (kept >= energy * total)
+				return r + 1;
+		}
+
+		return s.size();
+	}
+
+	///
+	/// Largest rank at which a fully connected layer, factored into two, runs at
+	/// least 'speedup' times faster than the dense layer on batches of 'batch_size'.
+	/// Both are timed on this machine. Returns 0 if no rank meets the target
+	///
+	inline int rank_for_speedup(const Network& net, const int layer, const double speedup, const int batch_size)
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+		if (layer < 0 || layer >= net.num_layers() || !internal::is_fully_connected(*net.get_layers()[layer]))
+			throw std::invalid_argument("[function rank_for_speedup]: Layer is not fully connected");
+
+		const Layer& dense = *net.get_layers()[layer];
+		RNG rng(1);
+		Matrix x(dense.in_size(), batch_size);
+		internal::set_normal_random(x.data(), x.size(), rng);
+		const double target = internal::predict_seconds(dense, x, 5) / speedup;
+
+		// The time grows with the rank, so search for the last rank within the target
+		int lo = 0, hi = std::min(dense.in_size(), dense.out_size());
+		while (lo < hi)
+		{
+			const int mid = (lo + hi + 1) / 2;
+			if (internal::low_rank_seconds(dense.in_size(), dense.out_size(), mid, batch_size, rng) <= target)
+				lo = mid;
+			else
+				hi = mid - 1;
+		}
+
+		return lo;
+	}
+
+	///
+	/// Result of factorize_fully_connected()
+	///
+	struct LowRankReport
+	{
+		int    layer;             // Index of the factored layer, now the first of the pair
+		int    rank;              // Rank of the factorization
+		int    full_rank;         // min(in_size, out_size) of the original layer
+		double energy;            // Fraction of the squared singular values kept
+		double dense_seconds;     // Prediction time of the original layer
+		double factored_seconds;  // Prediction time of the two layers
+		double loss_before;       // Loss of the network on the given data, before
+		double loss_factored;     // after the factorization
+		double loss_tuned;        // and after fine-tuning, if any
+	};
+
+	///
+	/// Low-rank factorization of a fully connected layer
+	///
+	/// The weights are replaced by their truncated SVD, W ~ U_r S_r V_r', split into
+	/// two FullyConnected layers: 'in_size -> rank' with weights U_r S_r^(1/2), no bias
+	/// and the identity activation, then 'rank -> out_size' with weights
+	/// S_r^(1/2) V_r', the original bias and activation. This saves work when
+	/// 'rank * (in_size + out_size) < in_size * out_size'.
+	///
+	/// \param net           The network, with an output layer set
+	/// \param layer         Index of a FullyConnected or SparseFullyConnected layer
+	/// \param rank          Rank of the factorization, see rank_for_energy() and
+	///                      rank_for_speedup()
+	/// \param x             Data used to measure the loss, and to fine-tune
+	/// \param y             Targets of 'x'
+	/// \param opt           If not NULL, the whole network is trained on 'x' afterwards
+	/// \param epoch         Number of fine-tuning passes over the data
+	/// \param batch_size    Mini-batch size of the fine-tuning and of the timings
+	///
+	template <typename DerivedX, typename DerivedY>
+	inline LowRankReport factorize_fully_connected(Network& net, const int layer, const int rank,
+												   const Eigen::MatrixBase<DerivedX>& x,
+												   const Eigen::MatrixBase<DerivedY>& y,
+												   Optimizer* opt = NULL, const int epoch = 1,
+												   const int batch_size = 32)
+	{
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+		typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+
+		if (layer < 0 || layer >= net.num_layers() || !internal::is_fully_connected(*net.get_layers()[layer]))
+			throw std::invalid_argument("[function factorize_fully_connected]: Layer is not fully connected");
+		if (net.get_output() == NULL)
+			throw std::invalid_argument("[function factorize_fully_connected]: Output layer is not set");
+
+		const Layer& dense = *net.get_layers()[layer];
+		const int in = dense.in_size(), out = dense.out_size();
+		LowRankReport res;
+		res.layer = layer;
+		res.rank = rank;
+		res.full_rank = std::min(in, out);
+		if (rank < 1 || rank > res.full_rank)
+			throw std::invalid_argument("[function factorize_fully_connected]: Rank out of range");
+
+		const Matrix xdata = x, ydata = y;
+		res.loss_before = net.loss(xdata, ydata);
+
+		Eigen::BDCSVD<Matrix> svd(internal::dense_weights(dense), Eigen::ComputeThinU | Eigen::ComputeThinV);
+		const Vector s = svd.singularValues();
+		res.energy = s.head(rank).squaredNorm() / s.squaredNorm();
+
+		const Vector root = s.head(rank).cwiseSqrt();
+		const Matrix w1 = svd.matrixU().leftCols(rank) * root.asDiagonal();
+		const Matrix w2 = root.asDiagonal() * svd.matrixV().leftCols(rank).transpose();
+		const std::vector<Scalar> param = dense.get_parameters();
+		const Vector zero = Vector::Zero(rank);
+		Layer* first = internal::create_fully_connected(in, rank, internal::IDENTITY, w1.data(), zero.data());
+		Layer* second = internal::create_fully_connected(rank, out, internal::activation_id(dense.activataion_type()),
+														 w2.data(), param.data() + std::size_t(in) * out);
+
+		Matrix xt(in, batch_size), h, z;
+		RNG rng(1);
+		internal::set_normal_random(xt.data(), xt.size(), rng);
+		res.dense_seconds = internal::predict_seconds(dense, xt, 5);
+		first->predict(xt, z, h);
+		res.factored_seconds = internal::predict_seconds(*first, xt, 5) + internal::predict_seconds(*second, h, 5);
+
+		net.replace_layer(layer, second);
+		net.insert_layer(layer, first);
+		res.loss_factored = net.loss(xdata, ydata);
+
+		if (opt != NULL && epoch > 0)
+		{
+			net.fit(*opt, xdata, ydata, batch_size, epoch);
+			res.loss_tuned = net.loss(xdata, ydata);
+		}
+		else
+		{
+			res.loss_tuned = res.loss_factored;
+		}
+
+		return res;
+	}
+
+	///
+	/// Print one line per factored layer: rank, kept energy, timings and losses
+	///
+	inline void low_rank_summary(std::ostream& os, const std::vector<LowRankReport>& reports)
+	{
+		const std::ios_base::fmtflags flags = os.flags();
+		const std::streamsize precision = os.precision();
+
+		os << "Layer  Rank       Energy  Dense us  Factored us  Speedup  Loss before  Loss factored  Loss tuned\n";
+		for (std::size_t i = 0; i < reports.size(); i++)
+		{
+			const LowRankReport& r = reports[i];
+			os << std::left << std::setw(7) << r.layer
+			   << std::setw(11) << (internal::to_string(r.rank) + "/" + internal::to_string(r.full_rank))
+			   << std::right << std::fixed << std::setprecision(4)
+			   << std::setw(6) << r.energy << "  "
+			   << std::setprecision(1)
+			   << std::setw(8) << 1e6 * r.dense_seconds << "  "
+			   << std::setw(11) << 1e6 * r.factored_seconds << "  "
+			   << std::setprecision(2)
+			   << std::setw(7) << r.dense_seconds / r.factored_seconds << "  "
+			   << std::setprecision(6)
+			   << std::setw(11) << r.loss_before << "  "
+			   << std::setw(13) << r.loss_factored << "  "
+			   << std::setw(10) << r.loss_tuned << "\n";
+		}
+
+		os.flags(flags);
+		os.precision(precision);
+	}
+}
\ No newline at end of file
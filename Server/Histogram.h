@@ -0,0 +1,93 @@
+#pragma once
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+namespace MiniDNN
+{
+
+    namespace server
+    {
+
+
+        ///
+        /// Log-linear histogram of latencies in microseconds
+        ///
+        /// Each power of two is split into four buckets, so quantiles are accurate
+        /// to within 19%.
+        ///
+        class LatencyHistogram
+        {
+        private:
+            static const int SubBuckets = 4;
+            static const int MaxExponent = 32;
+
+            std::vector<long> m_count;
+            long m_total;
+
+            static int bucket(const double us)
+            {
+                if (us < 1)
+                    return 0;
+
+                int e;
+                const double m = std::frexp(us, &e);  // us = m * 2^e, 0.5 <= m < 1
+                const int sub = int((2 * m - 1) * SubBuckets);
+                return std::min(1 + (e - 1) * SubBuckets + sub, int(MaxExponent * SubBuckets));
+            }
+
+            // Upper bound of a bucket
+            static double bucket_limit(const int k)
+            {
+                if (k == 0)
+                    return 1;
+
+                const int e = (k - 1) / SubBuckets;
+                const int sub = (k - 1) % SubBuckets;
+                return std::ldexp(1 + double(sub + 1) / SubBuckets, e);
+            }
+
+        public:
+            LatencyHistogram() : m_count(MaxExponent * SubBuckets + 1, 0), m_total(0) {}
+
+            void add(const double us)
+            {
+                m_count[bucket(us)]++;
+                m_total++;
+            }
+
+            long count() const { return m_total; }
+
+            void merge(const LatencyHistogram& other)
+            {
+                for (std::size_t k = 0; k < m_count.size(); k++)
+                {
+                    m_count[k] += other.m_count[k];
+                }
+                m_total += other.m_total;
+            }
+
+            // Quantile 'q' in [0, 1], in microseconds
+            double quantile(const double q) const
+            {
+                if (m_total == 0)
+                    return 0;
+
+                const long rank = std::max(1L, long(std::ceil(q * m_total)));
+                long acc = 0;
+                for (std::size_t k = 0; k < m_count.size(); k++)
+                {
+                    acc += m_count[k];
+                    if (acc >= rank)
+                        return bucket_limit(k);
+                }
+
+                return bucket_limit(m_count.size() - 1);
+            }
+        };
+
+
+    } // namespace server
+
+} // namespace MiniDNN
\ No newline at end of file
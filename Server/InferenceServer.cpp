@@ -0,0 +1,126 @@
+// Micro-batching inference server over a Unix domain socket
+//
+// Build (POSIX only, header-only library):
+//     g++ -O2 -std=c++14 -pthread -I<eigen> -I.. InferenceServer.cpp -o inference_server
+//
+// Usage:
+//     inference_server <model_folder> <model_name> <socket_path> [max_batch=32] [max_delay_us=2000]
+//
+// The model is read with Network::read_net(). Statistics are printed on SIGINT/SIGTERM
+// and can be queried at any time with an empty request (see Protocol.h).
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <cstdlib>
+#include <csignal>
+#include <exception>
+#include <poll.h>
+#include "../MiniDNN.h"
+#include "Protocol.h"
+#include "MicroBatcher.h"
+
+using namespace MiniDNN;
+
+static std::atomic<bool> g_stop(false);
+
+static void handle_signal(int) { g_stop = true; }
+
+static void serve_client(const int fd, server::MicroBatcher& batcher)
+{
+	std::vector<Scalar> input, output;
+
+	// An error only drops this client, the other connections keep being served
+	try
+	{
+		while (server::read_frame(fd, input, batcher.in_size()))
+		{
+			if (input.empty())
+			{
+				if (!server::write_text_frame(fd, batcher.stats()))
+					break;
+				continue;
+			}
+
+			if (int(input.size()) != batcher.in_size())
+			{
+				std::cerr << "Dropping client: expected " << batcher.in_size()
+						  << " values, got " << input.size() << std::endl;
+				break;
+			}
+
+			batcher.predict(input, output);
+			if (!server::write_frame(fd, output.data(), output.size()))
+				break;
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << "Dropping client: " << e.what() << std::endl;
+	}
+	catch (...)
+	{
+		std::cerr << "Dropping client: unknown error" << std::endl;
+	}
+
+	::close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+	if (argc < 4)
+	{
+		std::cerr << "Usage: " << argv[0]
+				  << " <model_folder> <model_name> <socket_path> [max_batch=32] [max_delay_us=2000]" << std::endl;
+		return 1;
+	}
+
+	const std::string socket_path = argv[3];
+	const int max_batch = argc > 4 ? std::atoi(argv[4]) : 32;
+	const int max_delay_us = argc > 5 ? std::atoi(argv[5]) : 2000;
+
+	Network net;
+	net.read_net(argv[1], argv[2]);
+	if (net.num_layers() <= 0)
+	{
+		std::cerr << "The model has no layers" << std::endl;
+		return 1;
+	}
+	const int in_size = net.get_layers()[0]->in_size();
+
+	std::signal(SIGINT, handle_signal);
+	std::signal(SIGTERM, handle_signal);
+	std::signal(SIGPIPE, SIG_IGN);
+
+	const int listen_fd = server::listen_unix(socket_path);
+	std::cout << "Serving " << net.num_layers() << "-layer model on " << socket_path
+			  << " (input size " << in_size << ", max batch " << max_batch
+			  << ", max delay " << max_delay_us << " us)" << std::endl;
+
+	{
+		server::MicroBatcher batcher(net, in_size, max_batch, max_delay_us);
+
+		// Poll so that a signal can stop the accept loop
+		while (!g_stop)
+		{
+			pollfd pfd;
+			pfd.fd = listen_fd;
+			pfd.events = POLLIN;
+			if (::poll(&pfd, 1, 200) <= 0)
+				continue;
+
+			const int fd = ::accept(listen_fd, NULL, NULL);
+			if (fd < 0)
+				continue;
+
+			std::thread(serve_client, fd, std::ref(batcher)).detach();
+		}
+
+		std::cout << batcher.stats() << std::flush;
+		::unlink(socket_path.c_str());
+		// Connections still open are abandoned at exit
+		std::_Exit(0);
+	}
+}
\ No newline at end of file
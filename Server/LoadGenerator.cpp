@@ -0,0 +1,101 @@
+// Closed-loop load generator for the inference server
+//
+// Build:
+//     g++ -O2 -std=c++14 -pthread -I<eigen> -I.. LoadGenerator.cpp -o load_generator
+//
+// Usage:
+//     load_generator <socket_path> <input_size> [clients=64] [requests_per_client=1000]
+//
+// Each client thread opens its own connection and sends one random observation at a
+// time, waiting for the answer before sending the next one. Client-side latency
+// quantiles and throughput are printed, followed by the server statistics.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <mutex>
+#include <cstdlib>
+#include "../Config.h"
+#include "../RNG.h"
+#include "Protocol.h"
+#include "Histogram.h"
+
+using namespace MiniDNN;
+
+int main(int argc, char* argv[])
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0]
+				  << " <socket_path> <input_size> [clients=64] [requests_per_client=1000]" << std::endl;
+		return 1;
+	}
+
+	const std::string socket_path = argv[1];
+	const int in_size = std::atoi(argv[2]);
+	const int nclient = argc > 3 ? std::atoi(argv[3]) : 64;
+	const int nrequest = argc > 4 ? std::atoi(argv[4]) : 1000;
+
+	// The output size of the model is not known here, this only rejects corrupt frames
+	const server::FrameSize max_output_size = 1 << 24;
+
+	typedef std::chrono::steady_clock Clock;
+	server::LatencyHistogram latency;
+	std::mutex latency_mutex;
+	long failures = 0;
+
+	const Clock::time_point start = Clock::now();
+	std::vector<std::thread> clients;
+	for (int c = 0; c < nclient; c++)
+	{
+		clients.push_back(std::thread([&, c]()
+		{
+			RNG rng(c + 1);
+			std::vector<Scalar> input(in_size), output;
+			server::LatencyHistogram local;
+			bool ok = true;
+
+			const int fd = server::connect_unix(socket_path);
+			for (int i = 0; i < nrequest && ok; i++)
+			{
+				for (int j = 0; j < in_size; j++)
+				{
+					input[j] = rng.rand();
+				}
+
+				const Clock::time_point t0 = Clock::now();
+				ok = server::write_frame(fd, input.data(), in_size) &&
+					 server::read_frame(fd, output, max_output_size);
+				local.add(std::chrono::duration<double, std::micro>(Clock::now() - t0).count());
+			}
+			::close(fd);
+
+			std::lock_guard<std::mutex> lock(latency_mutex);
+			latency.merge(local);
+			if (!ok)
+				failures++;
+		}));
+	}
+
+	for (std::size_t c = 0; c < clients.size(); c++)
+	{
+		clients[c].join();
+	}
+	const double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << "clients " << nclient << " requests " << latency.count()
+			  << " failed_clients " << failures << "\n"
+			  << "throughput_qps " << latency.count() / seconds << "\n"
+			  << "client_latency_us p50 " << latency.quantile(0.5)
+			  << " p99 " << latency.quantile(0.99) << "\n";
+
+	const int fd = server::connect_unix(socket_path);
+	std::string stats;
+	if (server::write_frame(fd, NULL, 0) && server::read_text_frame(fd, stats))
+		std::cout << "--- server ---\n" << stats;
+	::close(fd);
+
+	return 0;
+}
\ No newline at end of file
@@ -0,0 +1,215 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <deque>
+#include <string>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <exception>
+#include "../Config.h"
+#include "../Network.h"
+#include "Histogram.h"
+
+namespace MiniDNN
+{
+
+    namespace server
+    {
+
+
+        ///
+        /// Dynamic micro-batching in front of a Network
+        ///
+        /// Requests submitted from any number of threads are queued. One worker
+        /// thread collects them until either 'max_batch' requests are waiting or the
+        /// oldest one has waited 'max_delay_us', runs a single forward pass on the
+        /// batch and hands each caller its own column of the result.
+        ///
+        class MicroBatcher
+        {
+        private:
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef std::chrono::steady_clock Clock;
+
+            struct Request
+            {
+                const std::vector<Scalar>* input;
+                std::vector<Scalar>* output;
+                Clock::time_point arrival;
+                bool done;
+                // Error of the forward pass of the batch, rethrown to the caller
+                std::exception_ptr error;
+            };
+
+            Network& m_net;
+            const int m_in_size;
+            const int m_max_batch;
+            const std::chrono::microseconds m_max_delay;
+
+            std::mutex m_mutex;
+            std::condition_variable m_queue_cv;
+            std::condition_variable m_done_cv;
+            std::deque<Request*> m_queue;
+            bool m_stop;
+
+            LatencyHistogram m_latency;
+            LatencyHistogram m_queue_wait;
+            std::vector<long> m_batch_count;
+
+            std::thread m_worker;
+
+            void run()
+            {
+                std::vector<Request*> batch;
+                Matrix x;
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                while (true)
+                {
+                    m_queue_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                    if (m_queue.empty())
+                        break;
+
+                    // Wait for more requests until the batch is full or the oldest one is due
+                    const Clock::time_point deadline = m_queue.front()->arrival + m_max_delay;
+                    while (!m_stop && int(m_queue.size()) < m_max_batch)
+                    {
+                        if (m_queue_cv.wait_until(lock, deadline) == std::cv_status::timeout)
+                            break;
+                    }
+
+                    const int n = std::min(int(m_queue.size()), m_max_batch);
+                    batch.assign(m_queue.begin(), m_queue.begin() + n);
+                    m_queue.erase(m_queue.begin(), m_queue.begin() + n);
+                    const Clock::time_point start = Clock::now();
+                    lock.unlock();
+
+                    // An error fails the requests of this batch, and the worker goes on
+                    std::exception_ptr error;
+                    try
+                    {
+                        x.resize(m_in_size, n);
+                        for (int i = 0; i < n; i++)
+                        {
+                            std::copy(batch[i]->input->begin(), batch[i]->input->end(), x.col(i).data());
+                        }
+
+                        const Matrix& y = m_net.predict(x);
+                        for (int i = 0; i < n; i++)
+                        {
+                            batch[i]->output->assign(y.col(i).data(), y.col(i).data() + y.rows());
+                        }
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+
+                    lock.lock();
+                    const Clock::time_point end = Clock::now();
+                    for (int i = 0; i < n; i++)
+                    {
+                        batch[i]->done = true;
+                        batch[i]->error = error;
+                        m_latency.add(std::chrono::duration<double, std::micro>(end - batch[i]->arrival).count());
+                        m_queue_wait.add(std::chrono::duration<double, std::micro>(start - batch[i]->arrival).count());
+                    }
+                    m_batch_count[n]++;
+                    m_done_cv.notify_all();
+                }
+            }
+
+        public:
+            MicroBatcher(Network& net, const int in_size, const int max_batch, const int max_delay_us) :
+                m_net(net), m_in_size(in_size), m_max_batch(max_batch),
+                m_max_delay(max_delay_us), m_stop(false),
+                m_batch_count(max_batch + 1, 0)
+            {
+                if (max_batch < 1)
+                    throw std::invalid_argument("[class MicroBatcher]: Maximum batch size must be positive");
+
+                m_worker = std::thread(&MicroBatcher::run, this);
+            }
+
+            ~MicroBatcher()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_queue_cv.notify_all();
+                m_worker.join();
+            }
+
+            int in_size() const { return m_in_size; }
+
+            // Run one observation through the network. Blocks until its batch is done,
+            // and rethrows the error of the forward pass of the batch if any
+            void predict(const std::vector<Scalar>& input, std::vector<Scalar>& output)
+            {
+                if (int(input.size()) != m_in_size)
+                    throw std::invalid_argument("[class MicroBatcher]: Input data have incorrect dimension");
+
+                Request req;
+                req.input = &input;
+                req.output = &output;
+                req.arrival = Clock::now();
+                req.done = false;
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                if (m_stop)
+                    throw std::runtime_error("[class MicroBatcher]: Batcher is stopped");
+
+                m_queue.push_back(&req);
+                if (int(m_queue.size()) == 1 || int(m_queue.size()) >= m_max_batch)
+                    m_queue_cv.notify_one();
+
+                m_done_cv.wait(lock, [&req] { return req.done; });
+                if (req.error)
+                    std::rethrow_exception(req.error);
+            }
+
+            // Latency quantiles and the batch size histogram, as text
+            std::string stats()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                std::ostringstream os;
+                os << std::fixed << std::setprecision(1);
+                os << "requests " << m_latency.count() << "\n";
+                os << "latency_us p50 " << m_latency.quantile(0.5)
+                   << " p99 " << m_latency.quantile(0.99)
+                   << " p999 " << m_latency.quantile(0.999) << "\n";
+                os << "queue_wait_us p50 " << m_queue_wait.quantile(0.5)
+                   << " p99 " << m_queue_wait.quantile(0.99) << "\n";
+
+                long batches = 0, observations = 0;
+                for (int i = 1; i <= m_max_batch; i++)
+                {
+                    batches += m_batch_count[i];
+                    observations += long(i) * m_batch_count[i];
+                }
+                os << "batches " << batches << " mean_batch_size "
+                   << (batches > 0 ? double(observations) / batches : 0.0) << "\n";
+
+                os << "batch_size_histogram";
+                for (int i = 1; i <= m_max_batch; i++)
+                {
+                    if (m_batch_count[i] > 0)
+                        os << " " << i << ":" << m_batch_count[i];
+                }
+                os << "\n";
+
+                return os.str();
+            }
+        };
+
+
+    } // namespace server
+
+} // namespace MiniDNN
\ No newline at end of file
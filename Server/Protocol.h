@@ -0,0 +1,155 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+    namespace server
+    {
+
+
+        // Wire format over the Unix domain socket, in native byte order:
+        //
+        //   request:  uint32 n, followed by n Scalar values (one observation)
+        //   response: uint32 n, followed by n Scalar values (the prediction)
+        //
+        // A request with n == 0 asks for the server statistics. The response then
+        // carries n bytes of text instead of Scalar values.
+        //
+        typedef unsigned int FrameSize;
+
+        // Read exactly 'len' bytes. Returns false on end of stream
+        inline bool read_full(const int fd, void* buf, std::size_t len)
+        {
+            char* p = static_cast<char*>(buf);
+            while (len > 0)
+            {
+                const ssize_t r = ::read(fd, p, len);
+                if (r == 0)
+                    return false;
+                if (r < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                p += r;
+                len -= r;
+            }
+
+            return true;
+        }
+
+        inline bool write_full(const int fd, const void* buf, std::size_t len)
+        {
+            const char* p = static_cast<const char*>(buf);
+            while (len > 0)
+            {
+                const ssize_t r = ::write(fd, p, len);
+                if (r < 0)
+                {
+                    if (errno == EINTR)
+                        continue;
+                    return false;
+                }
+                p += r;
+                len -= r;
+            }
+
+            return true;
+        }
+
+        // Read a frame of at most 'max_size' values. Returns false on end of stream,
+        // or if the peer announces a larger frame, which is not read
+        inline bool read_frame(const int fd, std::vector<Scalar>& data, const FrameSize max_size)
+        {
+            FrameSize n;
+            if (!read_full(fd, &n, sizeof(n)) || n > max_size)
+                return false;
+
+            data.resize(n);
+            return n == 0 || read_full(fd, &data[0], n * sizeof(Scalar));
+        }
+
+        inline bool write_frame(const int fd, const Scalar* data, const FrameSize n)
+        {
+            return write_full(fd, &n, sizeof(n)) && (n == 0 || write_full(fd, data, n * sizeof(Scalar)));
+        }
+
+        inline bool write_text_frame(const int fd, const std::string& text)
+        {
+            const FrameSize n = text.size();
+            return write_full(fd, &n, sizeof(n)) && (n == 0 || write_full(fd, text.data(), n));
+        }
+
+        inline bool read_text_frame(const int fd, std::string& text)
+        {
+            FrameSize n;
+            if (!read_full(fd, &n, sizeof(n)))
+                return false;
+
+            text.resize(n);
+            return n == 0 || read_full(fd, &text[0], n);
+        }
+
+        inline sockaddr_un socket_address(const std::string& path)
+        {
+            sockaddr_un addr;
+            std::memset(&addr, 0, sizeof(addr));
+            addr.sun_family = AF_UNIX;
+            if (path.size() >= sizeof(addr.sun_path))
+                throw std::invalid_argument("[function socket_address]: Socket path is too long");
+
+            std::strcpy(addr.sun_path, path.c_str());
+            return addr;
+        }
+
+        // Create a listening socket bound to 'path', replacing a stale socket file
+        inline int listen_unix(const std::string& path, const int backlog = 128)
+        {
+            const sockaddr_un addr = socket_address(path);
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0)
+                throw std::runtime_error("[function listen_unix]: Cannot create socket");
+
+            ::unlink(path.c_str());
+            if (::bind(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0 ||
+                ::listen(fd, backlog) < 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("[function listen_unix]: Cannot listen on " + path);
+            }
+
+            return fd;
+        }
+
+        inline int connect_unix(const std::string& path)
+        {
+            const sockaddr_un addr = socket_address(path);
+            const int fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+            if (fd < 0)
+                throw std::runtime_error("[function connect_unix]: Cannot create socket");
+
+            if (::connect(fd, reinterpret_cast<const sockaddr*>(&addr), sizeof(addr)) < 0)
+            {
+                ::close(fd);
+                throw std::runtime_error("[function connect_unix]: Cannot connect to " + path);
+            }
+
+            return fd;
+        }
+
+
+    } // namespace server
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <map>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <stdexcept>
+#include "Config.h"
+#include "Utils/IO.h"
+#include "Utils/Enum.h"
+
+namespace MiniDNN
+{
+	///
+	/// Fully connected layer with sizes fixed at compile time, for use in StaticNet
+	///
+	/// Parameters use the same layout as FullyConnected: the column-major
+	/// 'InSize x OutSize' weight matrix followed by the bias.
+	///
+	template <int InSize, int OutSize, typename Activation>
+	class FC
+	{
+	public:
+		static const int in_size = InSize;
+		static const int out_size = OutSize;
+
+		typedef Eigen::Matrix<Scalar, InSize, 1> Input;
+		typedef Eigen::Matrix<Scalar, OutSize, 1> Output;
+
+	private:
+		typedef Eigen::Matrix<Scalar, InSize, OutSize> Weight;
+
+		Weight m_weight;
+		Output m_bias;
+
+	public:
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		FC() : m_weight(Weight::Zero()), m_bias(Output::Zero()) {}
+
+		void predict(const Input& x, Output& a) const
+		{
+			Output z;
+			z.noalias() = m_weight.transpose().lazyProduct(x);
+			z += m_bias;
+			Activation::activate(z, a);
+		}
+
+		std::vector<Scalar> get_parameters() const
+		{
+			std::vector<Scalar> res(m_weight.size() + m_bias.size());
+
+			std::copy(m_weight.data(), m_weight.data() + m_weight.size(), res.begin());
+			std::copy(m_bias.data(), m_bias.data() + m_bias.size(), res.begin() + m_weight.size());
+
+			return res;
+		}
+
+		void set_parameters(const std::vector<Scalar>& param)
+		{
+			if (static_cast<int>(param.size()) != m_weight.size() + m_bias.size())
+			{
+				throw std::invalid_argument("[Class FC]: Parameter size does not match");
+			}
+
+			std::copy(param.begin(), param.begin() + m_weight.size(), m_weight.data());
+			std::copy(param.begin() + m_weight.size(), param.end(), m_bias.data());
+		}
+
+		// Check that the meta information of layer 'index' describes this layer
+		void check_meta_info(const std::map<std::string, int>& map, int index) const
+		{
+			const std::string ind = internal::to_string(index);
+			std::map<std::string, int>::const_iterator layer = map.find("Layer" + ind),
+				act = map.find("Activation" + ind), in = map.find("in_size" + ind), out = map.find("out_size" + ind);
+
+			if (layer == map.end() || act == map.end() || in == map.end() || out == map.end() ||
+				layer->second != internal::FULLY_CONNECTED ||
+				act->second != internal::activation_id(Activation::return_type()) ||
+				in->second != InSize || out->second != OutSize)
+			{
+				throw std::invalid_argument("[Class FC]: Layer " + ind + " of the model does not match the static network");
+			}
+		}
+	};
+
+	///
+	/// A sequential network whose layer types and sizes are fixed at compile time
+	///
+	/// For example StaticNet< FC<16, 32, ReLU>, FC<32, 8, Softmax> >. All buffers are
+	/// fixed-size Eigen objects on the stack, so predicting one observation does not
+	/// allocate, and predict() is const and can be called from several threads.
+	///
+	template <typename... Layers>
+	class StaticNet
+	{
+	private:
+		typedef std::tuple<Layers...> LayerTuple;
+		static const int NLayers = sizeof...(Layers);
+
+		template <int I>
+		struct LayerAt
+		{
+			typedef typename std::tuple_element<I, LayerTuple>::type type;
+		};
+
+		// Compile-time check of consecutive layer sizes
+		template <int I, bool Last = (I + 1 >= NLayers)>
+		struct SizesMatch
+		{
+			static const bool value = (int(LayerAt<I>::type::out_size) == int(LayerAt<I + 1>::type::in_size)) &&
+									  SizesMatch<I + 1>::value;
+		};
+
+		template <int I>
+		struct SizesMatch<I, true>
+		{
+			static const bool value = true;
+		};
+
+		static_assert(NLayers > 0, "StaticNet needs at least one layer");
+		static_assert(SizesMatch<0>::value, "StaticNet: unit sizes of consecutive layers do not match");
+
+		LayerTuple m_layers;
+
+		template <int I>
+		void run(const typename LayerAt<I>::type::Input& x, typename LayerAt<NLayers - 1>::type::Output& y,
+				 std::true_type) const
+		{
+			std::get<I>(m_layers).predict(x, y);
+		}
+
+		template <int I>
+		void run(const typename LayerAt<I>::type::Input& x, typename LayerAt<NLayers - 1>::type::Output& y,
+				 std::false_type) const
+		{
+			typename LayerAt<I>::type::Output a;
+			std::get<I>(m_layers).predict(x, a);
+			run<I + 1>(a, y, std::integral_constant<bool, I + 2 == NLayers>());
+		}
+
+		template <int I>
+		void set_layer_parameters(const std::vector< std::vector<Scalar> >& param, std::true_type) {}
+
+		template <int I>
+		void set_layer_parameters(const std::vector< std::vector<Scalar> >& param, std::false_type)
+		{
+			std::get<I>(m_layers).set_parameters(param[I]);
+			set_layer_parameters<I + 1>(param, std::integral_constant<bool, I + 1 == NLayers>());
+		}
+
+		template <int I>
+		void check_layers(const std::map<std::string, int>& map, std::true_type) const {}
+
+		template <int I>
+		void check_layers(const std::map<std::string, int>& map, std::false_type) const
+		{
+			std::get<I>(m_layers).check_meta_info(map, I);
+			check_layers<I + 1>(map, std::integral_constant<bool, I + 1 == NLayers>());
+		}
+
+	public:
+		typedef typename LayerAt<0>::type::Input Input;
+		typedef typename LayerAt<NLayers - 1>::type::Output Output;
+
+		EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+		int num_layers() const { return NLayers; }
+
+		void predict(const Input& x, Output& y) const
+		{
+			run<0>(x, y, std::integral_constant<bool, NLayers == 1>());
+		}
+
+		Output predict(const Input& x) const
+		{
+			Output y;
+			predict(x, y);
+			return y;
+		}
+
+		// Parameters of each layer, in the format of Network::get_parameters()
+		void set_parameters(const std::vector< std::vector<Scalar> >& param)
+		{
+			if (static_cast<int>(param.size()) != NLayers)
+				throw std::invalid_argument("[class StaticNet]: Parameter size does not match");
+
+			set_layer_parameters<0>(param, std::false_type());
+		}
+
+		///
+		/// Read a model written by Network::export_net(), checking that its layers
+		/// match the static layer types
+		///
+		void read_net(const std::string& folder, const std::string& filename)
+		{
+			std::map<std::string, int> map;
+			internal::read_map(folder + "/" + filename, map);
+
+			std::map<std::string, int>::const_iterator nlayer = map.find("Nlayers");
+			if (nlayer == map.end() || nlayer->second != NLayers)
+				throw std::invalid_argument("[class StaticNet]: Number of layers does not match");
+
+			check_layers<0>(map, std::false_type());
+			set_parameters(internal::read_parameters(folder, filename, NLayers));
+		}
+	};
+}
\ No newline at end of file
@@ -0,0 +1,48 @@
+// Ahead-of-time source generator for trained networks
+//
+// Build:
+//     g++ -O2 -std=c++11 -pthread -I<eigen> -I.. GenerateSource.cpp -o generate_source
+//
+// Usage:
+//     generate_source <model_folder> <model_file> <namespace> <output.cpp>
+//
+// Reads a model written by Network::export_net() and writes a standalone C++ source
+// file computing its prediction, see MiniDNN::generate_source(). The generated file
+// has no dependency besides the standard library and reads no file at run time.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include "../MiniDNN.h"
+
+using namespace MiniDNN;
+
+int main(int argc, char* argv[])
+{
+	if (argc < 5)
+	{
+		std::cerr << "Usage: " << argv[0] << " <model_folder> <model_file> <namespace> <output.cpp>" << std::endl;
+		return 1;
+	}
+
+	try
+	{
+		std::map<std::string, int> map;
+		internal::read_map(std::string(argv[1]) + "/" + argv[2], map);
+		const int nlayer = internal::meta_value(map, "Nlayers");
+		const std::vector< std::vector<Scalar> > param = internal::read_parameters(argv[1], argv[2], nlayer);
+
+		std::ofstream out(argv[4]);
+		if (!out)
+			throw std::runtime_error(std::string("Cannot open ") + argv[4]);
+		generate_source(map, param, argv[3], out);
+	}
+	catch (const std::exception& e)
+	{
+		std::cerr << e.what() << std::endl;
+		return 1;
+	}
+
+	return 0;
+}
\ No newline at end of file
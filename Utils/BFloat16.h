@@ -0,0 +1,140 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include "../Config.h"
+#include "Compress.h"
+#include "ThreadPool.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        ///
+        /// A column-major matrix stored in bfloat16
+        ///
+        /// Layers keep one as a read-only copy of their full precision weights. The
+        /// products below convert it to float one cache-sized block at a time, so
+        /// the weights are read from memory at a quarter of the size of Scalar.
+        ///
+        class BFloat16Matrix
+        {
+        private:
+            int m_rows;
+            int m_cols;
+            std::vector<unsigned short> m_data;
+
+        public:
+            BFloat16Matrix() :
+                m_rows(0), m_cols(0)
+            {}
+
+            bool empty() const { return m_data.empty(); }
+
+            int rows() const { return m_rows; }
+
+            int cols() const { return m_cols; }
+
+            std::size_t bytes() const { return m_data.size() * sizeof(unsigned short); }
+
+            void assign(const Scalar* src, const int rows, const int cols)
+            {
+                m_rows = rows;
+                m_cols = cols;
+                const std::size_t n = std::size_t(rows) * cols;
+                m_data.resize(n);
+                for (std::size_t i = 0; i < n; i++)
+                {
+                    m_data[i] = float_to_bfloat16(float(src[i]));
+                }
+            }
+
+            void clear()
+            {
+                m_rows = m_cols = 0;
+                std::vector<unsigned short>().swap(m_data);
+            }
+
+            // Rows [row, row + nrow) of columns [col, col + ncol), as a column-major float matrix
+            void block_to_float(const int row, const int nrow, const int col, const int ncol, float* dest) const
+            {
+                for (int j = 0; j < ncol; j++, dest += nrow)
+                {
+                    const unsigned short* src = &m_data[std::size_t(col + j) * m_rows + row];
+                    for (int i = 0; i < nrow; i++)
+                    {
+                        dest[i] = bfloat16_to_float(src[i]);
+                    }
+                }
+            }
+        };
+
+        // Number of float elements of a converted block, which stays in the L2 cache
+        const int bfloat16_block_elements = 1 << 16;
+
+        ///
+        /// res = W' * x, with W in bfloat16 and accumulation in float
+        ///
+        /// Tasks work on blocks of columns of W, which are contiguous, and produce
+        /// the corresponding rows of the result.
+        ///
+        inline void bfloat16_product_transpose(
+            const BFloat16Matrix& w,
+            const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>& x,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res)
+        {
+            typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> FloatMatrix;
+
+            const int in = w.rows();
+            const int out = w.cols();
+            const int block = std::min(out, std::max(16, bfloat16_block_elements / std::max(in, 1)));
+            const int nblock = (out + block - 1) / block;
+            res.resize(out, x.cols());
+
+            thread_pool().parallel_for(nblock, [&](int b) {
+                const int begin = b * block;
+                const int n = std::min(block, out - begin);
+                FloatMatrix wblock(in, n);
+                w.block_to_float(0, in, begin, n, wblock.data());
+                const FloatMatrix r = wblock.transpose() * x;
+                res.middleRows(begin, n) = r.cast<Scalar>();
+            });
+        }
+
+        ///
+        /// res = W * g, with W in bfloat16 and accumulation in float
+        ///
+        /// Tasks work on blocks of rows of W, so that each one reads a disjoint part
+        /// of W and produces the corresponding rows of the result.
+        ///
+        inline void bfloat16_product(
+            const BFloat16Matrix& w,
+            const Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic>& g,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res)
+        {
+            typedef Eigen::Matrix<float, Eigen::Dynamic, Eigen::Dynamic> FloatMatrix;
+
+            const int in = w.rows();
+            const int out = w.cols();
+            const int block = std::min(in, std::max(16, bfloat16_block_elements / std::max(out, 1)));
+            const int nblock = (in + block - 1) / block;
+            res.resize(in, g.cols());
+
+            thread_pool().parallel_for(nblock, [&](int b) {
+                const int begin = b * block;
+                const int n = std::min(block, in - begin);
+                FloatMatrix wblock(n, out);
+                w.block_to_float(begin, n, 0, out, wblock.data());
+                const FloatMatrix r = wblock * g;
+                res.middleRows(begin, n) = r.cast<Scalar>();
+            });
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
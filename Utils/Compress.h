@@ -0,0 +1,272 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <cstring>
+#include <cmath>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+    class ReLU;
+    class Mish;
+
+    namespace internal
+    {
+
+
+        // Storage precision of the state that layers keep for backprop()
+        enum STORAGE_ENUM
+        {
+            FULL_PRECISION = 0,
+            HALF,
+            BFLOAT16
+        };
+
+        // What apply_jacobian() of an activation reads from its saved state.
+        // By default only A is used
+        template <typename Activation>
+        struct JacobianInputs
+        {
+            static const bool needs_z = false;
+            static const bool sign_only = false;
+        };
+
+        // ReLU only tests A > 0
+        template <>
+        struct JacobianInputs<ReLU>
+        {
+            static const bool needs_z = false;
+            static const bool sign_only = true;
+        };
+
+        template <>
+        struct JacobianInputs<Mish>
+        {
+            static const bool needs_z = true;
+            static const bool sign_only = false;
+        };
+
+        // IEEE 754 binary16, round to nearest even
+        inline unsigned short float_to_half(const float f)
+        {
+            unsigned int x;
+            std::memcpy(&x, &f, sizeof(x));
+            const unsigned short sign = (x >> 16) & 0x8000;
+            const unsigned int absx = x & 0x7FFFFFFF;
+
+            // Inf and NaN
+            if (absx >= 0x7F800000)
+                return sign | 0x7C00 | (absx > 0x7F800000 ? 0x0200 : 0);
+            // Values that round to infinity (>= 65520)
+            if (absx >= 0x477FF000)
+                return sign | 0x7C00;
+            // Subnormal results are multiples of 2^-24
+            if (absx < 0x38800000)
+            {
+                float a;
+                std::memcpy(&a, &absx, sizeof(a));
+                return sign | static_cast<unsigned short>(std::nearbyint(a * 16777216.0f));
+            }
+
+            const unsigned int rounded = absx + 0x0FFF + ((absx >> 13) & 1);
+            return sign | static_cast<unsigned short>((rounded - 0x38000000) >> 13);
+        }
+
+        inline float half_to_float(const unsigned short h)
+        {
+            const unsigned int sign = static_cast<unsigned int>(h & 0x8000) << 16;
+            const unsigned int exponent = (h >> 10) & 0x1F;
+            const unsigned int mantissa = h & 0x03FF;
+            unsigned int x;
+
+            if (exponent == 0)
+            {
+                const float a = float(mantissa) / 16777216.0f;
+                std::memcpy(&x, &a, sizeof(x));
+                x |= sign;
+            }
+            else if (exponent == 0x1F)
+            {
+                x = sign | 0x7F800000 | (mantissa << 13);
+            }
+            else
+            {
+                x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+            }
+
+            float f;
+            std::memcpy(&f, &x, sizeof(f));
+            return f;
+        }
+
+        // Upper half of an IEEE 754 binary32, round to nearest even
+        inline unsigned short float_to_bfloat16(const float f)
+        {
+            unsigned int x;
+            std::memcpy(&x, &f, sizeof(x));
+
+            // Keep NaN a (quiet) NaN
+            if ((x & 0x7FFFFFFF) > 0x7F800000)
+                return static_cast<unsigned short>((x >> 16) | 0x0040);
+
+            x += 0x7FFF + ((x >> 16) & 1);
+            return static_cast<unsigned short>(x >> 16);
+        }
+
+        inline float bfloat16_to_float(const unsigned short h)
+        {
+            const unsigned int x = static_cast<unsigned int>(h) << 16;
+            float f;
+            std::memcpy(&f, &x, sizeof(f));
+            return f;
+        }
+
+        ///
+        /// A matrix kept in compressed form between forward() and backprop()
+        ///
+        /// Either a bit mask of the positive entries, or a 16-bit floating point copy.
+        ///
+        class CompressedMatrix
+        {
+        private:
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef unsigned long long Word;
+
+            int m_rows;
+            int m_cols;
+            int m_storage;
+            bool m_sign_only;
+
+            std::vector<Word> m_mask;
+            std::vector<unsigned short> m_data;
+
+        public:
+            CompressedMatrix() :
+                m_rows(0), m_cols(0), m_storage(FULL_PRECISION), m_sign_only(false)
+            {}
+
+            bool empty() const { return m_rows == 0 && m_cols == 0; }
+
+            // Compress 'mat' and free its memory
+            void compress(Matrix& mat, const int storage, const bool sign_only)
+            {
+                m_rows = mat.rows();
+                m_cols = mat.cols();
+                m_storage = storage;
+                m_sign_only = sign_only;
+
+                const int n = mat.size();
+                const Scalar* src = mat.data();
+
+                if (sign_only)
+                {
+                    const int bits = sizeof(Word) * 8;
+                    m_mask.assign((n + bits - 1) / bits, Word(0));
+                    for (int i = 0; i < n; i++)
+                    {
+                        m_mask[i / bits] |= Word(src[i] > Scalar(0)) << (i % bits);
+                    }
+                }
+                else
+                {
+                    m_data.resize(n);
+                    for (int i = 0; i < n; i++)
+                    {
+                        m_data[i] = (storage == HALF) ? float_to_half(float(src[i])) :
+                                                        float_to_bfloat16(float(src[i]));
+                    }
+                }
+
+                mat.resize(0, 0);
+            }
+
+            // Restore the matrix. A sign mask is restored as 1 for positive entries and 0 otherwise
+            void decompress(Matrix& mat)
+            {
+                mat.resize(m_rows, m_cols);
+                const int n = mat.size();
+                Scalar* dest = mat.data();
+
+                if (m_sign_only)
+                {
+                    const int bits = sizeof(Word) * 8;
+                    for (int i = 0; i < n; i++)
+                    {
+                        dest[i] = Scalar((m_mask[i / bits] >> (i % bits)) & 1);
+                    }
+                }
+                else
+                {
+                    for (int i = 0; i < n; i++)
+                    {
+                        dest[i] = (m_storage == HALF) ? half_to_float(m_data[i]) :
+                                                        bfloat16_to_float(m_data[i]);
+                    }
+                }
+
+                clear();
+            }
+
+            void clear()
+            {
+                m_rows = m_cols = 0;
+                std::vector<Word>().swap(m_mask);
+                std::vector<unsigned short>().swap(m_data);
+            }
+
+            std::size_t bytes() const
+            {
+                return m_mask.size() * sizeof(Word) + m_data.size() * sizeof(unsigned short);
+            }
+        };
+
+        ///
+        /// Compress the saved state of a layer, its linear term 'z' and its
+        /// activation 'a', after forward()
+        ///
+        /// Unless the Jacobian reads it, 'z' is only used as scratch space for dLz
+        /// and is freed instead. When the Jacobian only needs the sign of 'a', a bit
+        /// mask is kept, unless the next layer reads the output of the layer, which
+        /// 'keep_output' tells.
+        ///
+        template <typename Activation>
+        void compress_layer_state(
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& z,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& a,
+            CompressedMatrix& z_saved, CompressedMatrix& a_saved,
+            const int storage, const bool keep_output)
+        {
+            if (storage == FULL_PRECISION)
+                return;
+
+            typedef JacobianInputs<Activation> Inputs;
+            if (Inputs::needs_z)
+                z_saved.compress(z, storage, false);
+            else
+                z.resize(0, 0);
+
+            a_saved.compress(a, storage, Inputs::sign_only && !keep_output);
+        }
+
+        // Restore the state saved by compress_layer_state() before backprop()
+        inline void decompress_layer_state(
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& z,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& a,
+            CompressedMatrix& z_saved, CompressedMatrix& a_saved)
+        {
+            if (a_saved.empty())
+                return;
+
+            a_saved.decompress(a);
+            if (z_saved.empty())
+                z.resize(a.rows(), a.cols());
+            else
+                z_saved.decompress(z);
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -2,7 +2,10 @@
 
 #include <Eigen/Core>
 #include <vector>
+#include <cstring>
+#include <algorithm>
 #include "../Config.h"
+#include "ThreadPool.h"
 
 namespace MiniDNN
 {
@@ -149,12 +152,122 @@ namespace MiniDNN
                     row1, row2) * mat2;
             }
         }
-        // The main convolution function using the "valid" rule
-        inline void convolve_valid(
+        ///
+        /// How the convolution kernels split their work on the thread pool
+        ///
+        /// Observations are divided into 'nchunk' contiguous chunks. When there are
+        /// fewer chunks than threads, the channels of each chunk are further
+        /// divided into 'ngroup' groups. Task 't' works on chunk 't / ngroup' and
+        /// channel group 't % ngroup'. convolve_valid() splits the output channels
+        /// into blocks when there are enough of them, and otherwise the input
+        /// channels, each group accumulating into its own partial result, which are
+        /// summed up at the end. convolve_full() splits the independent output
+        /// channels.
+        ///
+        struct ConvPartition
+        {
+            int nchunk;
+            int ngroup;
+
+            // 'flops' is the total cost of the convolution. Small problems run serially
+            ConvPartition(const int n_obs, const int nchannel, const double flops, const int nthread)
+            {
+                // Below this amount of work the threading overhead dominates
+                const double min_task_flops = 1e6;
+                const int ntask = std::max(1, std::min(nthread, int(flops / min_task_flops)));
+                nchunk = std::max(1, std::min(n_obs, ntask));
+                ngroup = std::max(1, std::min(nchannel, ntask / nchunk));
+            }
+
+            int ntask() const { return nchunk * ngroup; }
+
+            // First observation of chunk 'i' out of 'n', and similarly for channels
+            static int begin(const int i, const int nchunk, const int n)
+            {
+                return int((long long)(n) * i / nchunk);
+            }
+        };
+
+        // Copy the result of a set of observations from the layout of 'res' to 'dest'
+        // See the comments in convolve_valid()
+        // 'res' may hold a block of 'res.cols() / conv_cols' output channels, starting
+        // from channel 'first_channel'
+        inline void copy_conv_result(
+            const int conv_rows, const int conv_cols, const int out_channels,
+            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res, const int n_obs,
+            Scalar* dest, const int first_channel = 0)
+        {
+            const int res_rows = res.rows();
+            const int nchannel = res.cols() / conv_cols;
+            const Scalar* res_data = res.data();
+            const std::size_t copy_bytes = sizeof(Scalar) * conv_rows;
+
+            for (int k = 0; k < n_obs; k++)
+            {
+                for (int l = 0; l < nchannel; l++)
+                {
+                    Scalar* writer = dest + (std::size_t(k) * out_channels + first_channel + l) * conv_cols * conv_rows;
+                    for (int j = 0; j < conv_cols; j++, writer += conv_rows)
+                    {
+                        const int d = j * nchannel + l;
+                        std::memcpy(writer, res_data + std::size_t(d) * res_rows + k * conv_rows, copy_bytes);
+                    }
+                }
+            }
+        }
+
+        // Total FLOPs of convolve_valid()
+        inline double convolve_valid_flops(const ConvDims& dim, const int n_obs)
+        {
+            return 2.0 * n_obs * dim.in_channels * dim.out_channels *
+                dim.conv_rows * dim.conv_cols * dim.filter_rows * dim.filter_cols;
+        }
+
+        // A 1x1 filter is a pointwise channel mixing, computed by convolve_pointwise()
+        inline bool is_pointwise(const ConvDims& dim)
+        {
+            return dim.filter_rows == 1 && dim.filter_cols == 1;
+        }
+
+        // Smallest block of output channels of convolve_valid(). Every block
+        // flattens the input again, which only pays off with enough channels
+        const int valid_block_channels = 16;
+
+        // Partition of convolve_valid(). Its groups are blocks of output channels if
+        // 'split_output' is set, and groups of input channels otherwise
+        inline ConvPartition convolve_valid_partition(const ConvDims& dim, const int n_obs, bool& split_output)
+        {
+            const int out_blocks = dim.out_channels / valid_block_channels;
+            const ConvPartition part(n_obs, std::max(dim.in_channels, out_blocks),
+                convolve_valid_flops(dim, n_obs), thread_pool().size());
+            // Output blocks need no partial sums, so they are preferred
+            split_output = part.ngroup > 1 && part.ngroup <= out_blocks;
+            return part;
+        }
+
+        // Number of scalars in the temporary 'flat_mat' and 'res' matrices
+        // allocated by convolve_valid(), summed over all tasks
+        inline double convolve_valid_workspace(const ConvDims& dim, const int n_obs)
+        {
+            if (is_pointwise(dim))
+                return 0;
+
+            bool split_output;
+            const ConvPartition part = convolve_valid_partition(dim, n_obs, split_output);
+            const double flat_rows = double(dim.conv_rows) * n_obs;
+            const double flat_cols = double(dim.filter_rows) * dim.channel_cols;
+            const double res_cols = double(dim.conv_cols) * dim.out_channels;
+            return part.ngroup * flat_rows * flat_cols + (split_output ? 1 : part.ngroup) * flat_rows * res_cols;
+        }
+
+        // Accumulate the convolution of 'n_obs' images on 'nchannel' input channels into 'res',
+        // for the 'nout' output channels starting from 'out_begin'
+        inline void convolve_valid_accumulate(
             const ConvDims& dim,
-            const Scalar* src, const bool image_outer_loop, const int n_obs,
-            const Scalar* filter_data,
-            Scalar* dest)
+            const Scalar* src, const int img_stride, const int channel_stride,
+            const int n_obs, const int nchannel,
+            const Scalar* filter_data, const int out_begin, const int nout,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res)
         {
             typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
             typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
@@ -163,216 +276,435 @@ namespace MiniDNN
             // Flat matrix
             const int flat_rows = dim.conv_rows * n_obs;
             const int flat_cols = dim.filter_rows * dim.channel_cols;
-            const int channel_size = dim.channel_rows * dim.channel_cols;
-            // Distance between two images
-            const int img_stride = image_outer_loop ? (dim.img_rows * dim.img_cols) :
-                channel_size;
-            // Distance between two channels
-            const int channel_stride = image_outer_loop ? channel_size :
-                (channel_size * n_obs);
             RMatrix flat_mat(flat_rows, flat_cols);
-            // Convolution results
-            const int& res_rows = flat_rows;
-            const int res_cols = dim.conv_cols * dim.out_channels;
-            Matrix res = Matrix::Zero(res_rows, res_cols);
             const int& step = dim.filter_rows;
             const int filter_size = dim.filter_rows * dim.filter_cols;
             const int filter_stride = filter_size * dim.out_channels;
+            filter_data += std::size_t(out_begin) * filter_size;
 
-            for (int i = 0; i < dim.in_channels;
+            for (int i = 0; i < nchannel;
                 i++, src += channel_stride, filter_data += filter_stride)
             {
                 // Flatten source image
                 flatten_mat(dim, src, img_stride, n_obs, flat_mat);
                 // Compute the convolution result
-                ConstMapMat filter(filter_data, filter_size, dim.out_channels);
+                ConstMapMat filter(filter_data, filter_size, nout);
                 moving_product(step, flat_mat, filter, res);
             }
+        }
 
-            // The layout of 'res' is very complicated
-            /*
-             * obs0_out0[0, 0] obs0_out1[0, 0] obs0_out2[0, 0] obs0_out0[0, 1] obs0_out1[0, 1] obs0_out2[0, 1] ...
-             * obs0_out0[1, 0] obs0_out1[1, 0] obs0_out2[1, 0] obs0_out0[1, 1] obs0_out1[1, 1] obs0_out2[1, 1] ...
-             * obs0_out0[2, 0] obs0_out1[2, 0] obs0_out2[2, 0] obs0_out0[2, 1] obs0_out1[2, 1] obs0_out2[2, 1] ...
-             * obs1_out0[0, 0] obs1_out1[0, 0] obs1_out2[0, 0] obs1_out0[0, 1] obs1_out1[0, 1] obs1_out2[0, 1] ...
-             * obs1_out0[1, 0] obs1_out1[1, 0] obs1_out2[1, 0] obs1_out0[1, 1] obs1_out1[1, 1] obs1_out2[1, 1] ...
-             * obs1_out0[2, 0] obs1_out1[2, 0] obs1_out2[2, 0] obs1_out0[2, 1] obs1_out1[2, 1] obs1_out2[2, 1] ...
-             * ...
-             *
-             */
-             // obs<k>_out<l> means the convolution result of the k-th image on the l-th output channel
-             // [i, j] gives the matrix indices
-             // The destination has the layout
-             /*
-              * obs0_out0[0, 0] obs0_out0[0, 1] obs0_out0[0, 2] obs0_out1[0, 0] obs0_out1[0, 1] obs0_out1[0, 2] ...
-              * obs0_out0[1, 0] obs0_out0[1, 1] obs0_out0[1, 2] obs0_out1[1, 0] obs0_out1[1, 1] obs0_out1[1, 2] ...
-              * obs0_out0[2, 0] obs0_out0[2, 1] obs0_out0[2, 2] obs0_out1[2, 0] obs0_out1[2, 1] obs0_out1[2, 2] ...
-              *
-              */
-              // which in a larger scale looks like
-              // [obs0_out0 obs0_out1 obs0_out2 obs1_out0 obs1_out1 obs1_out2 obs2_out0 ...]
-              // Copy data to destination
-              // dest[a, b] corresponds to obs<k>_out<l>[i, j]
-              // where k = b / (conv_cols * out_channels),
-              //       l = (b % (conv_cols * out_channels)) / conv_cols
-              //       i = a,
-              //       j = b % conv_cols
-              // and then obs<k>_out<l>[i, j] corresponds to res[c, d]
-              // where c = k * conv_rows + i,
-              //       d = j * out_channels + l
-            const int dest_rows = dim.conv_rows;
-            const int dest_cols = res_cols * n_obs;
-            const Scalar* res_data = res.data();
-            const std::size_t copy_bytes = sizeof(Scalar) * dest_rows;
+        // Convolution with a 1x1 filter, for 'image_outer_loop == true'
+        //
+        // Each image is a 'channel_size x in_channels' matrix, and the filters form the
+        // 'out_channels x in_channels' matrix F, so the result of the image is the
+        // 'channel_size x out_channels' matrix image * F', already in the destination
+        // layout. No flattening or workspace is needed
+        inline void convolve_pointwise(
+            const ConvDims& dim,
+            const Scalar* src, const int n_obs,
+            const Scalar* filter_data,
+            Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+            typedef Eigen::Map<Matrix> MapMat;
 
-            for (int b = 0; b < dest_cols; b++, dest += dest_rows)
-            {
-                const int k = b / res_cols;
-                const int l = (b % res_cols) / dim.conv_cols;
-                const int j = b % dim.conv_cols;
-                const int d = j * dim.out_channels + l;
-                const int res_col_head = d * res_rows;
-                std::memcpy(dest, res_data + res_col_head + k * dim.conv_rows, copy_bytes);
-            }
-        }
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            ConstMapMat filter(filter_data, dim.out_channels, dim.in_channels);
 
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), pool.size());
 
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                for (int k = ConvPartition::begin(chunk, part.nchunk, n_obs); k < obs_end; k++)
+                {
+                    ConstMapMat img(src + std::size_t(k) * channel_size * dim.in_channels,
+                        channel_size, dim.in_channels);
+                    MapMat res(dest + std::size_t(k) * channel_size * dim.out_channels,
+                        channel_size, dim.out_channels);
+                    res.noalias() = img * filter.transpose();
+                }
+            });
+        }
 
-        // The moving_product() function for the "full" rule
-        inline void moving_product(
-            const int padding, const int step,
-            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>&
-            mat1,
-            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& mat2,
-            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res
-        )
+        // The main convolution function using the "valid" rule
+        inline void convolve_valid(
+            const ConvDims& dim,
+            const Scalar* src, const bool image_outer_loop, const int n_obs,
+            const Scalar* filter_data,
+            Scalar* dest)
         {
-            const int row1 = mat1.rows();
-            const int col1 = mat1.cols();
-            const int row2 = mat2.rows();
-            const int col2 = mat2.cols();
-            int res_start_col = 0;
-            // Left padding
-            int left_end = -padding;
-            int right_end = step;
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            // Distance between two images
+            const int img_stride = image_outer_loop ? (dim.img_rows * dim.img_cols) :
+                channel_size;
+            // Distance between two channels
+            const int channel_stride = image_outer_loop ? channel_size :
+                (channel_size * n_obs);
+            const int res_cols = dim.conv_cols * dim.out_channels;
+            const int filter_stride = dim.filter_rows * dim.filter_cols * dim.out_channels;
 
-            for (; left_end < 0
-                && right_end <= col1;
-                left_end += step, right_end += step, res_start_col += col2)
+            if (is_pointwise(dim) && image_outer_loop)
             {
-                res.block(0, res_start_col, row1, col2).noalias() += mat1.leftCols(right_end) *
-                    mat2.bottomRows(right_end);
+                convolve_pointwise(dim, src, n_obs, filter_data, dest);
+                return;
             }
 
-            // Main part
-            for (; right_end <= col1;
-                left_end += step, right_end += step, res_start_col += col2)
+            ThreadPool& pool = thread_pool();
+            bool split_output;
+            const ConvPartition part = convolve_valid_partition(dim, n_obs, split_output);
+
+            // Blocks of output channels go straight to the destination
+            if (split_output)
             {
-                res.block(0, res_start_col, row1, col2).noalias() += mat1.block(0, left_end,
-                    row1, row2) * mat2;
+                pool.parallel_for(part.ntask(), [&](int t) {
+                    const int chunk = t / part.ngroup, group = t % part.ngroup;
+                    const int obs_begin = ConvPartition::begin(chunk, part.nchunk, n_obs);
+                    const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                    const int out_begin = ConvPartition::begin(group, part.ngroup, dim.out_channels);
+                    const int out_end = ConvPartition::begin(group + 1, part.ngroup, dim.out_channels);
+
+                    Matrix res = Matrix::Zero(dim.conv_rows * (obs_end - obs_begin),
+                        dim.conv_cols * (out_end - out_begin));
+                    convolve_valid_accumulate(dim, src + std::size_t(obs_begin) * img_stride,
+                        img_stride, channel_stride, obs_end - obs_begin, dim.in_channels,
+                        filter_data, out_begin, out_end - out_begin, res);
+                    copy_conv_result(dim.conv_rows, dim.conv_cols, dim.out_channels, res,
+                        obs_end - obs_begin, dest + std::size_t(obs_begin) * dim.conv_rows * res_cols, out_begin);
+                });
+                return;
             }
 
-            // Right padding
-            for (; left_end < col1; left_end += step, res_start_col += col2)
-            {
-                if (left_end <= 0)
-                {
-                    res.block(0, res_start_col, row1, col2).noalias() += mat1 * mat2.block(0,
-                        -left_end, col1, row2);
-                }
-                else
+            // Partial convolution results of each task
+            std::vector<Matrix> partial(part.ntask());
+
+            pool.parallel_for(part.ntask(), [&](int t) {
+                const int chunk = t / part.ngroup, group = t % part.ngroup;
+                const int obs_begin = ConvPartition::begin(chunk, part.nchunk, n_obs);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                const int ch_begin = ConvPartition::begin(group, part.ngroup, dim.in_channels);
+                const int ch_end = ConvPartition::begin(group + 1, part.ngroup, dim.in_channels);
+
+                partial[t].setZero(dim.conv_rows * (obs_end - obs_begin), res_cols);
+                convolve_valid_accumulate(dim,
+                    src + std::size_t(obs_begin) * img_stride + std::size_t(ch_begin) * channel_stride,
+                    img_stride, channel_stride, obs_end - obs_begin, ch_end - ch_begin,
+                    filter_data + std::size_t(ch_begin) * filter_stride, 0, dim.out_channels, partial[t]);
+            });
+
+            // Sum up the channel groups and copy each chunk to the destination
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                Matrix& res = partial[chunk * part.ngroup];
+                for (int group = 1; group < part.ngroup; group++)
                 {
-                    const int overlap = col1 - left_end;
-                    res.block(0, res_start_col, row1, col2).noalias() += mat1.rightCols(overlap) *
-                        mat2.topRows(overlap);
+                    res.noalias() += partial[chunk * part.ngroup + group];
+                    partial[chunk * part.ngroup + group].resize(0, 0);
                 }
-            }
+
+                const int obs_begin = ConvPartition::begin(chunk, part.nchunk, n_obs);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                // The layout of 'res' is very complicated
+                /*
+                 * obs0_out0[0, 0] obs0_out1[0, 0] obs0_out2[0, 0] obs0_out0[0, 1] obs0_out1[0, 1] obs0_out2[0, 1] ...
+                 * obs0_out0[1, 0] obs0_out1[1, 0] obs0_out2[1, 0] obs0_out0[1, 1] obs0_out1[1, 1] obs0_out2[1, 1] ...
+                 * obs0_out0[2, 0] obs0_out1[2, 0] obs0_out2[2, 0] obs0_out0[2, 1] obs0_out1[2, 1] obs0_out2[2, 1] ...
+                 * obs1_out0[0, 0] obs1_out1[0, 0] obs1_out2[0, 0] obs1_out0[0, 1] obs1_out1[0, 1] obs1_out2[0, 1] ...
+                 * obs1_out0[1, 0] obs1_out1[1, 0] obs1_out2[1, 0] obs1_out0[1, 1] obs1_out1[1, 1] obs1_out2[1, 1] ...
+                 * obs1_out0[2, 0] obs1_out1[2, 0] obs1_out2[2, 0] obs1_out0[2, 1] obs1_out1[2, 1] obs1_out2[2, 1] ...
+                 * ...
+                 *
+                 */
+                 // obs<k>_out<l> means the convolution result of the k-th image on the l-th output channel
+                 // [i, j] gives the matrix indices
+                 // The destination has the layout
+                 /*
+                  * obs0_out0[0, 0] obs0_out0[0, 1] obs0_out0[0, 2] obs0_out1[0, 0] obs0_out1[0, 1] obs0_out1[0, 2] ...
+                  * obs0_out0[1, 0] obs0_out0[1, 1] obs0_out0[1, 2] obs0_out1[1, 0] obs0_out1[1, 1] obs0_out1[1, 2] ...
+                  * obs0_out0[2, 0] obs0_out0[2, 1] obs0_out0[2, 2] obs0_out1[2, 0] obs0_out1[2, 1] obs0_out1[2, 2] ...
+                  *
+                  */
+                  // which in a larger scale looks like
+                  // [obs0_out0 obs0_out1 obs0_out2 obs1_out0 obs1_out1 obs1_out2 obs2_out0 ...]
+                  // Copy data to destination
+                  // dest[a, b] corresponds to obs<k>_out<l>[i, j]
+                  // where k = b / (conv_cols * out_channels),
+                  //       l = (b % (conv_cols * out_channels)) / conv_cols
+                  //       i = a,
+                  //       j = b % conv_cols
+                  // and then obs<k>_out<l>[i, j] corresponds to res[c, d]
+                  // where c = k * conv_rows + i,
+                  //       d = j * out_channels + l
+                copy_conv_result(dim.conv_rows, dim.conv_cols, dim.out_channels, res,
+                    obs_end - obs_begin, dest + std::size_t(obs_begin) * dim.conv_rows * res_cols);
+                res.resize(0, 0);
+            });
         }
-        // The main convolution function for the "full" rule
-        inline void convolve_full(
+
+
+
+        // Number of scalars in the temporary 'col' matrices and partial gradients
+        // allocated by convolve_filter_gradient(), summed over all tasks
+        inline double convolve_filter_gradient_workspace(const ConvDims& dim, const int n_obs)
+        {
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), thread_pool().size());
+            const double filter_size = double(dim.filter_rows) * dim.filter_cols;
+            // A 1x1 filter uses the images as they are
+            const double col = is_pointwise(dim) ? 0 : filter_size * dim.conv_rows * dim.conv_cols;
+            const double grad = filter_size * dim.in_channels * dim.out_channels + dim.out_channels;
+            return part.nchunk * col + (part.nchunk - 1) * grad;
+        }
+
+        ///
+        /// Gradients of the filters and biases of a "valid" convolution
+        ///
+        /// 'src' holds 'n_obs' input images in the 'image_outer_loop == true' layout,
+        /// and 'dlz' the gradient with respect to the convolution result, in the
+        /// layout written by convolve_valid(). The filter gradient is written to 'df'
+        /// in the layout of 'filter_data', and the bias gradient to 'db', both
+        /// multiplied by 'scale'.
+        ///
+        /// For each image and input channel, the windows of the channel are unrolled
+        /// into a 'filter_size x conv_size' matrix and multiplied by the
+        /// 'conv_size x out_channels' gradient of that image, which is used as is.
+        ///
+        inline void convolve_filter_gradient(
             const ConvDims& dim,
-            const Scalar* src, const int n_obs, const Scalar* filter_data,
-            Scalar* dest)
+            const Scalar* src, const Scalar* dlz, const int n_obs, const Scalar& scale,
+            Scalar* df, Scalar* db)
         {
             typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
             typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor>
                 RMatrix;
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
             typedef Eigen::Map<const Matrix> ConstMapMat;
-            // Padding sizes
-            const int padding_top = dim.filter_rows - 1;
-            const int padding_left = dim.filter_cols - 1;
-            // Dimension of convolution result using "full" rule
-            const int conv_rows = dim.channel_rows + padding_top;
-            const int conv_cols = dim.channel_cols + padding_left;
-            // Add (top and bottom) padding to source images
-            const int pad_rows = dim.img_rows + padding_top * 2;
-            const int pad_cols = dim.img_cols * n_obs;
-            Matrix pad_mat(pad_rows, pad_cols);
-            ConstMapMat src_mat(src, dim.img_rows, pad_cols);
-            pad_mat.topRows(padding_top).setZero();
-            pad_mat.bottomRows(padding_top).setZero();
-            pad_mat.block(padding_top, 0, dim.img_rows, pad_cols).noalias() = src_mat;
-            src = pad_mat.data();
-            ConvDims pad_dim(dim.in_channels, dim.out_channels, pad_rows, dim.channel_cols,
-                dim.filter_rows, dim.filter_cols);
-            // Flat matrix
-            const int flat_rows = conv_rows * n_obs;
-            const int flat_cols = dim.filter_rows * dim.channel_cols;
-            const int img_stride = pad_rows * dim.img_cols;
-            const int channel_stride = pad_rows * dim.channel_cols;
-            RMatrix flat_mat(flat_rows, flat_cols);
-            // The processing of filters are different from the "valid" rule in two ways:
-            // 1. The layout of input channels and output channels are switched
-            // 2. The filters need to be rotated, which is equivalent to reversing the vector of each filter
-            // We also separate filters that belong to different input channels
-            std::vector<Matrix> filters_in(dim.in_channels);
+            typedef Eigen::Map<Matrix> MapMat;
+            typedef Eigen::Map<Vector> MapVec;
+
             const int filter_size = dim.filter_rows * dim.filter_cols;
-            const int nfilter = dim.in_channels * dim.out_channels;
+            const int conv_size = dim.conv_rows * dim.conv_cols;
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            const int img_size = dim.img_rows * dim.img_cols;
+            const int filter_stride = filter_size * dim.out_channels;
+            const int nfilter_data = filter_stride * dim.in_channels;
+            const std::size_t copy_bytes = sizeof(Scalar) * dim.conv_rows;
 
-            for (int i = 0; i < dim.in_channels; i++)
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), pool.size());
+            // The first chunk writes to 'df' and 'db', the others to their own buffers
+            std::vector<Vector> partial(part.nchunk);
+
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                Scalar* chunk_df = df;
+                Scalar* chunk_db = db;
+                if (chunk > 0)
+                {
+                    partial[chunk].resize(nfilter_data + dim.out_channels);
+                    chunk_df = partial[chunk].data();
+                    chunk_db = chunk_df + nfilter_data;
+                }
+                MapVec(chunk_df, nfilter_data).setZero();
+                MapVec bias_grad(chunk_db, dim.out_channels);
+                bias_grad.setZero();
+
+                const int obs_begin = ConvPartition::begin(chunk, part.nchunk, n_obs);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                RMatrix col(is_pointwise(dim) ? 0 : filter_size, conv_size);
+
+                for (int k = obs_begin; k < obs_end; k++)
+                {
+                    const Scalar* img = src + std::size_t(k) * img_size;
+                    ConstMapMat dlz_obs(dlz + std::size_t(k) * conv_size * dim.out_channels,
+                        conv_size, dim.out_channels);
+                    bias_grad.noalias() += scale * dlz_obs.colwise().sum().transpose();
+
+                    // The gradient of the 'out_channels x in_channels' filter matrix
+                    // of convolve_pointwise()
+                    if (is_pointwise(dim))
+                    {
+                        MapMat(chunk_df, dim.out_channels, dim.in_channels).noalias() +=
+                            scale * dlz_obs.transpose() * ConstMapMat(img, conv_size, dim.in_channels);
+                        continue;
+                    }
+
+                    for (int i = 0; i < dim.in_channels; i++, img += channel_size)
+                    {
+                        // Row 'r + c * filter_rows' of 'col' is the window starting at (r, c)
+                        Scalar* writer = col.data();
+                        for (int c = 0; c < dim.filter_cols; c++)
+                        {
+                            for (int r = 0; r < dim.filter_rows; r++)
+                            {
+                                const Scalar* reader = img + c * dim.channel_rows + r;
+                                for (int j = 0; j < dim.conv_cols; j++, reader += dim.channel_rows,
+                                    writer += dim.conv_rows)
+                                {
+                                    std::memcpy(writer, reader, copy_bytes);
+                                }
+                            }
+                        }
+
+                        MapMat filter_grad(chunk_df + i * filter_stride, filter_size, dim.out_channels);
+                        filter_grad.noalias() += scale * col * dlz_obs;
+                    }
+                }
+            });
+
+            // Add up the gradients of the other chunks
+            MapVec grad(df, nfilter_data);
+            MapVec bias_grad(db, dim.out_channels);
+            for (int chunk = 1; chunk < part.nchunk; chunk++)
             {
-                filters_in[i].resize(filter_size, dim.out_channels);
+                grad.noalias() += partial[chunk].head(nfilter_data);
+                bias_grad.noalias() += partial[chunk].tail(dim.out_channels);
             }
+        }
+
+
 
+        // Number of output channels of convolve_full() handled by one GEMM, so that
+        // the product has at least 64 columns
+        inline int full_block_channels(const ConvDims& dim)
+        {
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            return std::max(1, std::min(dim.out_channels, (64 + filter_size - 1) / filter_size));
+        }
+
+        // Total FLOPs of convolve_full()
+        inline double convolve_full_flops(const ConvDims& dim, const int n_obs)
+        {
+            return 2.0 * n_obs * dim.in_channels * dim.out_channels *
+                dim.channel_rows * dim.channel_cols * dim.filter_rows * dim.filter_cols;
+        }
+
+        // Number of scalars in the packed filters and the temporary 'shifted'
+        // matrices allocated by convolve_full(), summed over all tasks
+        inline double convolve_full_workspace(const ConvDims& dim, const int n_obs)
+        {
+            const ConvPartition part(n_obs, dim.out_channels, convolve_full_flops(dim, n_obs),
+                thread_pool().size());
+            const double filter_size = double(dim.filter_rows) * dim.filter_cols;
+            const double filters = filter_size * dim.in_channels * dim.out_channels;
+            const double shifted = double(dim.channel_rows) * dim.channel_cols *
+                full_block_channels(dim) * filter_size;
+            return filters + part.ntask() * shifted;
+        }
+
+        // The filters are stored with the output channels of convolve_full() (the
+        // input channels of the "valid" convolution) as the outer loop. Gather them
+        // into the 'in_channels x (out_channels * filter_size)' matrix used by the GEMM.
+        // It only depends on the filters, so callers may keep it between calls
+        inline void pack_full_filters(
+            const ConvDims& dim, const Scalar* filter_data,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& filters)
+        {
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            filters.resize(dim.in_channels, dim.out_channels * filter_size);
             const Scalar* reader = filter_data;
 
-            for (int i = 0; i < nfilter; i++, reader += filter_size)
+            for (int k = 0; k < dim.out_channels; k++)
             {
-                Scalar* writer = filters_in[i % dim.in_channels].data() +
-                    (i / dim.in_channels) * filter_size;
-                std::reverse_copy(reader, reader + filter_size, writer);
+                for (int i = 0; i < dim.in_channels; i++, reader += filter_size)
+                {
+                    for (int q = 0; q < filter_size; q++)
+                    {
+                        filters(i, k * filter_size + q) = reader[q];
+                    }
+                }
             }
+        }
 
-            // Convolution results
-            const int& res_rows = flat_rows;
-            const int res_cols = conv_cols * dim.out_channels;
-            Matrix res = Matrix::Zero(res_rows, res_cols);
-            const int& step = dim.filter_rows;
-            const int filter_padding = padding_left * dim.filter_rows;
+        // The main convolution function for the "full" rule
+        //
+        // Instead of padding and flattening the source images, every source pixel is
+        // multiplied by all the filter elements in one GEMM, and each product is added
+        // to the destination pixel it contributes to. For output channel 'k' and filter
+        // element 'q = a + b * filter_rows' the GEMM result
+        //     shifted = src_image * filters[, k * filter_size + q]
+        // holds the source channels combined with that element, and is added to the
+        // destination channel shifted by 'a' rows and 'b' columns. This is the full
+        // convolution with rotated filters, and the padding is never touched.
+        // The GEMM reads the source in place, and its depth is the number of
+        // source channels. 'filters' is the output of pack_full_filters()
+        inline void convolve_full(
+            const ConvDims& dim,
+            const Scalar* src, const int n_obs,
+            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& filters,
+            Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+            typedef Eigen::Map<const Vector> ConstMapVec;
+            typedef Eigen::Map<Vector> MapVec;
+            // Dimension of convolution result using "full" rule
+            const int conv_rows = dim.channel_rows + dim.filter_rows - 1;
+            const int conv_cols = dim.channel_cols + dim.filter_cols - 1;
+            const int conv_size = conv_rows * conv_cols;
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            const int filter_size = dim.filter_rows * dim.filter_cols;
 
-            for (int i = 0; i < dim.in_channels; i++, src += channel_stride)
-            {
-                // Flatten source image
-                flatten_mat(pad_dim, src, img_stride, n_obs, flat_mat);
-                // Compute the convolution result
-                moving_product(filter_padding, step, flat_mat, filters_in[i], res);
-            }
+            // Tasks split the observations, and then the output channels, which
+            // are independent of each other
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, dim.out_channels, convolve_full_flops(dim, n_obs),
+                pool.size());
+            const int block_channels = full_block_channels(dim);
 
-            // Copy results to destination
-            const int& dest_rows = conv_rows;
-            const int  dest_cols = res_cols * n_obs;
-            const Scalar* res_data = res.data();
-            const std::size_t copy_bytes = sizeof(Scalar) * dest_rows;
+            pool.parallel_for(part.ntask(), [&](int t) {
+                const int chunk = t / part.ngroup, group = t % part.ngroup;
+                const int obs_begin = ConvPartition::begin(chunk, part.nchunk, n_obs);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+                const int ch_begin = ConvPartition::begin(group, part.ngroup, dim.out_channels);
+                const int ch_end = ConvPartition::begin(group + 1, part.ngroup, dim.out_channels);
+                Matrix shifted(channel_size, block_channels * filter_size);
 
-            for (int b = 0; b < dest_cols; b++, dest += dest_rows)
-            {
-                const int k = b / res_cols;
-                const int l = (b % res_cols) / conv_cols;
-                const int j = b % conv_cols;
-                const int d = j * dim.out_channels + l;
-                const int res_col_head = d * res_rows;
-                std::memcpy(dest, res_data + res_col_head + k * conv_rows, copy_bytes);
-            }
+                for (int n = obs_begin; n < obs_end; n++)
+                {
+                    ConstMapMat src_image(src + std::size_t(n) * channel_size * dim.in_channels,
+                        channel_size, dim.in_channels);
+                    Scalar* dest_image = dest + std::size_t(n) * conv_size * dim.out_channels;
+
+                    for (int k0 = ch_begin; k0 < ch_end; k0 += block_channels)
+                    {
+                        const int nk = std::min(block_channels, ch_end - k0);
+                        shifted.leftCols(nk * filter_size).noalias() = src_image *
+                            filters.middleCols(k0 * filter_size, nk * filter_size);
+
+                        for (int k = 0; k < nk; k++)
+                        {
+                            Scalar* dest_channel = dest_image + std::size_t(k0 + k) * conv_size;
+                            MapVec(dest_channel, conv_size).setZero();
+
+                            for (int q = 0; q < filter_size; q++)
+                            {
+                                const Scalar* col = shifted.data() + std::size_t(k * filter_size + q) * channel_size;
+                                Scalar* writer = dest_channel + (q / dim.filter_rows) * conv_rows +
+                                    q % dim.filter_rows;
+
+                                for (int j = 0; j < dim.channel_cols; j++, col += dim.channel_rows,
+                                    writer += conv_rows)
+                                {
+                                    MapVec(writer, dim.channel_rows).noalias() +=
+                                        ConstMapVec(col, dim.channel_rows);
+                                }
+                            }
+                        }
+                    }
+                }
+            });
+        }
+
+        // convolve_full() with filters in the layout of convolve_valid()
+        inline void convolve_full(
+            const ConvDims& dim,
+            const Scalar* src, const int n_obs, const Scalar* filter_data,
+            Scalar* dest)
+        {
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> filters;
+            pack_full_filters(dim, filter_data, filters);
+            convolve_full(dim, src, n_obs, filters, dest);
         }
 
 
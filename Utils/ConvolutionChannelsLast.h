@@ -0,0 +1,308 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "ThreadPool.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        // Channels-last ("NHWC") kernels for the "valid" convolution
+        //
+        // In the channels-last layout the 'in_channels' values of a pixel are
+        // contiguous, and the pixels of an image follow each other in column-major
+        // order. Element (ch, i, j) of an image is at 'ch + in_channels * (i + channel_rows * j)',
+        // so an image is the 'in_channels x (channel_rows * channel_cols)' matrix
+        // whose columns are the pixels. Results are written in the same layout with
+        // 'out_channels' values per pixel.
+        //
+        // For the filter column 'c', the inputs seen by the output pixel (i, j) are the
+        // 'filter_rows * in_channels' contiguous values starting at pixel (i, j + c).
+        // Mapping these windows with an outer stride of 'in_channels' gives, without
+        // any copy, the right-hand side of a GEMM with the packed filters. To cover a
+        // whole image in one product, the windows of all the pixels (i, j) with
+        // i < channel_rows are used, and the results of the rows i >= conv_rows,
+        // which wrap into the next column, are discarded.
+
+        // Number of pixel columns of the wrapped products
+        inline int channels_last_span(const ConvDims& dim)
+        {
+            return dim.channel_rows * (dim.conv_cols - 1) + dim.conv_rows;
+        }
+
+        // The filters as an 'out_channels x (in_channels * filter_size)' matrix, with
+        // filter element (r, c) of input channel 'ch' in column
+        // 'ch + in_channels * (r + filter_rows * c)'
+        inline void pack_channels_last_filters(
+            const ConvDims& dim, const Scalar* filter_data,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& filters)
+        {
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            filters.resize(dim.out_channels, dim.in_channels * filter_size);
+
+            for (int ch = 0; ch < dim.in_channels; ch++)
+            {
+                for (int o = 0; o < dim.out_channels; o++, filter_data += filter_size)
+                {
+                    for (int q = 0; q < filter_size; q++)
+                    {
+                        filters(o, ch + dim.in_channels * q) = filter_data[q];
+                    }
+                }
+            }
+        }
+
+        // Number of scalars in the temporary products allocated by
+        // convolve_valid_channels_last(), summed over all tasks
+        inline double convolve_channels_last_workspace(const ConvDims& dim, const int n_obs)
+        {
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), thread_pool().size());
+            return double(part.nchunk) * dim.out_channels * channels_last_span(dim);
+        }
+
+        // Workspace of convolve_input_gradient_channels_last(), which also keeps the
+        // product of the gradient with all the filter elements
+        inline double convolve_input_gradient_channels_last_workspace(const ConvDims& dim, const int n_obs)
+        {
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), thread_pool().size());
+            const double prod = double(dim.in_channels) * dim.filter_rows * dim.filter_cols;
+            return double(part.nchunk) * (dim.out_channels + prod) * channels_last_span(dim);
+        }
+
+        // Workspace of convolve_filter_gradient_channels_last(), which also keeps
+        // one partial gradient per extra task
+        inline double convolve_filter_gradient_channels_last_workspace(const ConvDims& dim, const int n_obs)
+        {
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), thread_pool().size());
+            const double grad = double(dim.out_channels) * dim.in_channels * dim.filter_rows * dim.filter_cols;
+            return convolve_channels_last_workspace(dim, n_obs) + (part.nchunk - 1) * grad;
+        }
+
+        // "Valid" convolution of 'n_obs' channels-last images with the packed filters
+        inline void convolve_valid_channels_last(
+            const ConvDims& dim,
+            const Scalar* src, const int n_obs,
+            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& filters,
+            Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstWindowMap;
+
+            const int img_size = dim.channel_rows * dim.channel_cols * dim.in_channels;
+            const int res_size = dim.conv_rows * dim.conv_cols * dim.out_channels;
+            const int window_rows = dim.filter_rows * dim.in_channels;
+            const int span = channels_last_span(dim);
+            // Values of one column of the wrapped product, and of the destination
+            const int res_col = dim.channel_rows * dim.out_channels;
+            const std::size_t copy_bytes = sizeof(Scalar) * dim.conv_rows * dim.out_channels;
+
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), pool.size());
+
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                Matrix res(dim.out_channels, span);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+
+                for (int k = ConvPartition::begin(chunk, part.nchunk, n_obs); k < obs_end; k++)
+                {
+                    const Scalar* img = src + std::size_t(k) * img_size;
+                    for (int c = 0; c < dim.filter_cols; c++)
+                    {
+                        ConstWindowMap windows(img + std::size_t(c) * dim.channel_rows * dim.in_channels,
+                            window_rows, span, Eigen::OuterStride<>(dim.in_channels));
+                        if (c == 0)
+                            res.noalias() = filters.leftCols(window_rows) * windows;
+                        else
+                            res.noalias() += filters.middleCols(c * window_rows, window_rows) * windows;
+                    }
+
+                    // Keep the first 'conv_rows' pixels of every column
+                    Scalar* res_dest = dest + std::size_t(k) * res_size;
+                    for (int j = 0; j < dim.conv_cols; j++)
+                    {
+                        std::memcpy(res_dest + std::size_t(j) * dim.conv_rows * dim.out_channels,
+                            res.data() + std::size_t(j) * res_col, copy_bytes);
+                    }
+                }
+            });
+        }
+
+        // Copy the gradient 'dlz' of one image into the columns of the wrapped
+        // product, with zeros for the discarded rows
+        inline void spread_channels_last_gradient(
+            const ConvDims& dim, const Scalar* dlz,
+            Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& res)
+        {
+            const int res_col = dim.channel_rows * dim.out_channels;
+            const int valid = dim.conv_rows * dim.out_channels;
+            Scalar* writer = res.data();
+
+            for (int j = 0; j < dim.conv_cols; j++, dlz += valid, writer += res_col)
+            {
+                std::memcpy(writer, dlz, sizeof(Scalar) * valid);
+                if (j < dim.conv_cols - 1)
+                    std::fill(writer + valid, writer + res_col, Scalar(0));
+            }
+        }
+
+        // Gradient with respect to the input of convolve_valid_channels_last(), given
+        // the gradient 'dlz' with respect to its result. 'din' is overwritten
+        inline void convolve_input_gradient_channels_last(
+            const ConvDims& dim,
+            const Scalar* dlz, const int n_obs,
+            const Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic>& filters,
+            Scalar* din)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<Matrix> MapMat;
+
+            const int img_size = dim.channel_rows * dim.channel_cols * dim.in_channels;
+            const int res_size = dim.conv_rows * dim.conv_cols * dim.out_channels;
+            const int span = channels_last_span(dim);
+
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), pool.size());
+
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                Matrix grad(dim.out_channels, span);
+                Matrix prod(dim.in_channels * filter_size, span);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+
+                for (int k = ConvPartition::begin(chunk, part.nchunk, n_obs); k < obs_end; k++)
+                {
+                    spread_channels_last_gradient(dim, dlz + std::size_t(k) * res_size, grad);
+                    // All the filter elements in one GEMM
+                    prod.noalias() = filters.transpose() * grad;
+
+                    Scalar* img = din + std::size_t(k) * img_size;
+                    MapMat(img, dim.in_channels, dim.channel_rows * dim.channel_cols).setZero();
+
+                    // The output pixel (i, j) sends its gradient to the input pixel
+                    // (i + r, j + c) through the filter element (r, c)
+                    for (int c = 0; c < dim.filter_cols; c++)
+                    {
+                        for (int r = 0; r < dim.filter_rows; r++)
+                        {
+                            const int q = r + dim.filter_rows * c;
+                            MapMat target(img + std::size_t(r + dim.channel_rows * c) * dim.in_channels,
+                                dim.in_channels, span);
+                            target.noalias() += prod.middleRows(q * dim.in_channels, dim.in_channels);
+                        }
+                    }
+                }
+            });
+        }
+
+        ///
+        /// Gradients of the filters and biases of convolve_valid_channels_last()
+        ///
+        /// The filter gradient is written to 'df' in the layout of 'filter_data'
+        /// (not the packed one), and the bias gradient to 'db', both multiplied by
+        /// 'scale'.
+        ///
+        inline void convolve_filter_gradient_channels_last(
+            const ConvDims& dim,
+            const Scalar* src, const Scalar* dlz, const int n_obs, const Scalar& scale,
+            Scalar* df, Scalar* db)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, 1> Vector;
+            typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstWindowMap;
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+            typedef Eigen::Map<Vector> MapVec;
+
+            const int img_size = dim.channel_rows * dim.channel_cols * dim.in_channels;
+            const int res_size = dim.conv_rows * dim.conv_cols * dim.out_channels;
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            const int window_rows = dim.filter_rows * dim.in_channels;
+            const int span = channels_last_span(dim);
+
+            ThreadPool& pool = thread_pool();
+            const ConvPartition part(n_obs, 1, convolve_valid_flops(dim, n_obs), pool.size());
+            // Packed gradient of each chunk
+            std::vector<Matrix> partial(part.nchunk);
+
+            pool.parallel_for(part.nchunk, [&](int chunk) {
+                Matrix grad(dim.out_channels, span);
+                Matrix& filter_grad = partial[chunk];
+                filter_grad.setZero(dim.out_channels, dim.in_channels * filter_size);
+                const int obs_end = ConvPartition::begin(chunk + 1, part.nchunk, n_obs);
+
+                for (int k = ConvPartition::begin(chunk, part.nchunk, n_obs); k < obs_end; k++)
+                {
+                    spread_channels_last_gradient(dim, dlz + std::size_t(k) * res_size, grad);
+                    const Scalar* img = src + std::size_t(k) * img_size;
+                    for (int c = 0; c < dim.filter_cols; c++)
+                    {
+                        ConstWindowMap windows(img + std::size_t(c) * dim.channel_rows * dim.in_channels,
+                            window_rows, span, Eigen::OuterStride<>(dim.in_channels));
+                        filter_grad.middleCols(c * window_rows, window_rows).noalias() += grad * windows.transpose();
+                    }
+                }
+            });
+
+            for (int chunk = 1; chunk < part.nchunk; chunk++)
+            {
+                partial[0].noalias() += partial[chunk];
+                partial[chunk].resize(0, 0);
+            }
+
+            // Back to the layout of 'filter_data'
+            const Matrix& filter_grad = partial[0];
+            for (int ch = 0; ch < dim.in_channels; ch++)
+            {
+                for (int o = 0; o < dim.out_channels; o++, df += filter_size)
+                {
+                    for (int q = 0; q < filter_size; q++)
+                    {
+                        df[q] = scale * filter_grad(o, ch + dim.in_channels * q);
+                    }
+                }
+            }
+
+            ConstMapMat dlz_mat(dlz, dim.out_channels, std::size_t(n_obs) * dim.conv_rows * dim.conv_cols);
+            MapVec(db, dim.out_channels).noalias() = scale * dlz_mat.rowwise().sum();
+        }
+
+        // Reorder 'n_obs' images of 'nchannel' channels from the channels-first layout
+        // to the channels-last one. Each image is transposed from a
+        // 'npixel x nchannel' matrix into a 'nchannel x npixel' one
+        inline void to_channels_last(const Scalar* src, const int nchannel, const int npixel,
+                                     const int n_obs, Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            const std::size_t img_size = std::size_t(nchannel) * npixel;
+            for (int k = 0; k < n_obs; k++)
+            {
+                Eigen::Map<Matrix>(dest + k * img_size, nchannel, npixel).noalias() =
+                    Eigen::Map<const Matrix>(src + k * img_size, npixel, nchannel).transpose();
+            }
+        }
+
+        // The inverse of to_channels_last()
+        inline void to_channels_first(const Scalar* src, const int nchannel, const int npixel,
+                                      const int n_obs, Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            const std::size_t img_size = std::size_t(nchannel) * npixel;
+            for (int k = 0; k < n_obs; k++)
+            {
+                Eigen::Map<Matrix>(dest + k * img_size, npixel, nchannel).noalias() =
+                    Eigen::Map<const Matrix>(src + k * img_size, nchannel, npixel).transpose();
+            }
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
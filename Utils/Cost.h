@@ -0,0 +1,101 @@
+#pragma once
+
+#include <cstddef>
+#include <algorithm>
+#include "../Config.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        ///
+        /// Static cost of one layer for a given batch size
+        ///
+        /// FLOP counts treat a multiply-add as two operations. Byte counts are
+        /// derived from the sizes of the buffers that the layer actually
+        /// allocates, so they can be used to predict memory use before running.
+        ///
+        struct LayerCost
+        {
+            double forward_flops;
+            double backward_flops;
+            // Weights and biases. Gradients occupy the same amount again
+            std::size_t param_bytes;
+            // Per-batch state created by forward() and kept in the layer (m_z, m_a, ...)
+            std::size_t activation_bytes;
+            // Gradient with respect to the layer input (m_din), created by backprop()
+            std::size_t input_grad_bytes;
+            // Temporary workspaces that only live during forward() or backprop()
+            std::size_t forward_scratch_bytes;
+            std::size_t backward_scratch_bytes;
+            // Minimum number of bytes read and written from main memory
+            double forward_traffic_bytes;
+            double backward_traffic_bytes;
+
+            LayerCost() :
+                forward_flops(0), backward_flops(0),
+                param_bytes(0), activation_bytes(0), input_grad_bytes(0),
+                forward_scratch_bytes(0), backward_scratch_bytes(0),
+                forward_traffic_bytes(0), backward_traffic_bytes(0)
+            {}
+        };
+
+        ///
+        /// Static cost of a whole network for a given batch size
+        ///
+        /// Layers keep their buffers allocated between calls, so the peak memory
+        /// is the sum of the per-layer state plus the largest single workspace.
+        /// Optimizer state (e.g. momentum vectors) is not included.
+        ///
+        struct NetworkCost
+        {
+            double forward_flops;
+            double backward_flops;
+            // Forward FLOPs repeated in backprop() because of gradient checkpointing
+            double recompute_flops;
+            std::size_t param_bytes;
+            // Memory needed to run predict()
+            std::size_t inference_peak_bytes;
+            // Memory needed to run forward(), backprop() and update()
+            std::size_t training_peak_bytes;
+            // Roofline estimates, in seconds
+            double forward_seconds;
+            double backward_seconds;
+
+            NetworkCost() :
+                forward_flops(0), backward_flops(0), recompute_flops(0), param_bytes(0),
+                inference_peak_bytes(0), training_peak_bytes(0),
+                forward_seconds(0), backward_seconds(0)
+            {}
+        };
+
+        ///
+        /// Roofline estimate of the run time of a kernel
+        ///
+        /// \param flops          Number of floating point operations
+        /// \param bytes          Number of bytes moved from and to main memory
+        /// \param peak_gflops    Peak arithmetic throughput of the machine, in GFLOP/s
+        /// \param peak_gbs       Peak memory bandwidth of the machine, in GB/s
+        /// \return               Estimated time in seconds
+        ///
+        inline double roofline_seconds(const double flops, const double bytes,
+            const double peak_gflops, const double peak_gbs)
+        {
+            const double compute = flops / (peak_gflops * 1e9);
+            const double memory = bytes / (peak_gbs * 1e9);
+            return std::max(compute, memory);
+        }
+
+        // Bytes taken by 'n' scalars
+        inline std::size_t scalar_bytes(const double n)
+        {
+            return static_cast<std::size_t>(n) * sizeof(Scalar);
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <algorithm>
+#include "../Config.h"
+#include "Convolution.h"
+#include "ThreadPool.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        // Depthwise convolution uses the memory layout described in Convolution.h,
+        // with 'image_outer_loop == true' and 'in_channels == out_channels'. Each
+        // channel has a single 'filter_rows x filter_cols' filter, and output
+        // channel 'k' is the "valid" convolution of input channel 'k' with filter 'k'.
+        // The filters are stored one after another, so there are
+        // 'in_channels * filter_rows * filter_cols' filter elements in total.
+        //
+        // The kernels work directly on the images. For the filter element at (r, c),
+        // the 'conv_rows x conv_cols' block of the channel starting at (r, c) is
+        // multiplied by the element and added to the result, which keeps all the
+        // memory accesses contiguous within a column.
+
+        // Total FLOPs of convolve_depthwise(), and of each of the two gradients
+        inline double convolve_depthwise_flops(const ConvDims& dim, const int n_obs)
+        {
+            return 2.0 * n_obs * dim.in_channels * dim.conv_rows * dim.conv_cols *
+                dim.filter_rows * dim.filter_cols;
+        }
+
+        // Number of tasks for a depthwise kernel with 'nunit' independent units of work
+        inline int depthwise_ntask(const ConvDims& dim, const int n_obs, const int nunit)
+        {
+            // The same threshold as ConvPartition
+            const double min_task_flops = 1e6;
+            const double flops = convolve_depthwise_flops(dim, n_obs);
+            return std::max(1, std::min(std::min(thread_pool().size(), nunit), int(flops / min_task_flops)));
+        }
+
+        // Depthwise "valid" convolution of 'n_obs' images. 'dest' is written in the
+        // same layout as convolve_valid()
+        inline void convolve_depthwise(
+            const ConvDims& dim,
+            const Scalar* src, const int n_obs,
+            const Scalar* filter_data,
+            Scalar* dest)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstBlockMap;
+            typedef Eigen::Map<Matrix> MapMat;
+
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            const int conv_size = dim.conv_rows * dim.conv_cols;
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            // Each channel of each image is a unit of work
+            const int nunit = n_obs * dim.in_channels;
+            const int ntask = depthwise_ntask(dim, n_obs, nunit);
+
+            thread_pool().parallel_for(ntask, [&](int t) {
+                const int unit_end = ConvPartition::begin(t + 1, ntask, nunit);
+                for (int u = ConvPartition::begin(t, ntask, nunit); u < unit_end; u++)
+                {
+                    const Scalar* channel = src + std::size_t(u) * channel_size;
+                    const Scalar* filter = filter_data + std::size_t(u % dim.in_channels) * filter_size;
+                    MapMat res(dest + std::size_t(u) * conv_size, dim.conv_rows, dim.conv_cols);
+                    res.setZero();
+
+                    for (int c = 0; c < dim.filter_cols; c++)
+                    {
+                        for (int r = 0; r < dim.filter_rows; r++)
+                        {
+                            ConstBlockMap block(channel + c * dim.channel_rows + r, dim.conv_rows, dim.conv_cols,
+                                Eigen::OuterStride<>(dim.channel_rows));
+                            res.noalias() += filter[r + c * dim.filter_rows] * block;
+                        }
+                    }
+                }
+            });
+        }
+
+        // Gradient with respect to the input of convolve_depthwise(), given the gradient
+        // 'dlz' with respect to its result. 'din' is overwritten
+        inline void convolve_depthwise_input_gradient(
+            const ConvDims& dim,
+            const Scalar* dlz, const int n_obs,
+            const Scalar* filter_data,
+            Scalar* din)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<Matrix, 0, Eigen::OuterStride<> > BlockMap;
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+            typedef Eigen::Map<Matrix> MapMat;
+
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            const int conv_size = dim.conv_rows * dim.conv_cols;
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            const int nunit = n_obs * dim.in_channels;
+            const int ntask = depthwise_ntask(dim, n_obs, nunit);
+
+            thread_pool().parallel_for(ntask, [&](int t) {
+                const int unit_end = ConvPartition::begin(t + 1, ntask, nunit);
+                for (int u = ConvPartition::begin(t, ntask, nunit); u < unit_end; u++)
+                {
+                    Scalar* channel = din + std::size_t(u) * channel_size;
+                    const Scalar* filter = filter_data + std::size_t(u % dim.in_channels) * filter_size;
+                    ConstMapMat grad(dlz + std::size_t(u) * conv_size, dim.conv_rows, dim.conv_cols);
+                    MapMat(channel, dim.channel_rows, dim.channel_cols).setZero();
+
+                    // Every input pixel of the window at (r, c) receives the gradient
+                    // of the output pixel times the filter element
+                    for (int c = 0; c < dim.filter_cols; c++)
+                    {
+                        for (int r = 0; r < dim.filter_rows; r++)
+                        {
+                            BlockMap block(channel + c * dim.channel_rows + r, dim.conv_rows, dim.conv_cols,
+                                Eigen::OuterStride<>(dim.channel_rows));
+                            block.noalias() += filter[r + c * dim.filter_rows] * grad;
+                        }
+                    }
+                }
+            });
+        }
+
+        ///
+        /// Gradients of the filters and biases of a depthwise convolution
+        ///
+        /// 'src' holds the input images and 'dlz' the gradient with respect to the
+        /// result of convolve_depthwise(). The filter gradient is written to 'df' in
+        /// the layout of 'filter_data', and the bias gradient to 'db', both
+        /// multiplied by 'scale'.
+        ///
+        /// The channels are split among the tasks, and each task sums over all the
+        /// images, so no partial gradients need to be added up.
+        ///
+        inline void convolve_depthwise_filter_gradient(
+            const ConvDims& dim,
+            const Scalar* src, const Scalar* dlz, const int n_obs, const Scalar& scale,
+            Scalar* df, Scalar* db)
+        {
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+            typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<> > ConstBlockMap;
+            typedef Eigen::Map<const Matrix> ConstMapMat;
+
+            const int channel_size = dim.channel_rows * dim.channel_cols;
+            const int conv_size = dim.conv_rows * dim.conv_cols;
+            const int filter_size = dim.filter_rows * dim.filter_cols;
+            const int ntask = depthwise_ntask(dim, n_obs, dim.in_channels);
+
+            thread_pool().parallel_for(ntask, [&](int t) {
+                const int ch_end = ConvPartition::begin(t + 1, ntask, dim.in_channels);
+                for (int k = ConvPartition::begin(t, ntask, dim.in_channels); k < ch_end; k++)
+                {
+                    Scalar* filter_grad = df + std::size_t(k) * filter_size;
+                    std::fill(filter_grad, filter_grad + filter_size, Scalar(0));
+                    Scalar bias_grad = 0;
+
+                    for (int i = 0; i < n_obs; i++)
+                    {
+                        const std::size_t u = std::size_t(i) * dim.in_channels + k;
+                        const Scalar* channel = src + u * channel_size;
+                        ConstMapMat grad(dlz + u * conv_size, dim.conv_rows, dim.conv_cols);
+                        bias_grad += grad.sum();
+
+                        for (int c = 0; c < dim.filter_cols; c++)
+                        {
+                            for (int r = 0; r < dim.filter_rows; r++)
+                            {
+                                ConstBlockMap block(channel + c * dim.channel_rows + r, dim.conv_rows, dim.conv_cols,
+                                    Eigen::OuterStride<>(dim.channel_rows));
+                                filter_grad[r + c * dim.filter_rows] += grad.cwiseProduct(block).sum();
+                            }
+                        }
+                    }
+
+                    for (int q = 0; q < filter_size; q++)
+                    {
+                        filter_grad[q] *= scale;
+                    }
+                    db[k] = scale * bias_grad;
+                }
+            });
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
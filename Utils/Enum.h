@@ -14,7 +14,11 @@ namespace MiniDNN
         {
             FULLY_CONNECTED = 0,
             CONVOLUTIONAL,
-            MAX_POOLING
+            MAX_POOLING,
+            CONVOLUTIONAL_MAX_POOLING,
+            DEPTHWISE_CONVOLUTIONAL,
+            SPARSE_FULLY_CONNECTED,
+            BATCH_NORMALIZATION
         };
 
         // Convert a hidden layer type string to an integer
@@ -26,11 +30,28 @@ namespace MiniDNN
                 return CONVOLUTIONAL;
             if (type == "MaxPooling")
                 return MAX_POOLING;
+            if (type == "ConvolutionalMaxPooling")
+                return CONVOLUTIONAL_MAX_POOLING;
+            if (type == "DepthwiseConvolutional")
+                return DEPTHWISE_CONVOLUTIONAL;
+            if (type == "SparseFullyConnected")
+                return SPARSE_FULLY_CONNECTED;
+            if (type == "BatchNormalization")
+                return BATCH_NORMALIZATION;
 
             throw std::invalid_argument("[function layer_id]: Layer is not of a known type");
             return -1;
         }
 
+        // Memory layout of the images processed by Convolutional and MaxPooling.
+        // CHANNELS_FIRST stores the channels one after another, and CHANNELS_LAST
+        // stores the channel values of each pixel together
+        enum LAYOUT_ENUM
+        {
+            CHANNELS_FIRST = 0,
+            CHANNELS_LAST
+        };
+
         // Enumerations for activation functions
         enum ACTIVATION_ENUM
         {
@@ -75,9 +96,9 @@ namespace MiniDNN
         {
             if (type == "RegressionMSE")
                 return REGRESSION_MSE;
-            if (type == "MultiClassEntropy")
-                return BINARY_CLASS_ENTROPY;
             if (type == "BinaryClassEntropy")
+                return BINARY_CLASS_ENTROPY;
+            if (type == "MultiClassEntropy")
                 return MULTI_CLASS_ENTROPY;
 
             throw std::invalid_argument("[function output_id]: Output is not of a known type");
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <map>
+#include <string>
+#include <stdexcept>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Layer/FullyConnected.h"
+#include "../Layer/Convolutional.h"
+#include "../Layer/MaxPooling.h"
+#include "../Layer/ConvolutionalMaxPooling.h"
+#include "../Layer/DepthwiseConvolutional.h"
+#include "../Layer/SparseFullyConnected.h"
+#include "../Layer/BatchNormalization.h"
+#include "../Activation/Indentity.h"
+#include "../Activation/Mish.h"
+#include "../Activation/ReLU.h"
+#include "../Activation/Sigmoid.h"
+#include "../Activation/Softmax.h"
+#include "../Activation/Tanh.h"
+#include "../Output.h"
+#include "../Output/RegressionMSE.h"
+#include "../Output/MultiClassEntropy.h"
+#include "Enum.h"
+#include "IO.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        // Look up a required entry of the meta information
+        inline int meta_value(const std::map<std::string, int>& map, const std::string& key)
+        {
+            std::map<std::string, int>::const_iterator it = map.find(key);
+            if (it == map.end())
+                throw std::invalid_argument("[function meta_value]: Missing meta information \"" + key + "\"");
+
+            return it->second;
+        }
+
+        // Look up an optional entry, which older models may not have
+        inline int meta_value(const std::map<std::string, int>& map, const std::string& key, const int default_value)
+        {
+            std::map<std::string, int>::const_iterator it = map.find(key);
+            return it == map.end() ? default_value : it->second;
+        }
+
+        // Instantiate a layer template with the activation given by its ID
+        template <template <typename> class LayerType, typename Creator>
+        inline Layer* create_with_activation(const int act_id, const Creator& creator)
+        {
+            switch (act_id)
+            {
+            case IDENTITY:
+                return creator.template create< LayerType<Identity> >();
+            case RELU:
+                return creator.template create< LayerType<ReLU> >();
+            case SIGMOID:
+                return creator.template create< LayerType<Sigmoid> >();
+            case SOFTMAX:
+                return creator.template create< LayerType<Softmax> >();
+            case TANH:
+                return creator.template create< LayerType<Tanh> >();
+            case MISH:
+                return creator.template create< LayerType<Mish> >();
+            }
+
+            throw std::invalid_argument("[function create_layer]: Activation is not of a known type");
+        }
+
+        struct FullyConnectedCreator
+        {
+            int in_size, out_size;
+
+            template <typename L>
+            Layer* create() const { return new L(in_size, out_size); }
+        };
+
+        struct ConvolutionalCreator
+        {
+            int in_width, in_height, in_channels, out_channels, window_width, window_height;
+            int layout;
+
+            template <typename L>
+            Layer* create() const
+            {
+                return new L(in_width, in_height, in_channels, out_channels, window_width, window_height, layout);
+            }
+        };
+
+        struct ConvolutionalMaxPoolingCreator
+        {
+            int in_width, in_height, in_channels, out_channels, window_width, window_height;
+            int pooling_width, pooling_height;
+
+            template <typename L>
+            Layer* create() const
+            {
+                return new L(in_width, in_height, in_channels, out_channels, window_width, window_height,
+                             pooling_width, pooling_height);
+            }
+        };
+
+        struct DepthwiseConvolutionalCreator
+        {
+            int in_width, in_height, in_channels, window_width, window_height;
+
+            template <typename L>
+            Layer* create() const
+            {
+                return new L(in_width, in_height, in_channels, window_width, window_height);
+            }
+        };
+
+        struct BatchNormalizationCreator
+        {
+            int in_width, in_height, in_channels, layout;
+
+            template <typename L>
+            Layer* create() const { return new L(in_width, in_height, in_channels, layout); }
+        };
+
+        ///
+        /// Create a hidden layer from the meta information written by Layer::fill_meta_info()
+        ///
+        /// \param map      The meta information of the whole network
+        /// \param index    Index of the layer
+        /// \return         A pointer to the newly created layer, with memory allocated
+        ///                 but parameters not set
+        ///
+        inline Layer* create_layer(const std::map<std::string, int>& map, int index)
+        {
+            const std::string ind = to_string(index);
+            const int lay_id = meta_value(map, "Layer" + ind);
+            const int act_id = meta_value(map, "Activation" + ind);
+            Layer* layer = NULL;
+
+            if (lay_id == FULLY_CONNECTED)
+            {
+                FullyConnectedCreator c;
+                c.in_size = meta_value(map, "in_size" + ind);
+                c.out_size = meta_value(map, "out_size" + ind);
+                layer = create_with_activation<FullyConnected>(act_id, c);
+            }
+            else if (lay_id == CONVOLUTIONAL)
+            {
+                ConvolutionalCreator c;
+                c.in_width = meta_value(map, "in_width" + ind);
+                c.in_height = meta_value(map, "in_height" + ind);
+                c.in_channels = meta_value(map, "in_channels" + ind);
+                c.out_channels = meta_value(map, "out_channels" + ind);
+                c.window_width = meta_value(map, "window_width" + ind);
+                c.window_height = meta_value(map, "window_height" + ind);
+                c.layout = meta_value(map, "layout" + ind, CHANNELS_FIRST);
+                layer = create_with_activation<Convolutional>(act_id, c);
+            }
+            else if (lay_id == MAX_POOLING)
+            {
+                layer = new MaxPooling(meta_value(map, "in_width" + ind), meta_value(map, "in_height" + ind),
+                                       meta_value(map, "in_channels" + ind),
+                                       meta_value(map, "pooling_width" + ind), meta_value(map, "pooling_height" + ind),
+                                       meta_value(map, "layout" + ind, CHANNELS_FIRST));
+            }
+            else if (lay_id == CONVOLUTIONAL_MAX_POOLING)
+            {
+                ConvolutionalMaxPoolingCreator c;
+                c.in_width = meta_value(map, "in_width" + ind);
+                c.in_height = meta_value(map, "in_height" + ind);
+                c.in_channels = meta_value(map, "in_channels" + ind);
+                c.out_channels = meta_value(map, "out_channels" + ind);
+                c.window_width = meta_value(map, "window_width" + ind);
+                c.window_height = meta_value(map, "window_height" + ind);
+                c.pooling_width = meta_value(map, "pooling_width" + ind);
+                c.pooling_height = meta_value(map, "pooling_height" + ind);
+                layer = create_with_activation<ConvolutionalMaxPooling>(act_id, c);
+            }
+            else if (lay_id == DEPTHWISE_CONVOLUTIONAL)
+            {
+                DepthwiseConvolutionalCreator c;
+                c.in_width = meta_value(map, "in_width" + ind);
+                c.in_height = meta_value(map, "in_height" + ind);
+                c.in_channels = meta_value(map, "in_channels" + ind);
+                c.window_width = meta_value(map, "window_width" + ind);
+                c.window_height = meta_value(map, "window_height" + ind);
+                layer = create_with_activation<DepthwiseConvolutional>(act_id, c);
+            }
+            else if (lay_id == SPARSE_FULLY_CONNECTED)
+            {
+                FullyConnectedCreator c;
+                c.in_size = meta_value(map, "in_size" + ind);
+                c.out_size = meta_value(map, "out_size" + ind);
+                layer = create_with_activation<SparseFullyConnected>(act_id, c);
+            }
+            else if (lay_id == BATCH_NORMALIZATION)
+            {
+                BatchNormalizationCreator c;
+                c.in_width = meta_value(map, "in_width" + ind);
+                c.in_height = meta_value(map, "in_height" + ind);
+                c.in_channels = meta_value(map, "in_channels" + ind);
+                c.layout = meta_value(map, "layout" + ind, CHANNELS_FIRST);
+                layer = create_with_activation<BatchNormalization>(act_id, c);
+            }
+            else
+            {
+                throw std::invalid_argument("[function create_layer]: Layer is not of a known type");
+            }
+
+            layer->init();
+            return layer;
+        }
+
+        ///
+        /// Create the output layer from the meta information
+        ///
+        inline Output* create_output(const std::map<std::string, int>& map)
+        {
+            const int out_id = meta_value(map, "OutputLayer");
+
+            switch (out_id)
+            {
+            case REGRESSION_MSE:
+                return new RegressionMSE();
+            case MULTI_CLASS_ENTROPY:
+                return new MultiClassEntropy();
+            }
+
+            throw std::invalid_argument("[function create_output]: Output is not of a known type");
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
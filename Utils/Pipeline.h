@@ -0,0 +1,356 @@
+#pragma once
+
+#include <Eigen/Core>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <algorithm>
+#include <utility>
+#include "../Config.h"
+#include "../Layer.h"
+#include "../Output.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        ///
+        /// Split a stack of layers into at most 'nstage' contiguous stages, so that
+        /// the cost of the most expensive stage is minimal
+        ///
+        /// \param cost      Cost of each layer
+        /// \param nstage    Number of stages
+        /// \return          The first layer of each stage, followed by the number of layers
+        ///
+        inline std::vector<int> balance_stages(const std::vector<double>& cost, int nstage)
+        {
+            const int nlayer = cost.size();
+            nstage = std::max(1, std::min(nstage, nlayer));
+
+            std::vector<double> prefix(nlayer + 1, 0.0);
+            for (int i = 0; i < nlayer; i++)
+                prefix[i + 1] = prefix[i] + cost[i];
+
+            // best[s][i]: cost of the slowest stage when the first i layers form s stages,
+            // and cut[s][i] the first layer of the last of them
+            const double inf = 1e300;
+            std::vector< std::vector<double> > best(nstage + 1, std::vector<double>(nlayer + 1, inf));
+            std::vector< std::vector<int> > cut(nstage + 1, std::vector<int>(nlayer + 1, 0));
+            best[0][0] = 0;
+            for (int s = 1; s <= nstage; s++)
+            {
+                for (int i = s; i <= nlayer; i++)
+                {
+                    for (int j = s - 1; j < i; j++)
+                    {
+                        const double slowest = std::max(best[s - 1][j], prefix[i] - prefix[j]);
+                        if (slowest < best[s][i])
+                        {
+                            best[s][i] = slowest;
+                            cut[s][i] = j;
+                        }
+                    }
+                }
+            }
+
+            std::vector<int> res(nstage + 1);
+            res[nstage] = nlayer;
+            for (int s = nstage; s > 0; s--)
+                res[s - 1] = cut[s][res[s]];
+
+            return res;
+        }
+
+        ///
+        /// GPipe-style pipeline of layer stages, each run by its own thread
+        ///
+        /// A mini-batch is split into micro-batches that enter the first stage one
+        /// after the other. A stage runs forward() on a micro-batch and hands its
+        /// output to the next stage, which lets it start on the next micro-batch
+        /// right away. The last stage evaluates the output layer and starts the
+        /// backward pass, which flows back through the stages in the same way.
+        ///
+        /// Layers hold the state of a single micro-batch. A stage keeps the input of
+        /// each micro-batch, and recomputes its forward pass before backprop() if
+        /// the state has been overwritten in the meantime. The parameter gradients
+        /// of the micro-batches are accumulated, weighted by their sizes, and set
+        /// back into the layers at the end of the mini-batch.
+        ///
+        /// The layers of a stage are only touched by its thread while run_batch()
+        /// is running.
+        ///
+        class PipelineTrainer
+        {
+        private:
+            typedef Eigen::Matrix<Scalar, Eigen::Dynamic, Eigen::Dynamic> Matrix;
+
+            struct Message
+            {
+                int micro;
+                bool backward;
+                Matrix data;
+            };
+
+            struct Stage
+            {
+                int begin;
+                int end;
+                std::deque<Message> queue;
+                bool stop;
+                std::mutex mutex;
+                std::condition_variable cv;
+                // Input of each micro-batch, kept for the recomputation
+                std::vector<Matrix> input;
+                // Micro-batch whose forward state the layers hold, or -1
+                int current;
+                std::thread thread;
+            };
+
+            const std::vector<Layer*>& m_layers;
+            Output* m_output;
+            const int m_first;
+            std::vector< std::unique_ptr<Stage> > m_stages;
+
+            std::vector<Matrix> m_target;
+            std::vector<Scalar> m_weight;
+            std::vector< std::vector<Scalar> > m_accum;
+
+            // Micro-batches whose backward pass is complete
+            std::mutex m_mutex;
+            std::condition_variable m_done_cv;
+            int m_done;
+            std::exception_ptr m_error;
+
+            void send(const int stage, Message& msg)
+            {
+                Stage& st = *m_stages[stage];
+                {
+                    std::lock_guard<std::mutex> lock(st.mutex);
+                    st.queue.push_back(std::move(msg));
+                }
+                st.cv.notify_one();
+            }
+
+            void finish_micro()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_done++;
+                }
+                m_done_cv.notify_one();
+            }
+
+            void run_forward(Stage& st, const int micro)
+            {
+                const Matrix* input = &st.input[micro];
+                for (int i = st.begin; i < st.end; i++)
+                {
+                    m_layers[i]->forward(*input);
+                    input = &m_layers[i]->output();
+                }
+                st.current = micro;
+            }
+
+            void run_backward(const int stage, const int micro, const Matrix& grad)
+            {
+                Stage& st = *m_stages[stage];
+                if (st.current != micro)
+                    run_forward(st, micro);
+
+                const int last = std::max(st.begin, m_first);
+                for (int i = st.end - 1; i >= last; i--)
+                {
+                    const Matrix& prev = (i == st.begin) ? st.input[micro] : m_layers[i - 1]->output();
+                    const Matrix& next = (i == st.end - 1) ? grad : m_layers[i + 1]->backprop_data();
+                    m_layers[i]->backprop(prev, next);
+
+                    if (m_layers[i]->trainable())
+                    {
+                        const std::vector<Scalar> deriv = m_layers[i]->get_derivatives();
+                        std::vector<Scalar>& accum = m_accum[i];
+                        for (std::size_t k = 0; k < deriv.size(); k++)
+                            accum[k] += m_weight[micro] * deriv[k];
+                    }
+                }
+                // backprop() may reuse the forward state as scratch space
+                st.current = -1;
+                st.input[micro].resize(0, 0);
+
+                if (st.begin > m_first)
+                {
+                    Message msg;
+                    msg.micro = micro;
+                    msg.backward = true;
+                    msg.data = m_layers[st.begin]->backprop_data();
+                    send(stage - 1, msg);
+                }
+                else
+                {
+                    finish_micro();
+                }
+            }
+
+            void process(const int stage, Message& msg)
+            {
+                Stage& st = *m_stages[stage];
+                if (msg.backward)
+                {
+                    run_backward(stage, msg.micro, msg.data);
+                    return;
+                }
+
+                st.input[msg.micro].swap(msg.data);
+                run_forward(st, msg.micro);
+
+                const bool last_stage = stage == static_cast<int>(m_stages.size()) - 1;
+                if (!last_stage)
+                {
+                    Message next;
+                    next.micro = msg.micro;
+                    next.backward = false;
+                    next.data = m_layers[st.end - 1]->output();
+                    // Below the first trainable layer, no backward pass comes back
+                    if (st.end <= m_first)
+                        st.input[msg.micro].resize(0, 0);
+                    send(stage + 1, next);
+                    return;
+                }
+
+                m_output->evaluate(m_layers[st.end - 1]->output(), m_target[msg.micro]);
+                run_backward(stage, msg.micro, m_output->backprop_data());
+            }
+
+            void run(const int stage)
+            {
+                Stage& st = *m_stages[stage];
+                for (;;)
+                {
+                    Message msg;
+                    {
+                        std::unique_lock<std::mutex> lock(st.mutex);
+                        st.cv.wait(lock, [&st] { return st.stop || !st.queue.empty(); });
+                        if (st.stop)
+                            return;
+                        msg = std::move(st.queue.front());
+                        st.queue.pop_front();
+                    }
+
+                    try
+                    {
+                        process(stage, msg);
+                    }
+                    catch (...)
+                    {
+                        {
+                            std::lock_guard<std::mutex> lock(m_mutex);
+                            if (!m_error)
+                                m_error = std::current_exception();
+                        }
+                        m_done_cv.notify_one();
+                    }
+                }
+            }
+
+        public:
+            ///
+            /// \param layers     Layers of the network
+            /// \param output     Output layer of the network
+            /// \param first      Index of the first trainable layer
+            /// \param bounds     First layer of each stage, followed by the number of layers,
+            ///                   see balance_stages()
+            ///
+            PipelineTrainer(const std::vector<Layer*>& layers, Output* output, const int first,
+                            const std::vector<int>& bounds) :
+                m_layers(layers), m_output(output), m_first(first), m_accum(layers.size()), m_done(0)
+            {
+                for (std::size_t i = 0; i < layers.size(); i++)
+                {
+                    if (layers[i]->trainable())
+                        m_accum[i].resize(layers[i]->get_derivatives().size());
+                }
+
+                for (std::size_t s = 0; s + 1 < bounds.size(); s++)
+                {
+                    m_stages.push_back(std::unique_ptr<Stage>(new Stage()));
+                    m_stages[s]->begin = bounds[s];
+                    m_stages[s]->end = bounds[s + 1];
+                    m_stages[s]->stop = false;
+                    m_stages[s]->current = -1;
+                }
+                for (std::size_t s = 0; s < m_stages.size(); s++)
+                    m_stages[s]->thread = std::thread(&PipelineTrainer::run, this, int(s));
+            }
+
+            ~PipelineTrainer()
+            {
+                for (std::size_t s = 0; s < m_stages.size(); s++)
+                {
+                    {
+                        std::lock_guard<std::mutex> lock(m_stages[s]->mutex);
+                        m_stages[s]->stop = true;
+                    }
+                    m_stages[s]->cv.notify_one();
+                }
+                for (std::size_t s = 0; s < m_stages.size(); s++)
+                    m_stages[s]->thread.join();
+            }
+
+            int num_stages() const { return m_stages.size(); }
+
+            ///
+            /// Run the forward and backward passes of a mini-batch split into 'nmicro'
+            /// micro-batches, and set the mean parameter gradients into the layers
+            ///
+            void run_batch(const Matrix& x, const Matrix& y, int nmicro)
+            {
+                const int nobs = x.cols();
+                nmicro = std::max(1, std::min(nmicro, nobs));
+
+                m_target.resize(nmicro);
+                m_weight.resize(nmicro);
+                for (std::size_t s = 0; s < m_stages.size(); s++)
+                    m_stages[s]->input.resize(nmicro);
+                for (std::size_t i = 0; i < m_accum.size(); i++)
+                    std::fill(m_accum[i].begin(), m_accum[i].end(), Scalar(0));
+                m_done = 0;
+
+                for (int m = 0; m < nmicro; m++)
+                {
+                    const int begin = static_cast<long long>(nobs) * m / nmicro;
+                    const int end = static_cast<long long>(nobs) * (m + 1) / nmicro;
+                    m_target[m] = y.middleCols(begin, end - begin);
+                    m_weight[m] = Scalar(end - begin) / nobs;
+
+                    Message msg;
+                    msg.micro = m;
+                    msg.backward = false;
+                    msg.data = x.middleCols(begin, end - begin);
+                    send(0, msg);
+                }
+
+                {
+                    std::unique_lock<std::mutex> lock(m_mutex);
+                    m_done_cv.wait(lock, [&] { return m_done == nmicro || m_error; });
+                    if (m_error)
+                        std::rethrow_exception(m_error);
+                }
+
+                for (std::size_t i = 0; i < m_accum.size(); i++)
+                {
+                    if (m_layers[i]->trainable())
+                        m_layers[i]->set_derivatives(m_accum[i]);
+                }
+            }
+        };
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <cstdlib>
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        ///
+        /// A fixed pool of worker threads running indexed tasks
+        ///
+        /// parallel_for() hands task indices 0, ..., ntask-1 to the workers and to the
+        /// calling thread, and returns when all of them are done. Only one
+        /// parallel_for() runs on the pool at a time. A call made while the pool
+        /// is busy with another thread's work runs serially on the caller, and so
+        /// does a call nested inside a task, which is detected without touching
+        /// the lock of the pool. Kernels can therefore always use the pool safely.
+        ///
+        class ThreadPool
+        {
+        private:
+            std::vector<std::thread> m_workers;
+
+            std::mutex m_busy;
+            std::mutex m_mutex;
+            std::condition_variable m_start_cv;
+            std::condition_variable m_done_cv;
+
+            const std::function<void(int)>* m_task;
+            int m_ntask;
+            std::atomic<int> m_next;
+            int m_finished;
+            // Number of workers currently taking tasks
+            int m_active;
+            unsigned long m_generation;
+            bool m_stop;
+
+            // Whether the current thread is running a task of a pool
+            static bool& in_parallel_region()
+            {
+                static thread_local bool inside = false;
+                return inside;
+            }
+
+            static void run_serial(const int ntask, const std::function<void(int)>& task)
+            {
+                for (int i = 0; i < ntask; i++)
+                {
+                    task(i);
+                }
+            }
+
+            // Run tasks until none is left, return the number of tasks run
+            int drain(const std::function<void(int)>& task, const int ntask)
+            {
+                int count = 0;
+                for (int i = m_next++; i < ntask; i = m_next++, count++)
+                {
+                    task(i);
+                }
+
+                return count;
+            }
+
+            void worker()
+            {
+                unsigned long seen = 0;
+                // Workers only ever run tasks
+                in_parallel_region() = true;
+                std::unique_lock<std::mutex> lock(m_mutex);
+
+                while (true)
+                {
+                    m_start_cv.wait(lock, [&] { return m_stop || m_generation != seen; });
+                    if (m_stop)
+                        return;
+
+                    seen = m_generation;
+                    // Woken up after the work was already finished
+                    if (m_task == NULL)
+                        continue;
+
+                    const std::function<void(int)>& task = *m_task;
+                    const int ntask = m_ntask;
+                    m_active++;
+                    lock.unlock();
+
+                    const int count = drain(task, ntask);
+
+                    lock.lock();
+                    m_active--;
+                    m_finished += count;
+                    if (m_finished == ntask && m_active == 0)
+                        m_done_cv.notify_one();
+                }
+            }
+
+        public:
+            explicit ThreadPool(const int nthread) :
+                m_task(NULL), m_ntask(0), m_next(0), m_finished(0), m_active(0), m_generation(0), m_stop(false)
+            {
+                // The calling thread takes part in the work
+                for (int i = 1; i < nthread; i++)
+                {
+                    m_workers.push_back(std::thread(&ThreadPool::worker, this));
+                }
+            }
+
+            ~ThreadPool()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_start_cv.notify_all();
+
+                for (std::size_t i = 0; i < m_workers.size(); i++)
+                {
+                    m_workers[i].join();
+                }
+            }
+
+            int size() const { return m_workers.size() + 1; }
+
+            void parallel_for(const int ntask, const std::function<void(int)>& task)
+            {
+                // A nested call must not try to lock m_busy, which its thread may own
+                if (ntask <= 1 || m_workers.empty() || in_parallel_region())
+                {
+                    run_serial(ntask, task);
+                    return;
+                }
+
+                std::unique_lock<std::mutex> busy(m_busy, std::try_to_lock);
+                if (!busy.owns_lock())
+                {
+                    run_serial(ntask, task);
+                    return;
+                }
+
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_task = &task;
+                m_ntask = ntask;
+                m_next = 0;
+                m_finished = 0;
+                m_generation++;
+                lock.unlock();
+                m_start_cv.notify_all();
+
+                in_parallel_region() = true;
+                const int count = drain(task, ntask);
+                in_parallel_region() = false;
+
+                lock.lock();
+                m_finished += count;
+                m_done_cv.wait(lock, [&] { return m_finished == ntask && m_active == 0; });
+                m_task = NULL;
+            }
+        };
+
+        // Size of the shared pool: the MDNN_NUM_THREADS environment variable, or
+        // the number of hardware threads
+        inline int default_num_threads()
+        {
+            const char* env = std::getenv("MDNN_NUM_THREADS");
+            const int nthread = env ? std::atoi(env) : int(std::thread::hardware_concurrency());
+            return nthread > 0 ? nthread : 1;
+        }
+
+        inline std::unique_ptr<ThreadPool>& thread_pool_instance()
+        {
+            // The initialization of a local static is thread-safe, so threads that
+            // use the pool for the first time concurrently all get the same one
+            static std::unique_ptr<ThreadPool> pool(new ThreadPool(default_num_threads()));
+            return pool;
+        }
+
+        ///
+        /// The pool shared by all kernels
+        ///
+        /// It is created on first use, with default_num_threads() threads.
+        ///
+        inline ThreadPool& thread_pool()
+        {
+            return *thread_pool_instance();
+        }
+
+        ///
+        /// Replace the shared pool by one with 'nthread' threads
+        ///
+        /// This destroys the current pool, so it is only allowed before any
+        /// concurrent use of the library: no other thread may run a kernel, a
+        /// prediction or a training, or hold a reference returned by thread_pool().
+        ///
+        inline void set_num_threads(const int nthread)
+        {
+            thread_pool_instance().reset(new ThreadPool(nthread > 0 ? nthread : 1));
+        }
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file
@@ -0,0 +1,117 @@
+#pragma once
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include "../Layer.h"
+#include "../Optimizer.h"
+
+namespace MiniDNN
+{
+
+    namespace internal
+    {
+
+
+        ///
+        /// Runs Layer::update() on a background thread, in submission order
+        ///
+        /// Network::fit() submits a layer as soon as its backprop() has returned,
+        /// and the update overlaps with the backward pass of the layers below it.
+        /// The optimizer is only called from the background thread, one update at
+        /// a time.
+        ///
+        class UpdateQueue
+        {
+        private:
+            Optimizer& m_opt;
+            std::deque<Layer*> m_queue;
+            // Submitted layers whose update has not finished
+            int m_pending;
+            bool m_stop;
+            std::exception_ptr m_error;
+            std::mutex m_mutex;
+            std::condition_variable m_cv;
+            std::condition_variable m_done_cv;
+            std::thread m_thread;
+
+            void run()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                for (;;)
+                {
+                    m_cv.wait(lock, [this] { return m_stop || !m_queue.empty(); });
+                    if (m_queue.empty())
+                        return;
+
+                    Layer* layer = m_queue.front();
+                    m_queue.pop_front();
+                    lock.unlock();
+
+                    std::exception_ptr error;
+                    try
+                    {
+                        layer->update(m_opt);
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+
+                    lock.lock();
+                    if (error && !m_error)
+                        m_error = error;
+                    m_pending--;
+                    if (m_pending == 0)
+                        m_done_cv.notify_one();
+                }
+            }
+
+        public:
+            explicit UpdateQueue(Optimizer& opt) :
+                m_opt(opt), m_pending(0), m_stop(false)
+            {
+                m_thread = std::thread(&UpdateQueue::run, this);
+            }
+
+            ~UpdateQueue()
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_stop = true;
+                }
+                m_cv.notify_one();
+                m_thread.join();
+            }
+
+            // The layer must not read or write its parameters until wait() returns
+            void submit(Layer* layer)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(m_mutex);
+                    m_queue.push_back(layer);
+                    m_pending++;
+                }
+                m_cv.notify_one();
+            }
+
+            // Wait for all the submitted updates, and rethrow the first error
+            void wait()
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_done_cv.wait(lock, [this] { return m_pending == 0; });
+                if (m_error)
+                {
+                    std::exception_ptr error = m_error;
+                    m_error = NULL;
+                    std::rethrow_exception(error);
+                }
+            }
+        };
+
+
+    } // namespace internal
+
+} // namespace MiniDNN
\ No newline at end of file